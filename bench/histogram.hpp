@@ -0,0 +1,84 @@
+#ifndef LSMTREE_BENCH_HISTOGRAM_HPP
+#define LSMTREE_BENCH_HISTOGRAM_HPP
+
+#include <cstdint>
+#include <vector>
+
+// HDR 风格的延迟直方图，单位 ns。每个 2 的幂区间再等分成 2^kSubBits 个桶，
+// 任何数值的相对误差都不超过 1 / 2^kSubBits，记录一次只是一次加法
+// <http://hdrhistogram.org/>
+class LatencyHistogram {
+ public:
+  static const int kSubBits = 7;
+
+  LatencyHistogram()
+      : _counts((64 - kSubBits + 1) << kSubBits, 0),
+        _total(0),
+        _sum(0),
+        _min(UINT64_MAX),
+        _max(0) {}
+
+  void record(uint64_t ns) {
+    _counts[bucketOf(ns)]++;
+    _total++;
+    _sum += ns;
+    _min = ns < _min ? ns : _min;
+    _max = ns > _max ? ns : _max;
+  }
+
+  void merge(const LatencyHistogram &other) {
+    for (size_t i = 0; i < _counts.size(); i++) {
+      _counts[i] += other._counts[i];
+    }
+    _total += other._total;
+    _sum += other._sum;
+    _min = other._min < _min ? other._min : _min;
+    _max = other._max > _max ? other._max : _max;
+  }
+
+  // q 在 [0, 1] 中，返回所在桶的中点
+  uint64_t percentile(double q) const {
+    if (_total == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(q * _total);
+    rank = rank < 1 ? 1 : (rank > _total ? _total : rank);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < _counts.size(); i++) {
+      seen += _counts[i];
+      if (seen >= rank) {
+        uint64_t v = valueOf(i);
+        return v > _max ? _max : v;
+      }
+    }
+    return _max;
+  }
+
+  uint64_t count() const { return _total; }
+  uint64_t min() const { return _total ? _min : 0; }
+  uint64_t max() const { return _max; }
+  double mean() const { return _total ? _sum / _total : 0; }
+
+ private:
+  std::vector<uint64_t> _counts;
+  uint64_t _total;
+  double _sum;
+  uint64_t _min;
+  uint64_t _max;
+
+  // 小于 2^kSubBits 的值每个值一个桶，之后每个 2^e 区间 2^kSubBits 个桶
+  static size_t bucketOf(uint64_t v) {
+    if (v < (1ull << kSubBits)) return v;
+    int shift = 63 - __builtin_clzll(v) - kSubBits;
+    return (static_cast<size_t>(shift + 1) << kSubBits) +
+           ((v >> shift) - (1ull << kSubBits));
+  }
+
+  static uint64_t valueOf(size_t bucket) {
+    if (bucket < (1ull << kSubBits)) return bucket;
+    int shift = static_cast<int>(bucket >> kSubBits) - 1;
+    uint64_t low = ((bucket & ((1ull << kSubBits) - 1)) + (1ull << kSubBits))
+                   << shift;
+    return low + ((1ull << shift) >> 1);
+  }
+};
+
+#endif  // LSMTREE_BENCH_HISTOGRAM_HPP
@@ -0,0 +1,411 @@
+// YCSB 风格的端到端 benchmark。先 load 再依次运行各个 workload，
+// 每个 workload 每种操作一行 JSON，包括吞吐和 p50/p99/p999 延迟。
+//
+//   lsm_bench --workloads=load,a,b,c,e --records=1000000 --threads=4
+//             --distribution=zipfian --dir=/tmp/lsm_bench
+//
+// 不带参数运行时用默认参数，--help 列出所有参数
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "histogram.hpp"
+#include "lsm.hpp"
+
+namespace {
+
+enum OpType { READ, UPDATE, INSERT, DELETE, SCAN, NUM_OPS };
+const char *kOpNames[NUM_OPS] = {"read", "update", "insert", "delete", "scan"};
+
+// 各种操作的比例，和为 1
+struct Workload {
+  std::string name;
+  double mix[NUM_OPS];
+};
+
+// load 只插入；a-e 同 YCSB core workloads，d (read latest) 没有实现
+const Workload kWorkloads[] = {
+    {"load", {0, 0, 1, 0, 0}},
+    {"a", {0.5, 0.5, 0, 0, 0}},
+    {"b", {0.95, 0.05, 0, 0, 0}},
+    {"c", {1, 0, 0, 0, 0}},
+    {"e", {0, 0, 0.05, 0, 0.95}},
+    {"deletes", {0.4, 0.3, 0, 0.3, 0}},
+    {"scans", {0.1, 0.1, 0, 0, 0.8}},
+};
+
+struct Options {
+  // LSM 构造参数
+  long eltsPerRun = 100000;
+  int numRuns = 8;
+  double fracMerged = 1.0;
+  double bfFalsePositive = 0.01;
+  int blockSize = 1024;
+  int diskRunsPerLevel = 10;
+
+  std::string policy = "tiering";  // tiering / leveling / lazy-leveling
+  int sizeRatio = 0;               // 0 表示用 diskRunsPerLevel
+  std::string dir;                 // 为空时不调用 open
+  std::string sync = "none";       // none / interval / group
+  long cacheBytes = 0;             // 0 表示不用 block cache
+  bool io = false;                 // 批量读是否用 IOEngine
+  int mergeThreads = 0;
+  bool compress = false;
+
+  std::string workloads = "load,a,b,c,e";
+  std::string distribution = "zipfian";  // zipfian / uniform
+  double zipfTheta = 0.99;
+  long records = 1000000;
+  long operations = 1000000;
+  int threads = 4;
+  int maxScan = 100;
+  uint64_t seed = 1;
+  bool stats = false;  // 结束时把 LSM 的计数打印到 stderr
+};
+
+void usage(const char *prog) {
+  Options o;
+  fprintf(stderr,
+          "usage: %s [--flag=value ...]\n"
+          "  --elts_per_run=%ld --num_runs=%d --frac_merged=%g\n"
+          "  --bf_fp=%g --block_size=%d --disk_runs_per_level=%d\n"
+          "  --policy=tiering|leveling|lazy-leveling --size_ratio=N\n"
+          "  --dir=PATH --sync=none|interval|group --cache_bytes=N --io=0|1\n"
+          "  --merge_threads=N --compress=0|1\n"
+          "  --workloads=load,a,b,c,e,deletes,scans\n"
+          "  --distribution=zipfian|uniform --zipf_theta=%g\n"
+          "    (zipfian only picks among the loaded records; records inserted\n"
+          "    by a workload are read only under uniform)\n"
+          "  --records=%ld --operations=%ld --threads=%d --max_scan=%d "
+          "--seed=%llu --stats=0|1\n",
+          prog, o.eltsPerRun, o.numRuns, o.fracMerged, o.bfFalsePositive,
+          o.blockSize, o.diskRunsPerLevel, o.zipfTheta, o.records,
+          o.operations, o.threads, o.maxScan,
+          static_cast<unsigned long long>(o.seed));
+}
+
+// arg 是 --name=value 时取出 value
+bool flagValue(const char *arg, const char *name, std::string &value) {
+  size_t len = strlen(name);
+  if (strncmp(arg, "--", 2) != 0 || strncmp(arg + 2, name, len) != 0 ||
+      arg[2 + len] != '=') {
+    return false;
+  }
+  value = arg + 3 + len;
+  return true;
+}
+
+Options parseOptions(int argc, char *argv[]) {
+  Options o;
+  for (int i = 1; i < argc; i++) {
+    std::string v;
+    const char *a = argv[i];
+    if (flagValue(a, "elts_per_run", v)) o.eltsPerRun = atol(v.c_str());
+    else if (flagValue(a, "num_runs", v)) o.numRuns = atoi(v.c_str());
+    else if (flagValue(a, "frac_merged", v)) o.fracMerged = atof(v.c_str());
+    else if (flagValue(a, "bf_fp", v)) o.bfFalsePositive = atof(v.c_str());
+    else if (flagValue(a, "block_size", v)) o.blockSize = atoi(v.c_str());
+    else if (flagValue(a, "disk_runs_per_level", v))
+      o.diskRunsPerLevel = atoi(v.c_str());
+    else if (flagValue(a, "policy", v)) o.policy = v;
+    else if (flagValue(a, "size_ratio", v)) o.sizeRatio = atoi(v.c_str());
+    else if (flagValue(a, "dir", v)) o.dir = v;
+    else if (flagValue(a, "sync", v)) o.sync = v;
+    else if (flagValue(a, "cache_bytes", v)) o.cacheBytes = atol(v.c_str());
+    else if (flagValue(a, "io", v)) o.io = atoi(v.c_str()) != 0;
+    else if (flagValue(a, "merge_threads", v))
+      o.mergeThreads = atoi(v.c_str());
+    else if (flagValue(a, "compress", v)) o.compress = atoi(v.c_str()) != 0;
+    else if (flagValue(a, "workloads", v)) o.workloads = v;
+    else if (flagValue(a, "distribution", v)) o.distribution = v;
+    else if (flagValue(a, "zipf_theta", v)) o.zipfTheta = atof(v.c_str());
+    else if (flagValue(a, "records", v)) o.records = atol(v.c_str());
+    else if (flagValue(a, "operations", v)) o.operations = atol(v.c_str());
+    else if (flagValue(a, "threads", v)) o.threads = atoi(v.c_str());
+    else if (flagValue(a, "max_scan", v)) o.maxScan = atoi(v.c_str());
+    else if (flagValue(a, "seed", v)) o.seed = strtoull(v.c_str(), 0, 10);
+    else if (flagValue(a, "stats", v)) o.stats = atoi(v.c_str()) != 0;
+    else {
+      usage(argv[0]);
+      exit(strcmp(a, "--help") == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+
+  if (o.eltsPerRun <= 0 || o.numRuns <= 0 || o.records <= 0 ||
+      o.threads <= 0 || o.maxScan <= 0 ||
+      (o.distribution != "zipfian" && o.distribution != "uniform")) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  return o;
+}
+
+uint64_t fnv64(uint64_t x) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (int i = 0; i < 8; i++) {
+    h ^= x & 0xff;
+    h *= 0x100000001b3ull;
+    x >>= 8;
+  }
+  return h;
+}
+
+// 第 id 条记录的 key。和 YCSB 一样按 hash 打散，插入顺序不是 key 的顺序
+int keyOf(uint64_t id) { return static_cast<int>(fnv64(id) >> 33); }
+
+// [0, n) 上的 zipfian 分布，0 最热。按 hash 打散之后热点不集中在一段 key 上
+// <https://dl.acm.org/doi/10.1145/191843.191886>
+class ScrambledZipfian {
+ public:
+  ScrambledZipfian(uint64_t n, double theta) : _n(n), _theta(theta) {
+    double zeta2 = 1 + pow(0.5, theta);
+    _zetan = 0;
+    for (uint64_t i = 1; i <= n; i++) _zetan += 1 / pow(i, theta);
+    _alpha = 1 / (1 - theta);
+    _eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / _zetan);
+    _half = 1 + pow(0.5, theta);
+  }
+
+  uint64_t next(std::mt19937_64 &rng) {
+    double u = std::uniform_real_distribution<double>(0, 1)(rng);
+    double uz = u * _zetan;
+    uint64_t item;
+    if (uz < 1) {
+      item = 0;
+    } else if (uz < _half) {
+      item = 1;
+    } else {
+      item = static_cast<uint64_t>(_n * pow(_eta * u - _eta + 1, _alpha));
+    }
+    return fnv64(item) % _n;
+  }
+
+ private:
+  uint64_t _n;
+  double _theta, _zetan, _alpha, _eta, _half;
+};
+
+struct ThreadStats {
+  LatencyHistogram hist[NUM_OPS];
+  long notFound = 0;
+};
+
+class Bench {
+ public:
+  explicit Bench(const Options &o)
+      : _o(o),
+        _lsm(o.eltsPerRun, o.numRuns, o.fracMerged, o.bfFalsePositive,
+             o.blockSize, o.diskRunsPerLevel),
+        _inserted(o.records) {
+    int ratio = o.sizeRatio > 0 ? o.sizeRatio : o.diskRunsPerLevel;
+    if (o.policy == "leveling") {
+      _lsm.setCompactionPolicy(std::make_shared<LevelingPolicy>(ratio));
+    } else if (o.policy == "lazy-leveling") {
+      _lsm.setCompactionPolicy(std::make_shared<LazyLevelingPolicy>(ratio));
+    } else if (o.policy == "tiering") {
+      _lsm.setCompactionPolicy(
+          std::make_shared<TieringPolicy>(ratio, o.fracMerged));
+    } else {
+      fprintf(stderr, "Unknown compaction policy %s\n", o.policy.c_str());
+      exit(EXIT_FAILURE);
+    }
+    if (o.cacheBytes > 0) {
+      _lsm.setBlockCache(std::make_shared<BlockCache>(o.cacheBytes));
+    }
+    if (o.io) {
+      _lsm.setIOEngine(IOEngine::create());
+    }
+    if (o.mergeThreads > 0) {
+      _lsm.setMergeThreads(o.mergeThreads);
+    }
+    _lsm.setValueCompression(o.compress);
+    if (!o.dir.empty()) {
+      WalSyncMode mode = o.sync == "group"      ? WalSyncMode::GROUP_COMMIT
+                         : o.sync == "interval" ? WalSyncMode::INTERVAL
+                                                : WalSyncMode::NONE;
+      _lsm.open(o.dir, mode, 10);
+    }
+    if (o.distribution == "zipfian") {
+      _zipf.reset(new ScrambledZipfian(o.records, o.zipfTheta));
+    }
+  }
+
+  void run(const Workload &w) {
+    // load 插入全部 records，其余 workload 执行 operations 次操作
+    bool load = w.name == "load";
+    long total = load ? _o.records : _o.operations;
+    std::vector<ThreadStats> stats(_o.threads);
+    std::vector<std::thread> workers;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < _o.threads; t++) {
+      long lo = total * t / _o.threads, hi = total * (t + 1) / _o.threads;
+      workers.emplace_back([&, t, lo, hi]() {
+        std::mt19937_64 rng(_o.seed * 1000003 + t);
+        for (long i = lo; i < hi; i++) {
+          if (load) {
+            timed(stats[t], INSERT, [&]() { insert(rng, i); });
+          } else {
+            OpType op = chooseOp(w, rng);
+            timed(stats[t], op, [&]() { execute(op, rng, stats[t]); });
+          }
+        }
+      });
+    }
+    for (auto &worker : workers) {
+      worker.join();
+    }
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start).count();
+    report(w.name, stats, seconds);
+  }
+
+  void printStats() {
+    fprintf(stderr, "%s", _lsm.getStats().toString().c_str());
+  }
+
+ private:
+  const Options _o;
+  LSM<int, int> _lsm;
+  std::unique_ptr<ScrambledZipfian> _zipf;
+  std::atomic<long> _inserted;  // 记录数，load 的 id 是 [0, records)，之后插入的 id 从这里分配
+
+  template <class Fn>
+  static void timed(ThreadStats &stats, OpType op, Fn fn) {
+    auto t0 = std::chrono::steady_clock::now();
+    fn();
+    auto t1 = std::chrono::steady_clock::now();
+    stats.hist[op].record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0)
+            .count());
+  }
+
+  static OpType chooseOp(const Workload &w, std::mt19937_64 &rng) {
+    double u = std::uniform_real_distribution<double>(0, 1)(rng);
+    for (int op = 0; op < NUM_OPS; op++) {
+      if (u < w.mix[op]) return static_cast<OpType>(op);
+      u -= w.mix[op];
+    }
+    return READ;
+  }
+
+  // 已有记录中按分布选一条。zipfian 的分布只在构造时按 load 的记录建一次，
+  // workload 中新插入的记录不会被选到，uniform 才会选到
+  long chooseRecord(std::mt19937_64 &rng) {
+    if (_zipf) return _zipf->next(rng);
+    long n = _inserted.load(std::memory_order_relaxed);
+    return std::uniform_int_distribution<long>(0, n > 0 ? n - 1 : 0)(rng);
+  }
+
+  static int randomValue(std::mt19937_64 &rng) {
+    return static_cast<int>(rng() & 0x7fffffff);
+  }
+
+  void insert(std::mt19937_64 &rng, long id) {
+    int key = keyOf(id), value = randomValue(rng);
+    _lsm.insertKey(key, value);
+  }
+
+  void execute(OpType op, std::mt19937_64 &rng, ThreadStats &stats) {
+    int key = keyOf(op == INSERT ? _inserted.fetch_add(1) : chooseRecord(rng));
+    switch (op) {
+      case READ: {
+        int value;
+        if (!_lsm.search(key, value)) stats.notFound++;
+        break;
+      }
+      case UPDATE:
+      case INSERT: {
+        int value = randomValue(rng);
+        _lsm.insertKey(key, value);
+        break;
+      }
+      case DELETE:
+        _lsm.deleteKey(key);
+        break;
+      case SCAN: {
+        int len = std::uniform_int_distribution<int>(1, _o.maxScan)(rng);
+        auto it = _lsm.newIterator();
+        for (it->seek(key); it->valid() && len > 0; it->next()) len--;
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+  void report(const std::string &name, std::vector<ThreadStats> &stats,
+              double seconds) {
+    LatencyHistogram all;
+    long notFound = 0;
+    for (int op = 0; op < NUM_OPS; op++) {
+      LatencyHistogram h;
+      for (auto &s : stats) h.merge(s.hist[op]);
+      if (h.count() == 0) continue;
+      all.merge(h);
+      printLine(name, kOpNames[op], h, seconds);
+    }
+    for (auto &s : stats) notFound += s.notFound;
+    printLine(name, "all", all, seconds);
+    // merge 线程可能还在增加 disk levels，从 version 中读层数。
+    // levels[0] 是内存中的 runs
+    fprintf(stderr, "%s: %.2fs, %ld reads not found, %ld disk levels\n",
+            name.c_str(), seconds, notFound,
+            static_cast<long>(_lsm.getStats().levels.size()) - 1);
+  }
+
+  void printLine(const std::string &name, const char *op,
+                 const LatencyHistogram &h, double seconds) {
+    printf("{\"workload\":\"%s\",\"op\":\"%s\",\"threads\":%d,"
+           "\"ops\":%llu,\"seconds\":%.3f,\"ops_per_sec\":%.1f,"
+           "\"mean_us\":%.3f,\"p50_us\":%.3f,\"p99_us\":%.3f,"
+           "\"p999_us\":%.3f,\"max_us\":%.3f}\n",
+           name.c_str(), op, _o.threads,
+           static_cast<unsigned long long>(h.count()), seconds,
+           h.count() / seconds, h.mean() / 1e3, h.percentile(0.5) / 1e3,
+           h.percentile(0.99) / 1e3, h.percentile(0.999) / 1e3,
+           h.max() / 1e3);
+    fflush(stdout);
+  }
+};
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  Options o = parseOptions(argc, argv);
+
+  std::vector<const Workload *> plan;
+  std::stringstream ss(o.workloads);
+  std::string name;
+  while (std::getline(ss, name, ',')) {
+    const Workload *found = nullptr;
+    for (auto &w : kWorkloads) {
+      if (w.name == name) found = &w;
+    }
+    if (found == nullptr) {
+      fprintf(stderr, "Unknown workload %s\n", name.c_str());
+      exit(EXIT_FAILURE);
+    }
+    plan.push_back(found);
+  }
+
+  Bench bench(o);
+  for (auto w : plan) {
+    bench.run(*w);
+  }
+  if (o.stats) {
+    bench.printStats();
+  }
+  return 0;
+}
@@ -1,8 +1,8 @@
 #include <iostream>
 using namespace std;
 
-// TODO: Add Tests
+// 测试在 src/*_test.cpp 中，用 ctest 运行
 
 int main(int argc, char* argv[]) {
-  cout << "No Tests." << endl;
+  cout << "Run the tests with ctest." << endl;
 }
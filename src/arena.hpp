@@ -0,0 +1,86 @@
+#ifndef LSMTREE_ARENA_HPP
+#define LSMTREE_ARENA_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// 线程安全的 bump allocator。内存按 block 申请，分配只需要一次 fetch_add，
+// 当前 block 用完时才加锁换新的 block。不能单独释放，析构时一次性释放所有 block，
+// 用于一个 memtable run 的全部节点。
+class Arena {
+ public:
+  static const size_t kAlign = alignof(void *);
+
+  explicit Arena(size_t blockSize = 64 * 1024)
+      : _blockSize(blockSize), _memoryUsage(0) {
+    _current.store(newBlock(_blockSize), std::memory_order_release);
+  }
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  ~Arena() {
+    for (Block *block : _blocks) {
+      ::operator delete(block);
+    }
+  }
+
+  // 返回 kAlign 对齐的 bytes 字节
+  char *allocate(size_t bytes) {
+    size_t need = (bytes + kAlign - 1) & ~(kAlign - 1);
+    if (need > _blockSize / 4) {
+      // 大对象单独一个 block，避免浪费当前 block 的剩余空间
+      std::lock_guard<std::mutex> lk(_mu);
+      return newBlock(need)->data();
+    }
+
+    while (true) {
+      Block *block = _current.load(std::memory_order_acquire);
+      size_t offset = block->used.fetch_add(need, std::memory_order_relaxed);
+      if (offset + need <= block->size) {
+        return block->data() + offset;
+      }
+
+      std::lock_guard<std::mutex> lk(_mu);
+      if (_current.load(std::memory_order_relaxed) == block) {
+        _current.store(newBlock(_blockSize), std::memory_order_release);
+      }
+    }
+  }
+
+  size_t memoryUsage() const {
+    return _memoryUsage.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Block {
+    std::atomic<size_t> used;
+    size_t size;
+    char *data() {
+      return reinterpret_cast<char *>(this) + kHeaderSize;
+    }
+  };
+  static const size_t kHeaderSize = (sizeof(Block) + 15) & ~size_t(15);
+
+  size_t _blockSize;
+  std::atomic<size_t> _memoryUsage;
+  std::atomic<Block *> _current;
+  std::vector<Block *> _blocks;
+  std::mutex _mu;
+
+  // 调用方持有 _mu（构造时除外）
+  Block *newBlock(size_t size) {
+    Block *block = static_cast<Block *>(::operator new(kHeaderSize + size));
+    new (&block->used) std::atomic<size_t>(0);
+    block->size = size;
+    _blocks.push_back(block);
+    _memoryUsage.fetch_add(kHeaderSize + size, std::memory_order_relaxed);
+    return block;
+  }
+};
+
+#endif  // LSMTREE_ARENA_HPP
@@ -0,0 +1,196 @@
+#ifndef LSMTREE_BLOCK_CACHE_HPP
+#define LSMTREE_BLOCK_CACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// disk runs 用 pread 读出的 block 的缓存，总大小不超过 capacity 字节。
+// 按 (run, block) 的 hash 分成 2^shardBits 个 shard，每个 shard 一把锁，
+// 各自占 capacity 的一份，用 CLOCK 淘汰。每个 entry 有一个计数，插入和命中时
+// 设成所在 level 的优先级，时钟指针扫过时减一，减到 0 之后才淘汰，
+// 优先级高的 level 的 block 能多留几圈。被淘汰的 block 在读者放掉引用之后释放
+class BlockCache {
+ public:
+  typedef std::shared_ptr<const std::string> Block;
+  typedef uint64_t Key;  // run 编号 << 32 | block 下标
+
+  static const int kMaxLevels = 64;
+  static const int kMaxPriority = 7;
+  static const int kDefaultPriority = 1;
+
+  explicit BlockCache(size_t capacity, int shardBits = 4)
+      : _capacity(capacity), _shardBits(shardBits), _hits(0), _misses(0) {
+    for (int i = 0; i < (1 << _shardBits); i++) {
+      _shards.emplace_back(new Shard());
+      _shards.back()->capacity = capacity >> _shardBits;
+    }
+    for (int i = 0; i < kMaxLevels; i++) {
+      _priority[i] = kDefaultPriority;
+    }
+  }
+
+  // 每个使用 cache 的 run 一个编号，run 内的 block 用下标区分
+  static uint64_t newID() {
+    static std::atomic<uint64_t> id(0);
+    return id.fetch_add(1);
+  }
+
+  Block lookup(uint64_t id, uint32_t block) {
+    Key key = makeKey(id, block);
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lk(shard.lock);
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+      _misses.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    _hits.fetch_add(1, std::memory_order_relaxed);
+    Entry &entry = shard.slots[it->second];
+    entry.refs = entry.priority;
+    return entry.data;
+  }
+
+  // 比一个 shard 还大的 block 不缓存
+  void insert(uint64_t id, uint32_t block, Block data, int level) {
+    Key key = makeKey(id, block);
+    Shard &shard = shardOf(key);
+    size_t charge = data->size();
+    if (charge > shard.capacity) {
+      return;
+    }
+
+    int priority = getLevelPriority(level);
+    std::lock_guard<std::mutex> lk(shard.lock);
+    if (shard.index.count(key)) {
+      return;  // 并发读同一个 block，保留先插入的
+    }
+    while (shard.usage + charge > shard.capacity) {
+      evictOne(shard);
+    }
+
+    size_t slot;
+    if (shard.freeSlots.empty()) {
+      slot = shard.slots.size();
+      shard.slots.emplace_back();
+    } else {
+      slot = shard.freeSlots.back();
+      shard.freeSlots.pop_back();
+    }
+    shard.slots[slot] =
+        Entry{key, std::move(data), charge, priority, priority};
+    shard.index[key] = slot;
+    shard.usage += charge;
+  }
+
+  // run 的文件删除之后丢掉它的 blocks，不再占用预算
+  void erase(uint64_t id, uint32_t numBlocks) {
+    for (uint32_t b = 0; b < numBlocks; b++) {
+      Key key = makeKey(id, b);
+      Shard &shard = shardOf(key);
+      std::lock_guard<std::mutex> lk(shard.lock);
+      auto it = shard.index.find(key);
+      if (it != shard.index.end()) {
+        remove(shard, it->second);
+      }
+    }
+  }
+
+  // level 越上层读得越多，可以给更高的优先级。优先级为 0 的 block 在时钟
+  // 指针第一次扫过时就淘汰。只影响之后插入和命中的 blocks
+  void setLevelPriority(int level, int priority) {
+    priority = priority < 0 ? 0 : (priority > kMaxPriority ? kMaxPriority
+                                                           : priority);
+    _priority[clampLevel(level)] = priority;
+  }
+
+  int getLevelPriority(int level) { return _priority[clampLevel(level)]; }
+
+  size_t getCapacity() { return _capacity; }
+
+  size_t getUsage() {
+    size_t usage = 0;
+    for (auto &shard : _shards) {
+      std::lock_guard<std::mutex> lk(shard->lock);
+      usage += shard->usage;
+    }
+    return usage;
+  }
+
+  uint64_t getHits() { return _hits.load(); }
+  uint64_t getMisses() { return _misses.load(); }
+
+ private:
+  struct Entry {
+    Key key;
+    Block data;  // 为空表示空闲的 slot
+    size_t charge;
+    int priority;
+    int refs;
+  };
+
+  struct Shard {
+    std::mutex lock;
+    std::unordered_map<Key, size_t> index;  // key -> slot
+    std::vector<Entry> slots;               // 时钟指针扫描的环
+    std::vector<size_t> freeSlots;
+    size_t hand = 0;
+    size_t usage = 0;
+    size_t capacity = 0;
+  };
+
+  size_t _capacity;
+  int _shardBits;
+  std::vector<std::unique_ptr<Shard>> _shards;
+  std::atomic<int> _priority[kMaxLevels];
+  std::atomic<uint64_t> _hits;
+  std::atomic<uint64_t> _misses;
+
+  static Key makeKey(uint64_t id, uint32_t block) {
+    return (id << 32) | block;
+  }
+
+  static int clampLevel(int level) {
+    return level < 0 ? 0 : (level >= kMaxLevels ? kMaxLevels - 1 : level);
+  }
+
+  Shard &shardOf(Key key) {
+    if (_shardBits == 0) return *_shards[0];
+    uint64_t h = key * 0x9e3779b97f4a7c15ull;
+    return *_shards[h >> (64 - _shardBits)];
+  }
+
+  // 调用方持有 shard.lock，shard 中至少有一个 entry
+  void evictOne(Shard &shard) {
+    while (true) {
+      if (shard.hand >= shard.slots.size()) {
+        shard.hand = 0;
+      }
+      Entry &entry = shard.slots[shard.hand];
+      size_t slot = shard.hand++;
+      if (!entry.data) {
+        continue;
+      }
+      if (entry.refs > 0) {
+        entry.refs--;
+        continue;
+      }
+      remove(shard, slot);
+      return;
+    }
+  }
+
+  void remove(Shard &shard, size_t slot) {
+    Entry &entry = shard.slots[slot];
+    shard.index.erase(entry.key);
+    shard.usage -= entry.charge;
+    entry.data.reset();
+    shard.freeSlots.push_back(slot);
+  }
+};
+
+#endif  // LSMTREE_BLOCK_CACHE_HPP
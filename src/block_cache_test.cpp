@@ -0,0 +1,110 @@
+#include <map>
+#include <memory>
+#include <string>
+
+#include "block_cache.hpp"
+#include "lsm.hpp"
+#include "test_util.hpp"
+
+BlockCache::Block makeBlock(size_t size, char c) {
+  return std::make_shared<const std::string>(size, c);
+}
+
+// 插入超过预算的 blocks 时淘汰旧的，占用不超过 capacity，
+// 比一个 shard 还大的 block 不缓存
+void testBudget() {
+  BlockCache cache(1000, 0);
+  for (uint32_t b = 0; b < 100; b++) {
+    cache.insert(1, b, makeBlock(100, 'a'), 1);
+    CHECK(cache.getUsage() <= cache.getCapacity());
+    CHECK(cache.lookup(1, b) != nullptr);  // 刚插入的一定在
+  }
+  CHECK(cache.getUsage() == 1000);
+  int cached = 0;
+  for (uint32_t b = 0; b < 100; b++) cached += cache.lookup(1, b) != nullptr;
+  CHECK(cached == 10);
+
+  cache.insert(2, 0, makeBlock(1001, 'b'), 1);
+  CHECK(cache.lookup(2, 0) == nullptr);
+  CHECK(cache.getUsage() == 1000);
+
+  // 分成多个 shard 时每个 shard 各自不超过自己的一份
+  BlockCache sharded(1 << 16, 4);
+  for (uint32_t b = 0; b < 10000; b++) {
+    sharded.insert(b % 7, b, makeBlock(50 + b % 200, 'c'), 1);
+  }
+  CHECK(sharded.getUsage() <= sharded.getCapacity());
+  CHECK(sharded.getUsage() > sharded.getCapacity() / 2);
+}
+
+// 优先级为 0 的 level 的 blocks 先被淘汰，命中的 block 重新得到优先级，
+// 一直被读的高优先级 block 不会被淘汰
+void testEvictionPriority() {
+  BlockCache cache(1000, 0);
+  cache.setLevelPriority(1, BlockCache::kMaxPriority);
+  cache.setLevelPriority(2, 0);
+  CHECK(cache.getLevelPriority(1) == BlockCache::kMaxPriority);
+  CHECK(cache.getLevelPriority(2) == 0);
+  CHECK(cache.getLevelPriority(-1) == cache.getLevelPriority(0));
+
+  cache.insert(1, 0, makeBlock(100, 'h'), 1);
+  for (uint32_t b = 0; b < 9; b++) cache.insert(2, b, makeBlock(100, 'c'), 2);
+  for (uint32_t b = 9; b < 200; b++) {
+    cache.insert(2, b, makeBlock(100, 'c'), 2);
+    CHECK(cache.lookup(1, 0) != nullptr);
+  }
+
+  // 没有再被读之后，高优先级的 block 扫过几圈之后也会被淘汰
+  for (uint32_t b = 200; b < 300; b++) {
+    cache.insert(2, b, makeBlock(100, 'c'), 2);
+  }
+  CHECK(cache.lookup(1, 0) == nullptr);
+  CHECK(cache.getUsage() == 1000);
+}
+
+// 被淘汰或者 erase 的 block 在读者放掉引用之前仍然可读，
+// erase 之后不再占用预算，命中和未命中分别计数
+void testEraseAndCounters() {
+  BlockCache cache(1000, 0);
+  for (uint32_t b = 0; b < 5; b++) cache.insert(7, b, makeBlock(100, 'x'), 1);
+  BlockCache::Block held = cache.lookup(7, 3);
+  CHECK(held != nullptr && *held == std::string(100, 'x'));
+  CHECK(cache.getHits() == 1 && cache.getMisses() == 0);
+
+  cache.erase(7, 5);
+  CHECK(cache.getUsage() == 0);
+  CHECK(cache.lookup(7, 3) == nullptr);
+  CHECK(cache.getMisses() == 1);
+  CHECK(*held == std::string(100, 'x'));
+
+  // 同一个 block 重复插入时保留先插入的
+  cache.insert(8, 0, makeBlock(100, 'p'), 1);
+  cache.insert(8, 0, makeBlock(100, 'q'), 1);
+  CHECK(*cache.lookup(8, 0) == std::string(100, 'p'));
+  CHECK(cache.getUsage() == 100);
+}
+
+// disk runs 通过一个很小的 cache 读：结果正确，占用不超过预算，
+// 重复的读能命中
+void testLSMWithSmallCache() {
+  TempDir tmp;
+  auto cache = std::make_shared<BlockCache>(64 << 10);
+  TestLSM lsm(200, 4, 0.5, 0.01, 16, 3);
+  lsm.setBlockCache(cache);
+  lsm.open(tmp.path(), WalSyncMode::NONE);
+  std::map<int, int> ref;
+  writeRandom(lsm, ref, 30000, 1, 5000);
+  checkContents(lsm, ref, 5000);
+  checkContents(lsm, ref, 5000);
+  CHECK(cache->getUsage() <= cache->getCapacity());
+  CHECK(cache->getUsage() > 0);
+  CHECK(cache->getHits() > 0 && cache->getMisses() > 0);
+}
+
+int main() {
+  RUN_TEST(testBudget);
+  RUN_TEST(testEvictionPriority);
+  RUN_TEST(testEraseAndCounters);
+  RUN_TEST(testLSMWithSmallCache);
+  return 0;
+}
@@ -5,58 +5,287 @@
 #ifndef LSMTREE_BLOOM_FILTER_HPP
 #define LSMTREE_BLOOM_FILTER_HPP
 
+#include <algorithm>
 #include <array>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
 #include <vector>
 
-#include "murmur3.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LSMTREE_BLOOM_X86 1
+#endif
 
-// <https://findingprotopia.org/posts/how-to-write-a-bloom-filter-cpp/>
+#include "murmur3.hpp"
+#include "slice.hpp"
 
+// Split-block bloom filter: 每个 key 的所有 probe 都落在同一个 64 字节的
+// cache line 内，一次 miss 最多只会碰到一条 cache line。
+// line 由 hash 的高 64 位乘 line 数取高位选出（multiply-shift，不做取模，
+// 也不要求 line 数是 2 的幂，filter 的大小可以精确地按 bits 预算分配），
+// line 内再用一位选出 256 bit 的半块，8 个 probe 各在半块的一个 32 bit word 里置一位，
+// AVX2 下一次向量比较就能测完 8 个 probe。
+// <https://github.com/apache/parquet-format/blob/master/BloomFilter.md>
 template <class Key>
-class BloomFilter {
+class BlockedBloomFilter {
  public:
-  BloomFilter(uint64_t _n, double _p) {
-    double m = -1 * static_cast<double>(_n) * log(_p) /
-               0.480453013918201;            // 0.480453013918201 = ln(2) ^ 2;
-    k = ceil((m / _n) * 0.693147180559945);  // 0.693147180559945 = ln(2);
-    b = std::vector<bool>((int)m);
+  static const int kWordsPerLine = 16;  // 16 * 32 bit = 64 bytes
+  static const int kProbes = 8;
+
+  struct alignas(64) Line {
+    uint32_t words[kWordsPerLine];
+  };
+
+  BlockedBloomFilter(uint64_t _n, double _p) : lines(nullptr), numLines(0) {
+    reset(_n, _p);
+  }
+
+  BlockedBloomFilter(const BlockedBloomFilter &) = delete;
+  BlockedBloomFilter &operator=(const BlockedBloomFilter &) = delete;
+
+  ~BlockedBloomFilter() { free(lines); }
+
+  // 按新的元素个数和假阳性率重新分配，清空所有位
+  void reset(uint64_t _n, double _p) {
+    free(lines);
+    lines = nullptr;
+    numLines = 0;
+    if (_n == 0 || _p >= 1.0) {
+      return;  // 没有 filter，isContain 永远返回 true
+    }
+    allocate(static_cast<uint64_t>(ceil(bitsFor(_n, _p) / (kWordsPerLine * 32))));
   }
 
-  std::array<uint64_t, 2> hash(const Key *data, size_t len) {
+  static double bitsFor(uint64_t _n, double _p) {
+    return -1 * static_cast<double>(_n) * log(_p) / 0.480453013918201;
+  }
+
+  typedef typename SliceTraits<Key>::View KeyView;
+
+  static std::array<uint64_t, 2> hash(const void *data, size_t len) {
     std::array<uint64_t, 2> hashValue;
     MurmurHash3_x64_128(data, static_cast<int>(len), 0, hashValue.data());
     return hashValue;
   }
 
-  inline uint64_t nthHash(uint32_t n, uint64_t hashA, uint64_t hashB,
-                          uint64_t filterSize) {
-    return (hashA + n * hashB) % filterSize;
+  // 定长的 key hash 它的字节，变长的 key 只 hash 内容
+  static std::array<uint64_t, 2> hash(const KeyView &key) {
+    return hash(SliceTraits<Key>::data(key), SliceTraits<Key>::size(key));
+  }
+
+  void add(const KeyView &key) { addHash(hash(key)); }
+  void addConcurrent(const KeyView &key) { addHashConcurrent(hash(key)); }
+  bool isContain(const KeyView &key) const {
+    return numLines == 0 || isContainHash(hash(key));
   }
 
-  void add(const Key *data, std::size_t len) {
-    auto hashValues = hash(data, len);
+  void add(const void *data, std::size_t len) {
+    addHash(hash(data, len));
+  }
 
-    for (int n = 0; n < k; n++) {
-      b[nthHash(n, hashValues[0], hashValues[1], b.size())] = true;
+  void addHash(const std::array<uint64_t, 2> &hashValues) {
+    if (numLines == 0) return;
+    uint32_t *words = halfLine(hashValues[0]);
+    uint32_t h = static_cast<uint32_t>(hashValues[1]);
+    for (int n = 0; n < kProbes; n++) {
+      words[n] |= probeBit(h, n);
     }
   }
 
-  bool isContain(const Key *data, std::size_t len) {
-    auto hashValues = hash(data, len);
+  // 多个写者并发 add 时用原子的 or 置位，避免互相覆盖。读者可能看到只置了
+  // 一部分位的 key，这只说明这次插入还没有完成。读者要用 isContainConcurrent
+  void addConcurrent(const void *data, std::size_t len) {
+    addHashConcurrent(hash(data, len));
+  }
 
-    for (int n = 0; n < k; n++) {
-      if (!b[nthHash(n, hashValues[0], hashValues[1], b.size())]) {
+  void addHashConcurrent(const std::array<uint64_t, 2> &hashValues) {
+    if (numLines == 0) return;
+    uint32_t *words = halfLine(hashValues[0]);
+    uint32_t h = static_cast<uint32_t>(hashValues[1]);
+    for (int n = 0; n < kProbes; n++) {
+      __atomic_fetch_or(&words[n], probeBit(h, n), __ATOMIC_RELEASE);
+    }
+  }
+
+  bool isContain(const void *data, std::size_t len) const {
+    if (numLines == 0) return true;
+    return isContainHash(hash(data, len));
+  }
+
+  // 探测还在被 addConcurrent 的 filter（C_0）。每个 word 原子地 acquire load，
+  // 不和写者的 fetch_or 混用非原子的访问；不再修改的 filter 用 isContainHash
+  bool isContainConcurrent(const KeyView &key) const {
+    return isContainHashConcurrent(hash(key));
+  }
+
+  bool isContainHashConcurrent(const std::array<uint64_t, 2> &hashValues) const {
+    if (numLines == 0) return true;
+    const uint32_t *words = halfLine(hashValues[0]);
+    uint32_t h = static_cast<uint32_t>(hashValues[1]);
+    for (int n = 0; n < kProbes; n++) {
+      if (!(__atomic_load_n(&words[n], __ATOMIC_ACQUIRE) & probeBit(h, n))) {
         return false;
       }
     }
+    return true;
+  }
+
+  // 用 hash() 的结果探测。hash 和 filter 的大小无关，查多个 filters 的
+  // key 只需要算一次 hash
+  bool isContainHash(const std::array<uint64_t, 2> &hashValues) const {
+    if (numLines == 0) return true;
+    return testHalfLine(halfLine(hashValues[0]),
+                        static_cast<uint32_t>(hashValues[1]));
+  }
+
+  void prefetch(const std::array<uint64_t, 2> &hashValues) const {
+    if (numLines == 0) return;
+    __builtin_prefetch(halfLine(hashValues[0]));
+  }
+
+  uint64_t bitsNums() const { return numLines * kWordsPerLine * 32; }
+
+  // 序列化成 numLines | lines，和 run 文件一起持久化
+  void serialize(std::string &out) const {
+    out.append(reinterpret_cast<const char *>(&numLines), sizeof(numLines));
+    out.append(reinterpret_cast<const char *>(lines), numLines * sizeof(Line));
+  }
+
+  // 从 serialize 的结果恢复，长度对不上时返回 false
+  bool deserialize(const char *data, std::size_t len) {
+    uint64_t n;
+    if (len < sizeof(n)) return false;
+    memcpy(&n, data, sizeof(n));
+    if (len != sizeof(n) + n * sizeof(Line)) return false;
+
+    free(lines);
+    lines = nullptr;
+    numLines = 0;
+    if (n > 0) {
+      allocate(n);
+      memcpy(lines, data + sizeof(n), n * sizeof(Line));
+    }
+    return true;
+  }
 
+  // 在半块 words 中测试 h 的 8 个 probe 是否全部置位。逐个 probe 的版本和
+  // AVX2 的版本结果一样，公开出来供测试比较
+  static bool testHalfLineScalar(const uint32_t *words, uint32_t h) {
+    for (int n = 0; n < kProbes; n++) {
+      if (!(words[n] & probeBit(h, n))) {
+        return false;
+      }
+    }
     return true;
   }
 
+#ifdef LSMTREE_BLOOM_X86
+  static bool hasAvx2() {
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+  }
+
+  // 8 个 32 bit lane 同时算出 probe 位，testc 判断是否全部置位
+  __attribute__((target("avx2"))) static bool testHalfLineAvx2(
+      const uint32_t *words, uint32_t h) {
+    const __m256i salt =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(kSalt));
+    __m256i shifts =
+        _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(h), salt), 27);
+    __m256i mask = _mm256_sllv_epi32(_mm256_set1_epi32(1), shifts);
+    __m256i block =
+        _mm256_load_si256(reinterpret_cast<const __m256i *>(words));
+    return _mm256_testc_si256(block, mask);
+  }
+#endif
+
  private:
-  std::vector<bool> b;
-  uint8_t k;
+  Line *lines;
+  uint64_t numLines;
+
+  void allocate(uint64_t minLines) {
+    numLines = std::max<uint64_t>(minLines, 1);
+    if (posix_memalign(reinterpret_cast<void **>(&lines), sizeof(Line),
+                       numLines * sizeof(Line))) {
+      perror("Error allocating bloom filter");
+      exit(EXIT_FAILURE);
+    }
+    memset(lines, 0, numLines * sizeof(Line));
+  }
+
+  // 高位选 line，最低位选半块
+  uint32_t *halfLine(uint64_t h) const {
+    uint64_t line = static_cast<uint64_t>(
+        (static_cast<unsigned __int128>(h) * numLines) >> 64);
+    return lines[line].words + (h & 1) * kProbes;
+  }
+
+  static uint32_t probeBit(uint32_t h, int n) {
+    return 1u << ((h * kSalt[n]) >> 27);
+  }
+
+  static bool testHalfLine(const uint32_t *words, uint32_t h) {
+#ifdef LSMTREE_BLOOM_X86
+    if (hasAvx2()) return testHalfLineAvx2(words, h);
+#endif
+    return testHalfLineScalar(words, h);
+  }
+
+  static const uint32_t kSalt[kProbes];
 };
 
+template <class Key>
+const uint32_t BlockedBloomFilter<Key>::kSalt[BlockedBloomFilter<Key>::kProbes] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+
+// Monkey: 在总 bits 固定的前提下为每层 run 分配假阳性率，使 zero-result
+// lookup 的期望 I/O（所有 run 假阳性率之和）最小。最优解里每层的假阳性率和该层
+// run 的元素个数成正比，算出来 >= 1 的层不建 filter，剩下的层重新分配。
+// runSizes[i] / runNums[i] 是第 i 层每个 run 的元素个数和 run 数，返回每层的
+// 假阳性率，1.0 表示该层不建 filter。
+// <https://stratos.seas.harvard.edu/files/stratos/files/monkeykeyvaluestore.pdf>
+inline std::vector<double> monkeyFalsePositives(
+    const std::vector<long> &runSizes, const std::vector<int> &runNums,
+    double totalBits) {
+  const double ln2sq = 0.480453013918201;  // ln(2) ^ 2
+  std::vector<double> fp(runSizes.size(), 1.0);
+  std::vector<bool> hasFilter(runSizes.size(), true);
+
+  while (true) {
+    double entries = 0, entriesLogSize = 0;
+    for (size_t i = 0; i < runSizes.size(); i++) {
+      if (!hasFilter[i] || runSizes[i] <= 0) continue;
+      double n = static_cast<double>(runSizes[i]) * runNums[i];
+      entries += n;
+      entriesLogSize += n * log(static_cast<double>(runSizes[i]));
+    }
+    if (entries == 0 || totalBits <= 0) {
+      std::fill(fp.begin(), fp.end(), 1.0);
+      return fp;
+    }
+
+    // p_i = lambda * runSizes[i]，由 sum(n_i * ln(1 / p_i)) / ln2sq == totalBits 解出
+    double logLambda = -(totalBits * ln2sq + entriesLogSize) / entries;
+    size_t largest = runSizes.size();
+    for (size_t i = 0; i < runSizes.size(); i++) {
+      if (!hasFilter[i] || runSizes[i] <= 0) continue;
+      fp[i] = exp(logLambda + log(static_cast<double>(runSizes[i])));
+      if (fp[i] >= 1.0 &&
+          (largest == runSizes.size() || runSizes[i] > runSizes[largest])) {
+        largest = i;
+      }
+    }
+
+    if (largest == runSizes.size()) {
+      return fp;
+    }
+    hasFilter[largest] = false;
+    fp[largest] = 1.0;
+  }
+}
+
 #endif  // LSMTREE_BLOOM_FILTER_HPP
@@ -0,0 +1,219 @@
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <string>
+
+#include "bloom_filter.hpp"
+#include "test_util.hpp"
+
+typedef BlockedBloomFilter<int> Filter;
+
+const int kKeys = 100000;
+
+// [0, kKeys) 都加进 filter
+void addKeys(Filter &bf) {
+  for (int key = 0; key < kKeys; key++) bf.add(key);
+}
+
+// 不在 filter 中的 keys 被误判的比例
+double measureFalsePositives(const Filter &bf) {
+  const int probes = 1000000;
+  int positives = 0;
+  for (int key = kKeys; key < kKeys + probes; key++) {
+    positives += bf.isContain(key);
+  }
+  return static_cast<double>(positives) / probes;
+}
+
+// 加入过的 key 一定能查到，包括 addConcurrent 加入、isContainConcurrent
+// 和 isContainHash 查询的
+void testNoFalseNegatives() {
+  for (double p : {0.1, 0.01, 0.001}) {
+    Filter bf(kKeys, p), concurrent(kKeys, p);
+    addKeys(bf);
+    for (int key = 0; key < kKeys; key++) concurrent.addConcurrent(key);
+    for (int key = 0; key < kKeys; key++) {
+      CHECK(bf.isContain(key));
+      CHECK(bf.isContainHash(Filter::hash(key)));
+      CHECK(concurrent.isContainConcurrent(key));
+    }
+  }
+
+  // 没有 filter 时什么都可能存在
+  Filter none(0, 1.0);
+  CHECK(none.bitsNums() == 0);
+  CHECK(none.isContain(1));
+}
+
+// filter 的大小按 bitsFor 分配，实测的假阳性率接近目标。每个 key 的
+// probes 挤在一个半块里，probe 数也固定是 8 个，比理想的 bloom filter
+// 差一些，最多大约是目标的 2 倍
+void testFalsePositiveRate() {
+  for (double p : {0.1, 0.01, 0.001}) {
+    Filter bf(kKeys, p);
+    CHECK(bf.bitsNums() >= Filter::bitsFor(kKeys, p));
+    CHECK(bf.bitsNums() < Filter::bitsFor(kKeys, p) + 512);
+    addKeys(bf);
+    double fp = measureFalsePositives(bf);
+    CHECK(fp > p / 2);
+    CHECK(fp < p * 2.5);
+  }
+}
+
+// deserialize 出来的 filter 和原来的一样；长度不对的数据被拒绝，
+// 原来的内容不变
+void testSerializeRoundTrip() {
+  Filter bf(kKeys, 0.01);
+  addKeys(bf);
+  std::string data;
+  bf.serialize(data);
+
+  Filter copy(0, 1.0);
+  CHECK(copy.deserialize(data.data(), data.size()));
+  CHECK(copy.bitsNums() == bf.bitsNums());
+  for (int key = 0; key < kKeys + 100000; key++) {
+    CHECK(copy.isContain(key) == bf.isContain(key));
+  }
+  std::string again;
+  copy.serialize(again);
+  CHECK(again == data);
+
+  CHECK(!copy.deserialize(data.data(), data.size() - 1));
+  CHECK(!copy.deserialize(data.data(), 4));
+  CHECK(copy.bitsNums() == bf.bitsNums());
+  CHECK(copy.isContain(0));
+
+  Filter none(0, 1.0), restored(kKeys, 0.01);
+  std::string empty;
+  none.serialize(empty);
+  CHECK(restored.deserialize(empty.data(), empty.size()));
+  CHECK(restored.bitsNums() == 0);
+  CHECK(restored.isContain(kKeys));
+}
+
+// AVX2 的半块测试和逐个 probe 的结果一样：随机的半块（置位的比例从很少
+// 到几乎全满），以及全部置位的半块只清掉一位
+void testHalfLineAvx2() {
+#ifdef LSMTREE_BLOOM_X86
+  if (!Filter::hasAvx2()) return;
+  std::mt19937 rng(1);
+  alignas(32) uint32_t words[Filter::kProbes];
+  for (int round = 0; round < 100000; round++) {
+    int density = round % 8;
+    for (auto &w : words) {
+      w = rng();
+      for (int i = 0; i < density; i++) w |= rng();
+    }
+    uint32_t h = rng();
+    CHECK(Filter::testHalfLineAvx2(words, h) ==
+          Filter::testHalfLineScalar(words, h));
+  }
+
+  // 清掉的恰好是 probe 位时两个版本都返回 false，每个 word 中
+  // 恰好有一个 probe 位
+  for (int round = 0; round < 1000; round++) {
+    uint32_t h = rng();
+    int misses = 0;
+    for (int n = 0; n < Filter::kProbes; n++) {
+      for (int bit = 0; bit < 32; bit++) {
+        for (auto &w : words) w = ~0u;
+        words[n] &= ~(1u << bit);
+        bool scalar = Filter::testHalfLineScalar(words, h);
+        CHECK(Filter::testHalfLineAvx2(words, h) == scalar);
+        misses += !scalar;
+      }
+    }
+    CHECK(misses == Filter::kProbes);
+  }
+#endif
+}
+
+// 每层的 bits 按 bitsFor 从 monkey 给出的假阳性率算出
+double monkeyBits(const std::vector<long> &runSizes,
+                  const std::vector<int> &runNums,
+                  const std::vector<double> &fp) {
+  double bits = 0;
+  for (size_t i = 0; i < fp.size(); i++) {
+    if (fp[i] < 1.0) bits += Filter::bitsFor(runSizes[i] * runNums[i], fp[i]);
+  }
+  return bits;
+}
+
+// 预算够时每层都有 filter，bits 加起来正好是预算，假阳性率和 run 的
+// 元素个数成正比
+void testMonkeyBudget() {
+  std::vector<long> runSizes = {100, 400, 1600, 6400, 25600};
+  std::vector<int> runNums = {3, 3, 3, 3, 1};
+  double entries = 0;
+  for (size_t i = 0; i < runSizes.size(); i++) {
+    entries += runSizes[i] * runNums[i];
+  }
+
+  for (double bitsPerEntry : {2.0, 5.0, 10.0}) {
+    double budget = bitsPerEntry * entries;
+    std::vector<double> fp = monkeyFalsePositives(runSizes, runNums, budget);
+    CHECK(fp.size() == runSizes.size());
+    double bits = monkeyBits(runSizes, runNums, fp);
+    CHECK(std::fabs(bits - budget) < 1e-6 * budget);
+    for (size_t i = 0; i < fp.size(); i++) {
+      CHECK(fp[i] > 0 && fp[i] < 1.0);
+      double ratio = fp[i] / runSizes[i] / (fp[0] / runSizes[0]);
+      CHECK(std::fabs(ratio - 1) < 1e-9);
+    }
+  }
+
+  // 同样多的 bits 平均分配时，所有 runs 的假阳性率之和更大
+  double budget = 5.0 * entries;
+  std::vector<double> fp = monkeyFalsePositives(runSizes, runNums, budget);
+  double monkey = 0, uniform = 0;
+  for (size_t i = 0; i < fp.size(); i++) {
+    monkey += fp[i] * runNums[i];
+    uniform += exp(-5.0 * 0.480453013918201) * runNums[i];
+  }
+  CHECK(monkey < uniform);
+}
+
+// 预算不够时最大的层不建 filter，预算全部留给剩下的层，它们仍然满足
+// 正比关系；没有预算时所有层都不建 filter
+void testMonkeySmallBudget() {
+  std::vector<long> runSizes = {100, 400, 1600, 6400, 25600};
+  std::vector<int> runNums = {3, 3, 3, 3, 1};
+  double budget = 2000;
+  std::vector<double> fp = monkeyFalsePositives(runSizes, runNums, budget);
+  CHECK(fp.back() == 1.0);
+  CHECK(fp[0] < 1.0);
+  CHECK(std::fabs(monkeyBits(runSizes, runNums, fp) - budget) < 1e-6 * budget);
+  size_t filtered = 0;
+  for (size_t i = 0; i < fp.size(); i++) {
+    if (fp[i] == 1.0) {
+      // 不建 filter 的总是最大的那几层
+      for (size_t j = i; j < fp.size(); j++) CHECK(fp[j] == 1.0);
+      break;
+    }
+    filtered++;
+    double ratio = fp[i] / runSizes[i] / (fp[0] / runSizes[0]);
+    CHECK(std::fabs(ratio - 1) < 1e-9);
+  }
+  CHECK(filtered > 0 && filtered < fp.size());
+
+  for (double none : {0.0, -1.0}) {
+    for (double p : monkeyFalsePositives(runSizes, runNums, none)) {
+      CHECK(p == 1.0);
+    }
+  }
+  // 空的层不影响其它层
+  std::vector<double> empty =
+      monkeyFalsePositives({100, 0, 1600}, {3, 0, 1}, 20000);
+  CHECK(empty[1] == 1.0);
+  CHECK(empty[0] < 1.0 && empty[2] < 1.0);
+}
+
+int main() {
+  RUN_TEST(testNoFalseNegatives);
+  RUN_TEST(testFalsePositiveRate);
+  RUN_TEST(testSerializeRoundTrip);
+  RUN_TEST(testHalfLineAvx2);
+  RUN_TEST(testMonkeyBudget);
+  RUN_TEST(testMonkeySmallBudget);
+  return 0;
+}
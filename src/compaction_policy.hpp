@@ -0,0 +1,109 @@
+#ifndef LSMTREE_COMPACTION_POLICY_HPP
+#define LSMTREE_COMPACTION_POLICY_HPP
+
+#include <cmath>
+#include <vector>
+
+// 一层 disk level 的形状
+struct LevelShape {
+  int numRuns;    // 本层最多几个 runs
+  int mergeSize;  // 本层满了之后向下合并的 runs 数
+  long runSize;   // 每个 run 最多几个元素
+  bool leveled;   // 新到的 runs 是否和本层已有的 run 归并成一个
+
+  bool operator==(const LevelShape &o) const {
+    return numRuns == o.numRuns && mergeSize == o.mergeSize &&
+           runSize == o.runSize && leveled == o.leveled;
+  }
+};
+
+// 决定每层 disk level 的形状，也就是 runs 在层之间怎样合并。level 从 1 开始，
+// incoming 是上一层每次推下来的 run 最多有几个元素，第 1 层是 C_0 一次
+// flush 的大小。每层的 size ratio 可以单独设置，没有设置的层用默认值，
+// 只影响之后新建或者重新确定形状的层
+// <https://stratos.seas.harvard.edu/files/stratos/files/dostoevskykv.pdf>
+class CompactionPolicy {
+ public:
+  explicit CompactionPolicy(int sizeRatio) : _defaultRatio(sizeRatio) {}
+  virtual ~CompactionPolicy() = default;
+
+  virtual LevelShape shape(int level, long incoming, bool isLastLevel) = 0;
+  virtual const char *name() = 0;
+
+  void setSizeRatio(int level, int ratio) {
+    if (level >= static_cast<int>(_ratios.size())) {
+      _ratios.resize(level + 1, 0);
+    }
+    _ratios[level] = ratio;
+  }
+
+  int getSizeRatio(int level) {
+    int ratio = level < static_cast<int>(_ratios.size()) ? _ratios[level] : 0;
+    ratio = ratio > 0 ? ratio : _defaultRatio;
+    return ratio < 1 ? 1 : ratio;
+  }
+
+ protected:
+  // 本层最多 ratio 个 runs，满了之后把最旧的一部分归并成下一层的一个 run
+  static LevelShape tiered(int ratio, double fracMerged, long incoming) {
+    int mergeSize = static_cast<int>(ceil(ratio * fracMerged));
+    mergeSize = mergeSize < 1 ? 1 : (mergeSize > ratio ? ratio : mergeSize);
+    return LevelShape{ratio, mergeSize, incoming, false};
+  }
+
+  // 本层只有一个 run，容量是 incoming 的 ratio 倍，放不下时整个推到下一层
+  static LevelShape leveled(int ratio, long incoming) {
+    ratio = ratio < 2 ? 2 : ratio;
+    return LevelShape{1, 1, incoming * ratio, true};
+  }
+
+ private:
+  int _defaultRatio;
+  std::vector<int> _ratios;  // 下标是 level，0 表示用默认值
+};
+
+// 每层的 runs 积攒到 size ratio 个再往下合并，写放大最小。
+// fracMerged 小于 1 时每次只合并最旧的一部分 runs
+class TieringPolicy : public CompactionPolicy {
+ public:
+  explicit TieringPolicy(int sizeRatio, double fracMerged = 1.0)
+      : CompactionPolicy(sizeRatio), _fracMerged(fracMerged) {}
+
+  LevelShape shape(int level, long incoming, bool /* isLastLevel */) {
+    return tiered(getSizeRatio(level), _fracMerged, incoming);
+  }
+
+  const char *name() { return "tiering"; }
+
+ private:
+  double _fracMerged;
+};
+
+// 每层一个 run，新到的 run 立即和它归并，点查和范围查询最多每层读一个 run
+class LevelingPolicy : public CompactionPolicy {
+ public:
+  explicit LevelingPolicy(int sizeRatio) : CompactionPolicy(sizeRatio) {}
+
+  LevelShape shape(int level, long incoming, bool /* isLastLevel */) {
+    return leveled(getSizeRatio(level), incoming);
+  }
+
+  const char *name() { return "leveling"; }
+};
+
+// 上面的层用 tiering，数据最多的最后一层用 leveling。新加一层之后，
+// 原来的最后一层在下一次被清空时改成 tiering
+class LazyLevelingPolicy : public CompactionPolicy {
+ public:
+  explicit LazyLevelingPolicy(int sizeRatio) : CompactionPolicy(sizeRatio) {}
+
+  LevelShape shape(int level, long incoming, bool isLastLevel) {
+    int ratio = getSizeRatio(level);
+    return isLastLevel ? leveled(ratio, incoming)
+                       : tiered(ratio, 1.0, incoming);
+  }
+
+  const char *name() { return "lazy-leveling"; }
+};
+
+#endif  // LSMTREE_COMPACTION_POLICY_HPP
@@ -0,0 +1,240 @@
+#ifndef LSMTREE_COMPRESS_HPP
+#define LSMTREE_COMPRESS_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "slice.hpp"
+
+// 磁盘 run 的 block 编码用到的压缩工具
+
+// LEB128 无符号 varint，每个字节 7 位，最高位表示后面还有字节
+inline void putVarint64(std::string &out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back(static_cast<char>(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back(static_cast<char>(v));
+}
+
+// 读失败（越界或者超过 10 个字节）返回 nullptr
+inline const char *getVarint64(const char *p, const char *limit,
+                               uint64_t &v) {
+  v = 0;
+  for (int shift = 0; shift <= 63 && p < limit; shift += 7) {
+    uint64_t byte = static_cast<unsigned char>(*p++);
+    v |= (byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return p;
+    }
+  }
+  return nullptr;
+}
+
+// 有序的整数 key 存成第一个 key 加上相邻 key 之差的 varint。
+// 差值用无符号数计算，有符号的 key 也不会溢出。其他定长的 key 按原样存储，
+// 变长的 key 按 slotted 格式存储
+template <class K>
+void encodeKeys(const K *keys, long n, std::string &out, std::true_type) {
+  typedef typename std::make_unsigned<K>::type U;
+  if (n == 0) return;
+  out.append(reinterpret_cast<const char *>(&keys[0]), sizeof(K));
+  for (long i = 1; i < n; i++) {
+    putVarint64(out, static_cast<U>(static_cast<U>(keys[i]) -
+                                    static_cast<U>(keys[i - 1])));
+  }
+}
+
+template <class K>
+void encodeKeys(const K *keys, long n, std::string &out, std::false_type) {
+  out.append(reinterpret_cast<const char *>(keys), n * sizeof(K));
+}
+
+template <class K>
+bool decodeKeys(const char *p, const char *limit, long n, K *keys,
+                std::true_type) {
+  typedef typename std::make_unsigned<K>::type U;
+  if (n == 0) return true;
+  if (limit - p < static_cast<long>(sizeof(K))) return false;
+  memcpy(&keys[0], p, sizeof(K));
+  p += sizeof(K);
+  for (long i = 1; i < n; i++) {
+    uint64_t delta;
+    p = getVarint64(p, limit, delta);
+    if (p == nullptr) return false;
+    keys[i] = static_cast<K>(static_cast<U>(keys[i - 1]) +
+                             static_cast<U>(delta));
+  }
+  return true;
+}
+
+template <class K>
+bool decodeKeys(const char *p, const char *limit, long n, K *keys,
+                std::false_type) {
+  if (limit - p < static_cast<long>(n * sizeof(K))) return false;
+  memcpy(keys, p, n * sizeof(K));
+  return true;
+}
+
+// 变长的字节串按 slotted 格式存放：n + 1 个 4 字节的偏移 | 所有内容，
+// 第 i 个是 [offsets[i], offsets[i + 1])，不用解码前面的就能直接访问
+inline void encodeSlices(const Slice *slices, long n, std::string &out) {
+  uint32_t offset = 0;
+  out.append(reinterpret_cast<const char *>(&offset), sizeof(offset));
+  for (long i = 0; i < n; i++) {
+    offset += static_cast<uint32_t>(slices[i].size());
+    out.append(reinterpret_cast<const char *>(&offset), sizeof(offset));
+  }
+  for (long i = 0; i < n; i++) {
+    out.append(slices[i].data(), slices[i].size());
+  }
+}
+
+// 读出的 slices 指向 [p, limit) 中的数据
+inline bool decodeSlices(const char *p, const char *limit, long n,
+                         Slice *slices) {
+  long header = (n + 1) * static_cast<long>(sizeof(uint32_t));
+  if (limit - p < header) return false;
+  const char *base = p + header;
+  uint32_t begin, end;
+  memcpy(&begin, p, sizeof(begin));
+  for (long i = 0; i < n; i++) {
+    memcpy(&end, p + (i + 1) * sizeof(uint32_t), sizeof(end));
+    if (end < begin || end > limit - base) return false;
+    slices[i] = Slice(base + begin, end - begin);
+    begin = end;
+  }
+  return true;
+}
+
+// slotted 格式中的第 i 个，调用方保证数据已经校验过
+inline Slice sliceAt(const char *p, long n, long i) {
+  uint32_t begin, end;
+  memcpy(&begin, p + i * sizeof(uint32_t), sizeof(begin));
+  memcpy(&end, p + (i + 1) * sizeof(uint32_t), sizeof(end));
+  return Slice(p + (n + 1) * sizeof(uint32_t) + begin, end - begin);
+}
+
+inline void encodeKeys(const Slice *keys, long n, std::string &out,
+                       std::false_type) {
+  encodeSlices(keys, n, out);
+}
+
+inline bool decodeKeys(const char *p, const char *limit, long n, Slice *keys,
+                       std::false_type) {
+  return decodeSlices(p, limit, n, keys);
+}
+
+// LZ4 block 格式的简化实现：每个 sequence 是
+// token(高 4 位 literal 长度，低 4 位 match 长度 - 4) | 长度扩展 | literals |
+// offset(2 字节小端) | match 长度扩展，最后一个 sequence 只有 literals。
+// 长度为 15 时后面跟若干个 255 直到一个小于 255 的字节
+// <https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md>
+class LZCodec {
+ public:
+  static void compress(const char *src, size_t n, std::string &out) {
+    std::vector<int32_t> table(1 << kHashLog, -1);
+    size_t anchor = 0, i = 0;
+    while (i + kMinMatch <= n) {
+      uint32_t seq = load32(src + i);
+      uint32_t h = (seq * 2654435761u) >> (32 - kHashLog);
+      int32_t ref = table[h];
+      table[h] = static_cast<int32_t>(i);
+      if (ref < 0 || i - ref > kMaxOffset || load32(src + ref) != seq) {
+        i++;
+        continue;
+      }
+
+      size_t len = kMinMatch;
+      while (i + len < n && src[ref + len] == src[i + len]) len++;
+      putSequence(out, src + anchor, i - anchor, i - ref, len);
+      i += len;
+      anchor = i;
+    }
+    putSequence(out, src + anchor, n - anchor, 0, 0);
+  }
+
+  // dst 必须正好是原始数据的长度，数据损坏时返回 false
+  static bool decompress(const char *src, size_t n, char *dst, size_t dstLen) {
+    const char *p = src, *limit = src + n;
+    size_t pos = 0;
+    while (p < limit) {
+      unsigned token = static_cast<unsigned char>(*p++);
+      size_t litLen = token >> 4;
+      if (litLen == 15 && !getLength(p, limit, litLen)) return false;
+      if (static_cast<size_t>(limit - p) < litLen || dstLen - pos < litLen) {
+        return false;
+      }
+      memcpy(dst + pos, p, litLen);
+      p += litLen;
+      pos += litLen;
+      if (p == limit) break;
+
+      if (limit - p < 2) return false;
+      size_t offset = static_cast<unsigned char>(p[0]) |
+                      (static_cast<size_t>(static_cast<unsigned char>(p[1]))
+                       << 8);
+      p += 2;
+      size_t matchLen = token & 15;
+      if (matchLen == 15 && !getLength(p, limit, matchLen)) return false;
+      matchLen += kMinMatch;
+      if (offset == 0 || offset > pos || dstLen - pos < matchLen) {
+        return false;
+      }
+      // match 可能和正在写的区域重叠，逐字节复制
+      for (size_t k = 0; k < matchLen; k++, pos++) {
+        dst[pos] = dst[pos - offset];
+      }
+    }
+    return pos == dstLen;
+  }
+
+ private:
+  static const int kHashLog = 12;
+  static const size_t kMinMatch = 4;
+  static const size_t kMaxOffset = 65535;
+
+  static uint32_t load32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  static void putLength(std::string &out, size_t len) {
+    while (len >= 255) {
+      out.push_back(static_cast<char>(255));
+      len -= 255;
+    }
+    out.push_back(static_cast<char>(len));
+  }
+
+  static bool getLength(const char *&p, const char *limit, size_t &len) {
+    unsigned byte;
+    do {
+      if (p == limit) return false;
+      byte = static_cast<unsigned char>(*p++);
+      len += byte;
+    } while (byte == 255);
+    return true;
+  }
+
+  // matchLen 为 0 表示最后一个只有 literals 的 sequence
+  static void putSequence(std::string &out, const char *lit, size_t litLen,
+                          size_t offset, size_t matchLen) {
+    size_t m = matchLen ? matchLen - kMinMatch : 0;
+    out.push_back(static_cast<char>(((litLen < 15 ? litLen : 15) << 4) |
+                                    (m < 15 ? m : 15)));
+    if (litLen >= 15) putLength(out, litLen - 15);
+    out.append(lit, litLen);
+    if (matchLen == 0) return;
+
+    out.push_back(static_cast<char>(offset & 0xff));
+    out.push_back(static_cast<char>(offset >> 8));
+    if (m >= 15) putLength(out, m - 15);
+  }
+};
+
+#endif  // LSMTREE_COMPRESS_HPP
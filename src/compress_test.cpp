@@ -0,0 +1,202 @@
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "compress.hpp"
+#include "disk_run.hpp"
+#include "test_util.hpp"
+
+// 各个长度边界上的 varint 能原样读回，截断或者超过 10 个字节时读失败
+void testVarint() {
+  std::vector<uint64_t> values = {0,       1,           127,        128,
+                                  16383,   16384,       UINT32_MAX, 1ULL << 63,
+                                  UINT64_MAX};
+  std::string buf;
+  for (uint64_t v : values) putVarint64(buf, v);
+  CHECK(buf.size() == 1 + 1 + 1 + 2 + 2 + 3 + 5 + 10 + 10);
+
+  const char *p = buf.data(), *limit = buf.data() + buf.size();
+  for (uint64_t v : values) {
+    uint64_t got;
+    p = getVarint64(p, limit, got);
+    CHECK(p != nullptr && got == v);
+  }
+  CHECK(p == limit);
+
+  uint64_t got;
+  std::string one;
+  putVarint64(one, 16384);
+  CHECK(getVarint64(one.data(), one.data() + one.size() - 1, got) == nullptr);
+  std::string tooLong(11, '\x80');
+  CHECK(getVarint64(tooLong.data(), tooLong.data() + tooLong.size(), got) ==
+        nullptr);
+}
+
+// 有序的整数 keys 按差值编码，负数、跨过 0 和整个值域的差值都能还原
+template <class K>
+void checkDeltaKeys(const std::vector<K> &keys) {
+  std::string buf;
+  encodeKeys(keys.data(), keys.size(), buf, std::true_type());
+  std::vector<K> decoded(keys.size());
+  CHECK(decodeKeys(buf.data(), buf.data() + buf.size(), keys.size(),
+                   decoded.data(), std::true_type()));
+  CHECK(decoded == keys);
+  if (keys.size() > 1) {
+    CHECK(!decodeKeys(buf.data(), buf.data() + buf.size() - 1, keys.size(),
+                      decoded.data(), std::true_type()));
+  }
+}
+
+void testDeltaKeys() {
+  checkDeltaKeys(std::vector<int>{INT_MIN, -1000, -1, 0, 1, 2, 1000, INT_MAX});
+  checkDeltaKeys(std::vector<uint64_t>{0, 1, 1ULL << 40, UINT64_MAX});
+  checkDeltaKeys(std::vector<long>{LONG_MIN, LONG_MAX});
+  checkDeltaKeys(std::vector<int>{42});
+
+  // 连续的 keys 每个只占一个字节
+  std::vector<int> dense;
+  for (int i = -500; i < 500; i++) dense.push_back(i);
+  std::string buf;
+  encodeKeys(dense.data(), dense.size(), buf, std::true_type());
+  CHECK(buf.size() == sizeof(int) + dense.size() - 1);
+  checkDeltaKeys(dense);
+}
+
+// slotted 格式的字节串，包括空串，能整体解码也能按下标直接读；
+// 偏移越界时解码失败
+void testSlices() {
+  std::vector<std::string> strs = {"", "a", std::string(300, 'x'), "",
+                                   std::string("\0b\0", 3)};
+  std::vector<Slice> slices;
+  for (auto &s : strs) slices.push_back(Slice(s));
+  std::string buf;
+  encodeSlices(slices.data(), slices.size(), buf);
+
+  std::vector<Slice> decoded(strs.size());
+  CHECK(decodeSlices(buf.data(), buf.data() + buf.size(), strs.size(),
+                     decoded.data()));
+  for (size_t i = 0; i < strs.size(); i++) {
+    CHECK(decoded[i].toString() == strs[i]);
+    CHECK(sliceAt(buf.data(), strs.size(), i).toString() == strs[i]);
+  }
+  CHECK(!decodeSlices(buf.data(), buf.data() + buf.size() - 1, strs.size(),
+                      decoded.data()));
+}
+
+void checkLZ(const std::string &src) {
+  std::string compressed;
+  LZCodec::compress(src.data(), src.size(), compressed);
+  std::string out(src.size(), '\0');
+  CHECK(LZCodec::decompress(compressed.data(), compressed.size(), &out[0],
+                            out.size()));
+  CHECK(out == src);
+
+  // 长度不对或者数据被截掉一半时返回 false
+  std::string longer(src.size() + 1, '\0');
+  CHECK(!LZCodec::decompress(compressed.data(), compressed.size(), &longer[0],
+                             longer.size()));
+  if (!src.empty()) {
+    CHECK(!LZCodec::decompress(compressed.data(), compressed.size() / 2,
+                               &out[0], out.size()));
+  }
+}
+
+// 空串、短串、随机字节、重叠的 match（同一个字节重复）以及超过 15 和
+// 15 + 255 的 literal / match 长度都能原样解压，重复的数据变小
+void testLZCodec() {
+  std::mt19937 rng(1);
+  std::string random(5000, '\0');
+  for (auto &c : random) c = static_cast<char>(rng());
+
+  std::string repeated;
+  while (repeated.size() < 10000) repeated += "value-" + std::to_string(7);
+
+  checkLZ("");
+  checkLZ("abc");
+  checkLZ("abcdabcd");
+  checkLZ(random);
+  checkLZ(std::string(10000, 'z'));
+  checkLZ(repeated);
+  checkLZ(random.substr(0, 300) + repeated + random.substr(300, 20));
+
+  std::string compressed;
+  LZCodec::compress(repeated.data(), repeated.size(), compressed);
+  CHECK(compressed.size() < repeated.size() / 10);
+}
+
+// 写入 disk run 的 blocks 能按 key 查到，遍历的顺序和内容不变，
+// 重新打开文件之后也一样。keys 有负数，value 有压缩的也有没压缩的
+template <class K, class V>
+void checkRun(const std::vector<kvPair<K, V>> &entries, bool compress,
+              const std::vector<K> &absent) {
+  typedef DiskRun<K, V> RunType;
+  TempDir tmp;
+  uint64_t fileID;
+  {
+    auto run = std::make_shared<RunType>(entries.size(), 16, 1, 0, 0.01);
+    run->setValueCompression(compress);
+    run->setDirectory(tmp.path());
+    run->writeData(entries.data(), 0, entries.size());
+    run->constructIndex();
+    fileID = run->getFileID();
+    CHECK(run->getCapacity() == static_cast<long>(entries.size()));
+  }
+
+  auto run = std::make_shared<RunType>(tmp.path(), fileID, 16, 1, 0, 0.01);
+  CHECK(run->getCapacity() == static_cast<long>(entries.size()));
+  for (auto &kv : entries) {
+    bool isFound = false, isDeleted = false;
+    V value = run->search(kv.key, isFound, isDeleted);
+    CHECK(isFound && isDeleted == kv.isDeleted);
+    if (!kv.isDeleted) CHECK(value == kv.value);
+  }
+  for (auto &key : absent) {
+    bool isFound = false, isDeleted = false;
+    run->search(key, isFound, isDeleted);
+    CHECK(!isFound);
+  }
+
+  typename RunType::Iterator it(run);
+  size_t i = 0;
+  for (it.seekToFirst(); it.valid(); it.next(), i++) {
+    CHECK(i < entries.size());
+    CHECK(it.key() == entries[i].key);
+    CHECK(it.isDeleted() == entries[i].isDeleted);
+    if (!entries[i].isDeleted) CHECK(it.value() == entries[i].value);
+  }
+  CHECK(i == entries.size());
+}
+
+void testRunBlocks() {
+  std::vector<kvPair<int, int>> ints;
+  std::vector<int> intAbsent = {INT_MIN, -2001, 1, 3001};
+  for (int key = -2000; key < 3000; key += 2) {
+    ints.push_back(kvPair<int, int>{key, key * 3, key % 7 == 0});
+  }
+
+  std::vector<kvPair<std::string, std::string>> strs;
+  std::vector<std::string> strAbsent = {"", "k", "k00001", "z"};
+  char buf[16];
+  for (int i = 0; i < 3000; i += 2) {
+    snprintf(buf, sizeof(buf), "k%05d", i);
+    std::string value = i % 3 ? std::string(i % 50, 'v') : std::string(buf);
+    strs.push_back(kvPair<std::string, std::string>{buf, value, i % 11 == 0});
+  }
+
+  checkRun(ints, false, intAbsent);
+  checkRun(ints, true, intAbsent);
+  checkRun(strs, false, strAbsent);
+  checkRun(strs, true, strAbsent);
+}
+
+int main() {
+  RUN_TEST(testVarint);
+  RUN_TEST(testDeltaKeys);
+  RUN_TEST(testSlices);
+  RUN_TEST(testLZCodec);
+  RUN_TEST(testRunBlocks);
+  return 0;
+}
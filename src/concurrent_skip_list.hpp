@@ -0,0 +1,372 @@
+#ifndef LSMTREE_CONCURRENT_SKIP_LIST_HPP
+#define LSMTREE_CONCURRENT_SKIP_LIST_HPP
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <random>
+#include <thread>
+
+#include "arena.hpp"
+#include "iterator.hpp"
+#include "run.hpp"
+#include "slice.hpp"
+
+// 无锁并发跳表，支持多个写者和读者同时访问。
+// 每个节点的 tower 按照实际高度分配，自底向上逐层用 CAS 链入，
+// level 0 链入成功即对读者可见。节点不会被物理删除，删除通过写入墓碑完成。
+// 节点从 run 自己的 arena 中分配，run 被 merge 之后随 arena 一次性释放。
+// 变长的 key 和 value 的内容也放在 arena 中，和节点一起分配
+// <https://github.com/facebook/rocksdb/blob/main/memtable/inlineskiplist.h>
+template <class K, class V, int MAXLEVEL = 20>
+class ConcurrentSkipList : public Run<K, V> {
+ public:
+  typedef SliceTraits<K> KeyTraits;
+  typedef SliceTraits<V> ValueTraits;
+  typedef typename KeyTraits::View KeyView;
+  typedef typename ValueTraits::View ValueView;
+
+  // 一个 key 当前的值。覆盖写入时换成新的 cell，读者一次原子读
+  // 同时拿到 value 和墓碑标记
+  struct Cell {
+    ValueView value;
+    bool isDeleted;
+  };
+
+  struct Node {
+    const KeyView key;
+    std::atomic<const Cell *> cell;
+    const int height;
+    std::atomic<Node *> _forward[1];  // 实际长度为 height，跟在节点后面分配
+
+    Node(const KeyView &_key, const Cell *_cell, int _height)
+        : key(_key), cell(_cell), height(_height) {
+      for (int i = 0; i < height; i++) {
+        new (&_forward[i]) std::atomic<Node *>(nullptr);
+      }
+    }
+
+    Node *next(int level) {
+      return _forward[level].load(std::memory_order_acquire);
+    }
+
+    bool casNext(int level, Node *expected, Node *x) {
+      return _forward[level].compare_exchange_strong(expected, x,
+                                                     std::memory_order_release);
+    }
+  };
+
+  // 遍历过程中可以有并发的插入，已经链入 level 0 的节点都能被看到。
+  // 持有 run 的引用，run 被 merge 之后迭代器仍然可用
+  class Iterator : public KVIterator<K, V> {
+   public:
+    explicit Iterator(std::shared_ptr<ConcurrentSkipList> list)
+        : _list(std::move(list)), _node(nullptr), _cell(nullptr) {}
+
+    bool valid() { return _node != nullptr; }
+    void seekToFirst() { setNode(_list->p_listHead->next(0)); }
+    void seek(const K &key) {
+      setNode(_list->findGreaterOrEqual(KeyTraits::view(key)));
+    }
+    void next() { setNode(_node->next(0)); }
+    K key() { return KeyTraits::fromView(_node->key); }
+    const KeyView &keyView() { return _node->key; }  // 指向 arena，随 run 释放
+    V value() { return ValueTraits::fromView(_cell->value); }
+    bool isDeleted() { return _cell->isDeleted; }
+
+   private:
+    std::shared_ptr<ConcurrentSkipList> _list;
+    Node *_node;
+    const Cell *_cell;
+
+    // 定位时读出 cell，之后的 value 和 isDeleted 来自同一次写入
+    void setNode(Node *node) {
+      _node = node;
+      _cell = node ? node->cell.load(std::memory_order_acquire) : nullptr;
+    }
+  };
+
+  ConcurrentSkipList()
+      : _min(nullptr),
+        _max(nullptr),
+        _n(0),
+        _reserved(0),
+        _maxSize(LONG_MAX),
+        curMaxLevel(1) {
+    p_listHead = newNode(KeyView(), ValueView(), false, MAXLEVEL);
+  }
+
+  ~ConcurrentSkipList() = default;
+
+  K getMax() {
+    Node *node = _max.load(std::memory_order_acquire);
+    return node ? KeyTraits::fromView(node->key) : K();
+  }
+  K getMin() {
+    Node *node = _min.load(std::memory_order_acquire);
+    return node ? KeyTraits::fromView(node->key) : K();
+  }
+
+  // 已经插入的最小和最大的 key，run 为空时返回 false
+  bool getBounds(KeyView &lo, KeyView &hi) {
+    Node *minNode = _min.load(std::memory_order_acquire);
+    Node *maxNode = _max.load(std::memory_order_acquire);
+    if (minNode == nullptr || maxNode == nullptr) {
+      return false;
+    }
+    lo = minNode->key;
+    hi = maxNode->key;
+    return true;
+  }
+
+  // 上一次插入在每一层的位置 prev < key <= next。按 key 升序插入时
+  // 下一个 key 从仍然包住它的最低一层往下找，不用每次从表头开始
+  struct Splice {
+    Node *prev[MAXLEVEL];
+    Node *next[MAXLEVEL];
+    bool isValid = false;
+  };
+
+  void insertKey(const K &iKey, const V &iValue) {
+    Splice splice;
+    insertEntry(KeyTraits::view(iKey), ValueTraits::view(iValue), false,
+                splice);
+  }
+
+  // 节点不做物理删除，写入墓碑
+  void deleteKey(const K &dKey) {
+    Splice splice;
+    insertEntry(KeyTraits::view(dKey), ValueView(), true, splice);
+  }
+
+  // 用 splice 作为起点写入一个值或者墓碑，并把 splice 更新成这次插入的位置。
+  // 同一个 splice 上的 keys 需要严格递增
+  void insertEntry(const KeyView &iKey, const ValueView &iValue,
+                   bool isDeleted, Splice &splice) {
+    Node **prev = splice.prev, **next = splice.next;
+    int height = genNodeLevel();
+    int maxLevel = curMaxLevel.load(std::memory_order_relaxed);
+    while (height > maxLevel &&
+           !curMaxLevel.compare_exchange_weak(maxLevel, height)) {
+    }
+
+    if (splice.isValid) {
+      recomputeSplice(iKey, splice);
+    } else {
+      findSplice(iKey, prev, next);
+      splice.isValid = true;
+    }
+    if (next[0] != nullptr && next[0]->key == iKey) {
+      next[0]->cell.store(newCell(iValue, isDeleted),
+                          std::memory_order_release);
+      return;
+    }
+
+    Node *node = newNode(iKey, iValue, isDeleted, height);
+    for (int level = 0; level < height; level++) {
+      while (true) {
+        node->_forward[level].store(next[level], std::memory_order_relaxed);
+        if (prev[level]->casNext(level, next[level], node)) {
+          break;
+        }
+
+        // CAS 失败说明有别的写者插到了 prev 后面，从 prev 开始重新找这一层的位置
+        findSpliceForLevel(iKey, prev[level], level, prev[level], next[level]);
+        if (level == 0 && next[0] != nullptr && next[0]->key == iKey) {
+          // 同一个 key 被别的写者先插入了，node 留在 arena 中不再使用，
+          // 它的 cell 换到已有的节点上
+          next[0]->cell.store(node->cell.load(std::memory_order_relaxed),
+                              std::memory_order_release);
+          return;
+        }
+      }
+      prev[level] = node;  // node 之后的 key 从 node 开始找
+    }
+
+    _n.fetch_add(1, std::memory_order_relaxed);
+    updateMinMax(node);
+  }
+
+  V search(const K &sKey, bool &isFound, bool &isDeleted) {
+    KeyView key = KeyTraits::view(sKey);
+    Node *curNode = findGreaterOrEqual(key);
+    if (curNode != nullptr && curNode->key == key) {
+      const Cell *cell = curNode->cell.load(std::memory_order_acquire);
+      isFound = true;
+      isDeleted = cell->isDeleted;
+      return ValueTraits::fromView(cell->value);
+    }
+
+    return V();
+  }
+
+  // 为一次写入预留位置，超过 setSize 设置的大小后返回 false，
+  // 并发写者据此决定切换 run，保证 run 中的元素个数不超过上限
+  bool reserveSlot() {
+    return _reserved.fetch_add(1, std::memory_order_relaxed) < _maxSize;
+  }
+
+  // 一次预留 n 个位置，放不下时返回 false，这个 run 随之变满
+  bool reserveSlots(long n) {
+    return _reserved.fetch_add(n, std::memory_order_relaxed) + n <= _maxSize;
+  }
+
+  // 所有位置都已经被预留
+  bool isFull() {
+    return _reserved.load(std::memory_order_relaxed) >= _maxSize;
+  }
+
+  long long eltsNums() { return _n.load(std::memory_order_relaxed); }
+  size_t getMemoryUsage() { return arena.memoryUsage(); }
+  void setSize(const long size) { _maxSize = size; }
+
+  std::vector<kvPair<K, V>> getAll() {
+    std::vector<kvPair<K, V>> ret = std::vector<kvPair<K, V>>();
+    ret.reserve(eltsNums());
+    for (Node *node = p_listHead->next(0); node != nullptr;
+         node = node->next(0)) {
+      ret.emplace_back(toPair(node));
+    }
+    return ret;
+  }
+
+  std::vector<kvPair<K, V>> getAllInRange(const K &k1, const K &k2) {
+    KeyView lo, hi, begin = KeyTraits::view(k1), end = KeyTraits::view(k2);
+    if (!getBounds(lo, hi) || begin > hi || end < lo) {
+      return {};
+    }
+    std::vector<kvPair<K, V>> ret = std::vector<kvPair<K, V>>();
+    for (Node *node = findGreaterOrEqual(begin);
+         node != nullptr && node->key < end; node = node->next(0)) {
+      ret.emplace_back(toPair(node));
+    }
+
+    return ret;
+  }
+
+ private:
+  std::atomic<Node *> _min, _max;  // key 最小和最大的节点，run 为空时是 nullptr
+  std::atomic<long long> _n;
+  std::atomic<long> _reserved;
+  long _maxSize;
+  std::atomic<int> curMaxLevel;
+  Arena arena;
+  Node *p_listHead;
+
+  static_assert(alignof(Node) <= Arena::kAlign &&
+                    alignof(Cell) <= Arena::kAlign,
+                "node over-aligned for arena");
+
+  // 节点、tower、第一个 cell 以及变长的 key 和 value 的内容一次分配，
+  // 查找命中时读 value 不会多一次 cache miss
+  Node *newNode(const KeyView &key, const ValueView &value, bool isDeleted,
+                int height) {
+    size_t cellOffset =
+        (sizeof(Node) + sizeof(std::atomic<Node *>) * (height - 1) +
+         alignof(Cell) - 1) / alignof(Cell) * alignof(Cell);
+    size_t keyOffset = cellOffset + sizeof(Cell);
+    size_t valueOffset = keyOffset + KeyTraits::extraBytes(key);
+    char *mem = arena.allocate(valueOffset + ValueTraits::extraBytes(value));
+    Cell *cell = new (mem + cellOffset)
+        Cell{ValueTraits::copy(value, mem + valueOffset), isDeleted};
+    return new (mem) Node(KeyTraits::copy(key, mem + keyOffset), cell, height);
+  }
+
+  const Cell *newCell(const ValueView &value, bool isDeleted) {
+    char *mem = arena.allocate(sizeof(Cell) + ValueTraits::extraBytes(value));
+    return new (mem)
+        Cell{ValueTraits::copy(value, mem + sizeof(Cell)), isDeleted};
+  }
+
+  static kvPair<K, V> toPair(Node *node) {
+    const Cell *cell = node->cell.load(std::memory_order_acquire);
+    kvPair<K, V> kv = {KeyTraits::fromView(node->key),
+                       ValueTraits::fromView(cell->value), cell->isDeleted};
+    return kv;
+  }
+
+  // level 0 上第一个 key >= sKey 的节点。返回 level 0 上已经和 sKey
+  // 比较过的 next，重新读 curNode->next(0) 可能读到刚插入的更小的 key
+  Node *findGreaterOrEqual(const KeyView &sKey) {
+    Node *curNode = p_listHead;
+    Node *next = nullptr;
+    for (int level = curMaxLevel.load(std::memory_order_acquire) - 1;
+         level >= 0; level--) {
+      next = curNode->next(level);
+      while (next != nullptr && next->key < sKey) {
+        curNode = next;
+        next = curNode->next(level);
+      }
+    }
+    return next;
+  }
+
+  void findSplice(const KeyView &key, Node **prev, Node **next) {
+    Node *curNode = p_listHead;
+    for (int level = MAXLEVEL - 1; level >= 0; level--) {
+      findSpliceForLevel(key, curNode, level, prev[level], next[level]);
+      curNode = prev[level];
+    }
+  }
+
+  // prev 的 key 都小于上一个插入的 key，只有 next 可能已经 < key。
+  // 包住 key 的层是连续的高层，从最低的那一层往下重新找
+  void recomputeSplice(const KeyView &key, Splice &splice) {
+    int level = 0;
+    while (level < MAXLEVEL && splice.next[level] != nullptr &&
+           splice.next[level]->key < key) {
+      level++;
+    }
+    for (int i = level - 1; i >= 0; i--) {
+      // 上一层新找到的 prev 和这一层原来的 prev 都在 key 之前，取靠后的
+      Node *before = splice.prev[i];
+      if (i + 1 < MAXLEVEL) {
+        Node *upper = splice.prev[i + 1];
+        if (before == p_listHead ||
+            (upper != p_listHead && before->key < upper->key)) {
+          before = upper;
+        }
+      }
+      findSpliceForLevel(key, before, i, splice.prev[i], splice.next[i]);
+    }
+  }
+
+  void findSpliceForLevel(const KeyView &key, Node *before, int level,
+                          Node *&prev, Node *&next) {
+    while (true) {
+      Node *n = before->next(level);
+      if (n == nullptr || !(n->key < key)) {
+        prev = before;
+        next = n;
+        return;
+      }
+      before = n;
+    }
+  }
+
+  // 比较时要读 cur->key，load 和 CAS 失败时都要 acquire，
+  // 保证看到别的线程发布的节点内容
+  void updateMinMax(Node *node) {
+    Node *cur = _min.load(std::memory_order_acquire);
+    while ((cur == nullptr || node->key < cur->key) &&
+           !_min.compare_exchange_weak(cur, node)) {
+    }
+    cur = _max.load(std::memory_order_acquire);
+    while ((cur == nullptr || node->key > cur->key) &&
+           !_max.compare_exchange_weak(cur, node)) {
+    }
+  }
+
+  // 每个线程一个随机数发生器，高度为 i 的概率是 1 / 2^i
+  static int genNodeLevel() {
+    static thread_local std::mt19937 rng(static_cast<uint32_t>(
+        std::hash<std::thread::id>()(std::this_thread::get_id())));
+    return __builtin_ctz(static_cast<uint32_t>(rng()) | (1u << (MAXLEVEL - 1))) +
+           1;
+  }
+};
+
+#endif  // LSMTREE_CONCURRENT_SKIP_LIST_HPP
@@ -0,0 +1,122 @@
+#include <atomic>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "concurrent_skip_list.hpp"
+#include "lsm.hpp"
+#include "test_util.hpp"
+
+const int kWriters = 4;
+const int kReaders = 2;
+
+// 写者 t 写的第 i 个 key，写者之间的 keys 互相交错
+std::string keyOf(int t, int i) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "k%08d", i * kWriters + t);
+  return buf;
+}
+
+// 多个写者并发插入，读者同时查找已经插入完成的 keys：
+// 一定能找到，value 是完整的，min / max 的范围包住这个 key
+void testConcurrentInsertAndSearch() {
+  const int perWriter = 20000;
+  ConcurrentSkipList<std::string, std::string> list;
+  std::atomic<int> inserted[kWriters];
+  for (auto &n : inserted) n.store(0);
+  std::atomic<int> writersDone(0);
+  std::atomic<long> bad(0);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kWriters; t++) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < perWriter; i++) {
+        std::string key = keyOf(t, i);
+        list.insertKey(key, "v" + key);
+        inserted[t].store(i + 1, std::memory_order_release);
+      }
+      writersDone++;
+    });
+  }
+  for (int r = 0; r < kReaders; r++) {
+    threads.emplace_back([&, r]() {
+      std::mt19937 rng(r);
+      while (writersDone.load() < kWriters) {
+        int t = rng() % kWriters;
+        int n = inserted[t].load(std::memory_order_acquire);
+        if (n == 0) continue;
+        std::string key = keyOf(t, rng() % n);
+        bool isFound = false, isDeleted = false;
+        std::string value = list.search(key, isFound, isDeleted);
+        Slice lo, hi;
+        if (!isFound || isDeleted || value != "v" + key ||
+            !list.getBounds(lo, hi) || Slice(key) < lo || Slice(key) > hi) {
+          bad++;
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) thread.join();
+  CHECK(bad.load() == 0);
+
+  std::vector<kvPair<std::string, std::string>> all = list.getAll();
+  CHECK(all.size() == static_cast<size_t>(kWriters * perWriter));
+  for (size_t i = 0; i < all.size(); i++) {
+    CHECK(all[i].key == keyOf(i % kWriters, i / kWriters));
+    CHECK(all[i].value == "v" + all[i].key);
+  }
+  CHECK(list.getMin() == keyOf(0, 0));
+  CHECK(list.getMax() == keyOf(kWriters - 1, perWriter - 1));
+}
+
+// 通过 LSM 并发写入，读者查找已经写入完成的 keys。写入过程中 C_0 的 runs
+// 会被 flush 和 merge，读者要经过并发写入的 filters 和 disk levels
+void testLSMConcurrentInsertAndSearch() {
+  const int perWriter = 50000;
+  TempDir tmp;
+  auto lsm = openLSM(tmp.path(), false);
+  std::atomic<int> inserted[kWriters];
+  for (auto &n : inserted) n.store(0);
+  std::atomic<int> writersDone(0);
+  std::atomic<long> bad(0);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kWriters; t++) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < perWriter; i++) {
+        int key = i * kWriters + t, value = key + 1;
+        lsm->insertKey(key, value);
+        inserted[t].store(i + 1, std::memory_order_release);
+      }
+      writersDone++;
+    });
+  }
+  for (int r = 0; r < kReaders; r++) {
+    threads.emplace_back([&, r]() {
+      std::mt19937 rng(r);
+      while (writersDone.load() < kWriters) {
+        int t = rng() % kWriters;
+        int n = inserted[t].load(std::memory_order_acquire);
+        if (n == 0) continue;
+        int key = (rng() % n) * kWriters + t, value;
+        if (!lsm->search(key, value) || value != key + 1) bad++;
+      }
+    });
+  }
+  for (auto &thread : threads) thread.join();
+  CHECK(bad.load() == 0);
+
+  for (int key = 0; key < kWriters * perWriter; key++) {
+    int value;
+    CHECK(lsm->search(key, value));
+    CHECK(value == key + 1);
+  }
+}
+
+int main() {
+  RUN_TEST(testConcurrentInsertAndSearch);
+  RUN_TEST(testLSMConcurrentInsertAndSearch);
+  return 0;
+}
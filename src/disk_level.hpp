@@ -4,167 +4,357 @@
 #include <assert.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "compaction_policy.hpp"
 #include "disk_run.hpp"
+#include "loser_tree.hpp"
 #include "run.hpp"
 
-#define LEFTCHILD(x) 2 * x + 1
-#define RIGHTCHILD(x) 2 * x + 2
-#define PARENT(x) (x - 1) / 2
-
-int TOMBSTONE = INT_MIN;
+// 发布给读者的 run。filter 单独持有引用，重建 filter 时 run 换上新的对象，
+// 旧的 filter 随引用它的 version 一起释放
+template <class K, class V>
+struct DiskRunRef {
+  std::shared_ptr<DiskRun<K, V>> run;
+  std::shared_ptr<const BlockedBloomFilter<K>> bf;
+};
 
+// multiGet 的一批 keys，按 key 排好序。pending 是还没有找到的 keys 的下标，
+// 保持有序，每查完一个 run 去掉已经找到的，全部找到之后不再查后面的 runs
 template <class K, class V>
-class DiskLevel {
- public:
-  typedef kvPair<K, V> KVPair_t;
-  typedef std::pair<kvPair<K, V>, int> KVIntPair_t;
-  KVPair_t KVPMAX;
-  KVIntPair_t KVPINTMAX;
-  V V_TOMBSTONE = static_cast<V>(TOMBSTONE); // 墓碑机制
-
-  struct StaticHead {
-    int size;
-    std::vector<KVIntPair_t> arr;
-    KVIntPair_t max;
-    StaticHead(int sz, KVIntPair_t mx) {
-      size = 0;
-      arr = std::vector<KVIntPair_t>(sz, mx);
-      max = mx;
-    }
-
-    void push(KVIntPair_t blob) {
-      int idx = size++;
-      while (idx && blob < arr[PARENT(idx)]) {
-        arr[idx] = arr[PARENT(idx)];
-        idx = PARENT(idx);
-      }
-      arr[idx] = blob;
+struct LookupBatch {
+  typedef typename SliceTraits<K>::View KeyView;
+
+  std::vector<K> keys;
+  std::vector<std::array<uint64_t, 2>> hashes;  // 所有 filters 共用
+  std::vector<V> values;
+  std::unique_ptr<bool[]> resolved;  // 找到了最新的版本，可能是墓碑
+  std::unique_ptr<bool[]> deleted;   // 找到的最新版本是墓碑
+  std::vector<long> pending;
+  std::vector<long> candidates;  // probe 的结果
+
+  explicit LookupBatch(std::vector<K> sortedKeys)
+      : keys(std::move(sortedKeys)),
+        values(keys.size()),
+        resolved(new bool[keys.size()]()),
+        deleted(new bool[keys.size()]()) {
+    for (long i = 0; i < static_cast<long>(keys.size()); i++) {
+      hashes.push_back(
+          BlockedBloomFilter<K>::hash(SliceTraits<K>::view(keys[i])));
+      pending.push_back(i);
     }
+  }
 
-    void heapify(int idx) {
-      int smallestIdx =
-          (LEFTCHILD(idx) < size && arr[LEFTCHILD(idx)] < arr[idx])
-              ? LEFTCHILD(idx)
-              : idx;
-      if (RIGHTCHILD(idx) < size && arr[RIGHTCHILD(idx)] < arr[smallestIdx]) {
-        smallestIdx = RIGHTCHILD(idx);
-      }
-
-      if (smallestIdx != idx) {
-        KVIntPair_t tmp = arr[idx];
-        arr[idx] = arr[smallestIdx];
-        arr[smallestIdx] = tmp;
-        heapify(smallestIdx);
-      }
+  // pending 中落在 [lo, hi] 并且通过 filter 的 keys 放进 candidates，
+  // 返回测试了几个 keys。先预取所有 keys 的 filter line 再逐个测试，
+  // cache miss 互相重叠。concurrent 表示 filter 还在被并发写入（C_0）
+  long probe(const BlockedBloomFilter<K> &filter, const KeyView &lo,
+             const KeyView &hi, bool concurrent = false) {
+    candidates.clear();
+    auto first = std::lower_bound(
+        pending.begin(), pending.end(), lo, [this](long i, const KeyView &key) {
+          return SliceTraits<K>::view(keys[i]) < key;
+        });
+    auto last = std::upper_bound(
+        first, pending.end(), hi, [this](const KeyView &key, long i) {
+          return key < SliceTraits<K>::view(keys[i]);
+        });
+    for (auto it = first; it != last; ++it) filter.prefetch(hashes[*it]);
+    for (auto it = first; it != last; ++it) {
+      bool pass = concurrent ? filter.isContainHashConcurrent(hashes[*it])
+                             : filter.isContainHash(hashes[*it]);
+      if (pass) candidates.push_back(*it);
     }
+    return last - first;
+  }
 
-    KVIntPair_t pop() {
-      KVIntPair_t ret = arr[0];
-      arr[0] = arr[--size];
-      heapify(0);
-      return ret;
-    }
-  };
+  void removeResolved() {
+    pending.erase(std::remove_if(pending.begin(), pending.end(),
+                                 [this](long i) { return resolved[i]; }),
+                  pending.end());
+  }
+
+  bool done() { return pending.empty(); }
+};
+
+template <class K, class V>
+class DiskLevel {
+ public:
+  typedef kvPair<K, V> KVPair_t;
+  typedef SliceTraits<K> KeyTraits;
+  typedef typename KeyTraits::View KeyView;
 
   int _level;
   int _blockSize;       // 每个 block 元素个数，per fence pointer
   int _numRunsPerLevel; // 一层多少个 Runs
   int _activeRunIdx;    // index of active run;
   int _mergeSize;       // 向下合并的 runs 数
+  bool _leveled;        // 新到的 runs 和本层唯一的 run 归并成一个
 
   long _runSize;        // 每个 runs 的元素个数;
 
   double _bfFalsePositive; // 假阳性的概率
+  bool _compressValues;    // 新写入的 runs 是否压缩 values
+  std::string _dir;        // 新写入的 runs 所在的目录，为空时不持久化
+  std::shared_ptr<BlockCache> _cache;  // 不为空时新写入的 runs 用 pread 读
+  std::shared_ptr<IOEngine> _io;       // runs 批量读 blocks 用的 I/O 引擎
+  std::shared_ptr<EngineStats> _stats; // 新的 runs 记录计数的地方
+  int _mergeThreads;       // addRuns 最多用几个线程
 
-  std::vector<DiskRun<K, V> *> runs;
+  static const long kMinPartitionSize = 1 << 16;  // 每个分区至少的元素个数
+
+  std::vector<std::shared_ptr<DiskRun<K, V>>> runs;
 
   DiskLevel<K, V>(int blockSize, int level, long runSize, int numRunsPerLevel,
-                  int mergeSize, double bfFalsePositive)
-      : _blockSize(blockSize),
-        _level(level),
-        _runSize(runSize),
+                  int mergeSize, double bfFalsePositive, bool leveled = false)
+      : _level(level),
+        _blockSize(blockSize),
         _numRunsPerLevel(numRunsPerLevel),
+        _activeRunIdx(0),
         _mergeSize(mergeSize),
-        _bfFalsePositive(bfFalsePositive) {
-    KVPMAX = KVPair_t{INT_MAX, 0};
-    KVPINTMAX = KVIntPair_t(KVPMAX, -1);
+        _leveled(leveled),
+        _runSize(runSize),
+        _bfFalsePositive(bfFalsePositive),
+        _compressValues(false),
+        _mergeThreads(
+            std::max<int>(std::thread::hardware_concurrency(), 1)) {
     for (auto i = 0; i < _numRunsPerLevel; i++) {
-      DiskRun<K, V> *run =
-          new DiskRun<K, V>(_runSize, _blockSize, _level, i, _bfFalsePositive);
-      runs.push_back(run);
+      runs.push_back(newRun(i));
     }
   }
 
-  ~DiskLevel<K, V>() {
-    for (auto i = 0; i < runs.size(); i++) {
-      delete runs[i];
-    }
+  std::shared_ptr<DiskRun<K, V>> newRun(int runID) {
+    auto run = std::make_shared<DiskRun<K, V>>(_runSize, _blockSize, _level,
+                                               runID, _bfFalsePositive);
+    run->setValueCompression(_compressValues);
+    run->setDirectory(_dir);
+    run->setBlockCache(_cache);
+    run->setIOEngine(_io);
+    run->setStats(_stats);
+    return run;
   }
 
-  // 最小堆，每次都从一个 runs 中拿出一个最小值
-  void addRuns(std::vector<DiskRun<K, V> *> &runList, const long runlen,
+  // 把 runList (从旧到新) 归并成本层的一个新 run。输入按 key 范围切成若干个
+  // 分区，每个分区由一个线程归并到输出缓冲区中各自的区域，最后把各区域
+  // 拼接起来再统一构建 block index 和 filter。leveling 的层把已有的 run
+  // 作为最旧的输入一起归并，结果替换掉它
+  void addRuns(std::vector<std::shared_ptr<DiskRun<K, V>>> &runList,
                bool isLastLevel) {
-    StaticHead h = StaticHead(static_cast<int>(runlen), KVPINTMAX);
-
-    std::vector<int> heads(runList.size(), 0);
-    for (int i = 0; i < runList.size(); i++) {
-      KVPair_t kvp = runList[i]->map[0];
-      h.push(KVIntPair_t(kvp, i));
-    }
-
-    int j = -1;
-    K lastKey = INT_MAX;
-    int lastK = INT_MIN;
-    while (h.size != 0) {
-      auto val_run_pair = h.pop();
-      if (lastKey == val_run_pair.first.key) {
-        if (lastK < val_run_pair.second) {
-          runs[_activeRunIdx]->map[j] = val_run_pair.first;
-        }
-      } else {
-        ++j;
-        if (j != -1 && isLastLevel &&
-            runs[_activeRunIdx]->map[j].value == V_TOMBSTONE) {
-          --j;
-        }
-        runs[_activeRunIdx]->map[j] = val_run_pair.first;
-      }
-      lastKey = val_run_pair.first.key;
-      lastK = val_run_pair.second;
+    std::vector<std::shared_ptr<DiskRun<K, V>>> inputs;
+    std::shared_ptr<DiskRun<K, V>> replaced;
+    if (_leveled && _activeRunIdx > 0) {
+      replaced = runs[0];
+      inputs.push_back(replaced);
+      runs[0] = newRun(0);
+      _activeRunIdx = 0;
+    }
 
-      int k = val_run_pair.second;
-      if (++heads[k] < runList[k]->getCapacity()) {
-        KVPair_t kvp = runList[k]->map[heads[k]];
-        h.push(KVIntPair_t(kvp, k));
-      }
+    long total = replaced ? replaced->getCapacity() : 0;
+    for (auto &run : runList) {
+      total += run->getCapacity();
+      inputs.push_back(run);
+    }
+    assert(total <= _runSize);
+
+    std::vector<K> splitters = chooseSplitters(inputs, total);
+    int parts = static_cast<int>(splitters.size()) + 1;
+    KVPair_t *out = runs[_activeRunIdx]->stage(total);
+
+    // 分区的输入元素个数是它输出个数的上界，按输入的前缀和划分输出区域
+    std::vector<long> start(parts, 0), written(parts, 0);
+    for (int i = 1; i < parts; i++) {
+      for (auto &run : inputs) start[i] += run->rank(splitters[i - 1]);
     }
 
-    if (isLastLevel && runs[_activeRunIdx]->map[j].value == V_TOMBSTONE) {
-      --j;
+    std::vector<std::thread> workers;
+    for (int i = 1; i < parts; i++) {
+      workers.emplace_back([&, i]() {
+        const K *hi = i + 1 < parts ? &splitters[i] : nullptr;
+        written[i] = mergePartition(inputs, &splitters[i - 1], hi,
+                                    isLastLevel, out + start[i]);
+      });
+    }
+    written[0] = mergePartition(inputs, nullptr,
+                                parts > 1 ? &splitters[0] : nullptr,
+                                isLastLevel, out);
+    for (auto &worker : workers) {
+      worker.join();
+    }
+
+    long n = written[0];
+    for (int i = 1; i < parts; i++) {
+      std::move(out + start[i], out + start[i] + written[i], out + n);
+      n += written[i];
     }
 
-    runs[_activeRunIdx]->setCapacity(j + 1);
+    runs[_activeRunIdx]->setCapacity(n);
     runs[_activeRunIdx]->constructIndex();
 
-    if (j + 1 > 0) {
+    if (n > 0) {
       ++_activeRunIdx;
     }
+    if (replaced) {
+      replaced->markObsolete();
+    }
+  }
+
+  // 并行归并用的线程数，默认是 CPU 核数
+  void setMergeThreads(int mergeThreads) {
+    _mergeThreads = std::max(mergeThreads, 1);
+  }
+
+  // 从所有输入 runs 的 block index 中按分位数选出分区的分界 key，
+  // 分区 i 是 [splitters[i - 1], splitters[i])
+  std::vector<K> chooseSplitters(
+      std::vector<std::shared_ptr<DiskRun<K, V>>> &runList, long total) {
+    long parts = std::min(static_cast<long>(_mergeThreads),
+                          total / kMinPartitionSize);
+    if (parts <= 1) {
+      return {};
+    }
+
+    std::vector<K> samples;
+    for (auto &run : runList) {
+      samples.insert(samples.end(), run->_blockKeys.begin(),
+                     run->_blockKeys.end());
+    }
+    std::sort(samples.begin(), samples.end());
+
+    std::vector<K> splitters;
+    for (long i = 1; i < parts; i++) {
+      K key = samples[i * samples.size() / parts];
+      if (key != samples[0] && (splitters.empty() || key > splitters.back())) {
+        splitters.push_back(key);
+      }
+    }
+    return splitters;
+  }
+
+  // 归并 runList 中 [lo, hi) 范围内的元素写到 out，返回写入的个数。
+  // lo / hi 为空表示不限。相同的 key 按 run 的下标从小到大弹出，新的覆盖旧的；
+  // 最后一层不再需要墓碑，直接丢掉
+  long mergePartition(std::vector<std::shared_ptr<DiskRun<K, V>>> &runList,
+                      const K *lo, const K *hi, bool isLastLevel,
+                      KVPair_t *out) {
+    int numRuns = static_cast<int>(runList.size());
+    LoserTree<KeyView> tree(numRuns);
+    std::vector<typename DiskRun<K, V>::Iterator> iters;
+    KeyView end = hi != nullptr ? KeyTraits::view(*hi) : KeyView();
+    for (int i = 0; i < numRuns; i++) {
+      iters.emplace_back(runList[i], false);
+      if (lo != nullptr) {
+        iters[i].seek(*lo);
+      } else {
+        iters[i].seekToFirst();
+      }
+      if (iters[i].valid() && (hi == nullptr || iters[i].keyView() < end)) {
+        tree.set(i, iters[i].keyView());
+      }
+    }
+    tree.build();
+
+    long n = 0;
+    bool hasPending = false;
+    KVPair_t pending;
+    while (!tree.empty()) {
+      int k = tree.top();
+      if (!hasPending || KeyTraits::view(pending.key) != iters[k].keyView()) {
+        if (hasPending && !(isLastLevel && pending.isDeleted)) {
+          out[n++] = std::move(pending);
+        }
+        hasPending = true;
+        pending.key = iters[k].key();
+      }
+      pending.value = iters[k].value();
+      pending.isDeleted = iters[k].isDeleted();
+
+      iters[k].next();
+      if (iters[k].valid() && (hi == nullptr || iters[k].keyView() < end)) {
+        tree.set(k, iters[k].keyView());
+      } else {
+        tree.setEnd(k);
+      }
+      tree.replay();
+    }
+
+    if (hasPending && !(isLastLevel && pending.isDeleted)) {
+      out[n++] = std::move(pending);
+    }
+    return n;
   }
 
-  void addRunByArray(KVPair_t *runToAdd, const long runlen) {
+  // runToAdd 是从 C_0 归并出来的有序元素。isLastLevel 表示写入之后本层
+  // 就是全部的 disk 数据，墓碑不再需要，和 addRuns 一样直接丢掉。
+  // 没有元素时不写入，返回是否写入了新的 run
+  bool addRunByArray(KVPair_t *runToAdd, long runlen,
+                     bool isLastLevel = false) {
+    if (_leveled && _activeRunIdx > 0) {
+      return mergeArray(runToAdd, runlen, isLastLevel);
+    }
+    if (isLastLevel) {
+      runlen = std::remove_if(runToAdd, runToAdd + runlen,
+                              [](const KVPair_t &kv) { return kv.isDeleted; }) -
+               runToAdd;
+    }
+    if (runlen == 0) {
+      return false;
+    }
     assert(_activeRunIdx < _numRunsPerLevel);
-    assert(runlen == _runSize);
+    assert(runlen <= _runSize);
     runs[_activeRunIdx]->writeData(runToAdd, 0, runlen);
     runs[_activeRunIdx]->constructIndex();
     _activeRunIdx++;
+    return true;
+  }
+
+  // leveling 的层把有序的 runToAdd 和已有的 run 归并成一个新的 run，
+  // 相同的 key 保留 runToAdd 中的值。最后一层去掉所有墓碑，结果为空时
+  // 本层变空，返回是否还有 run
+  bool mergeArray(KVPair_t *runToAdd, const long runlen, bool isLastLevel) {
+    std::shared_ptr<DiskRun<K, V>> replaced = runs[0];
+    assert(replaced->getCapacity() + runlen <= _runSize);
+    runs[0] = newRun(0);
+    KVPair_t *out = runs[0]->stage(replaced->getCapacity() + runlen);
+
+    long n = 0, j = 0;
+    auto emit = [&](KVPair_t kv) {
+      if (!(isLastLevel && kv.isDeleted)) out[n++] = std::move(kv);
+    };
+    typename DiskRun<K, V>::Iterator it(replaced, false);
+    for (it.seekToFirst(); it.valid(); it.next()) {
+      KeyView key = it.keyView();
+      while (j < runlen && KeyTraits::view(runToAdd[j].key) < key) {
+        emit(runToAdd[j++]);
+      }
+      if (j < runlen && KeyTraits::view(runToAdd[j].key) == key) {
+        emit(runToAdd[j++]);
+      } else {
+        emit(KVPair_t{it.key(), it.value(), it.isDeleted()});
+      }
+    }
+    while (j < runlen) {
+      emit(runToAdd[j++]);
+    }
+
+    runs[0]->setCapacity(n);
+    runs[0]->constructIndex();
+    replaced->markObsolete();
+    if (n == 0) {
+      _activeRunIdx = 0;
+      return false;
+    }
+    return true;
   }
 
   // return runs [0, _mergeSize)
-  std::vector<DiskRun<K, V> *> getRunsToMerge() {
-    std::vector<DiskRun<K, V> *> toMerge;
+  std::vector<std::shared_ptr<DiskRun<K, V>>> getRunsToMerge() {
+    std::vector<std::shared_ptr<DiskRun<K, V>>> toMerge;
     for (int i = 0; i < _mergeSize; i++) {
       toMerge.push_back(runs[i]);
     }
@@ -172,54 +362,184 @@ class DiskLevel {
     return toMerge;
   }
 
-  void freeMergedRuns(std::vector<DiskRun<K, V> *> &toFree) {
-    assert(toFree.size() == _mergeSize);
+  // 合并完的 runs 从本层移除，文件在最后一个引用它的 version 释放时删除
+  void freeMergedRuns(std::vector<std::shared_ptr<DiskRun<K, V>>> &toFree) {
+    assert(toFree.size() == static_cast<size_t>(_mergeSize));
     for (auto i = 0; i < _mergeSize; i++) {
       assert(toFree[i]->_level == _level);
-      delete toFree[i];
+      toFree[i]->markObsolete();
     }
 
     runs.erase(runs.begin(), runs.begin() + _mergeSize);
     _activeRunIdx -= _mergeSize;
     for (auto i = 0; i < _activeRunIdx; i++) {
       runs[i]->_runID = i;
-      std::string newName = "C_" + std::to_string(runs[i]->_level) + "_" +
-                            std::to_string(runs[i]->_runID) + ".clsm";
-
-      if (rename(runs[i]->_filename.c_str(), newName.c_str())) {
-        perror(("Error renaming file " + runs[i]->_filename + " to " + newName)
-                   .c_str());
-        exit(EXIT_FAILURE);
-      }
-      runs[i]->_filename = newName;
     }
 
     for (auto i = _activeRunIdx; i < _numRunsPerLevel; i++) {
-      DiskRun<K, V> *newRun =
-          new DiskRun<K, V>(_runSize, _blockSize, _level, i, _bfFalsePositive);
-      runs.push_back(newRun);
+      runs.push_back(newRun(i));
+    }
+  }
+
+  // 已经写完的 runs [0, _activeRunIdx)，用于发布新的 version
+  std::vector<DiskRunRef<K, V>> getActiveRuns() {
+    std::vector<DiskRunRef<K, V>> active;
+    for (auto i = 0; i < _activeRunIdx; i++) {
+      active.push_back(DiskRunRef<K, V>{runs[i], runs[i]->bf});
+    }
+    return active;
+  }
+
+  // 修改本层的假阳性率，已经写入的 runs 立即重建 filter
+  void setFalsePositive(double bfFalsePositive) {
+    if (bfFalsePositive == _bfFalsePositive) return;
+    _bfFalsePositive = bfFalsePositive;
+    for (int i = 0; i < static_cast<int>(runs.size()); i++) {
+      runs[i]->setFalsePositive(_bfFalsePositive, i < _activeRunIdx);
+    }
+  }
+
+  void setDirectory(const std::string &dir) {
+    _dir = dir;
+    for (size_t i = _activeRunIdx; i < runs.size(); i++) {
+      runs[i]->setDirectory(_dir);
+    }
+  }
+
+  // 之后写入的 runs 通过 cache 读
+  void setBlockCache(std::shared_ptr<BlockCache> cache) {
+    _cache = std::move(cache);
+    for (size_t i = _activeRunIdx; i < runs.size(); i++) {
+      runs[i]->setBlockCache(_cache);
+    }
+  }
+
+  void setIOEngine(std::shared_ptr<IOEngine> io) {
+    _io = std::move(io);
+    for (auto &run : runs) {
+      run->setIOEngine(_io);
+    }
+  }
+
+  void setStats(std::shared_ptr<EngineStats> stats) {
+    _stats = std::move(stats);
+    for (auto &run : runs) {
+      run->setStats(_stats);
+    }
+  }
+
+  // 重新打开目录时用 manifest 中记录的 runs 作为本层已经写完的 runs
+  void restoreRuns(std::vector<std::shared_ptr<DiskRun<K, V>>> &restored) {
+    assert(_activeRunIdx == 0 &&
+           restored.size() <= static_cast<size_t>(_numRunsPerLevel));
+    for (size_t i = 0; i < restored.size(); i++) {
+      runs[i] = restored[i];
+      runs[i]->setIOEngine(_io);
+      runs[i]->setStats(_stats);
+    }
+    _activeRunIdx = static_cast<int>(restored.size());
+  }
+
+  std::vector<uint64_t> getFileIDs() {
+    std::vector<uint64_t> ids;
+    for (auto i = 0; i < _activeRunIdx; i++) ids.push_back(runs[i]->getFileID());
+    return ids;
+  }
+
+  // 只影响之后写入的 runs，已经写好的文件保持原来的编码
+  void setValueCompression(bool compressValues) {
+    _compressValues = compressValues;
+    for (size_t i = _activeRunIdx; i < runs.size(); i++) {
+      runs[i]->setValueCompression(_compressValues);
     }
   }
 
   bool isLevelFull() { return _activeRunIdx == _numRunsPerLevel; }
 
+  // 本层能否再放下 incoming 个元素。leveling 的层看和已有的 run
+  // 归并之后会不会超过容量
+  bool canAccept(long incoming) {
+    if (_leveled && _activeRunIdx > 0) {
+      return runs[0]->getCapacity() + incoming <= _runSize;
+    }
+    return !isLevelFull();
+  }
+
+  bool hasShape(const LevelShape &shape) {
+    return shape == LevelShape{_numRunsPerLevel, _mergeSize, _runSize,
+                               _leveled};
+  }
+
+  // 按 compaction policy 修改本层的形状，只能在本层为空时调用
+  void reshape(const LevelShape &shape) {
+    assert(isLevelEmpty());
+    _numRunsPerLevel = shape.numRuns;
+    _mergeSize = shape.mergeSize;
+    _runSize = shape.runSize;
+    _leveled = shape.leveled;
+    runs.clear();
+    for (auto i = 0; i < _numRunsPerLevel; i++) {
+      runs.push_back(newRun(i));
+    }
+  }
+
   bool isLevelEmpty() { return _activeRunIdx == 0; }
 
-  V search(const K &key, bool &isFound) {
-    int maxRunToSearch = _activeRunIdx - 1;
-    for (int i = maxRunToSearch; i >= 0; i--) {
-      if (runs[i]->maxKey == INT_MIN || key < runs[i]->minKey ||
-          key > runs[i]->maxKey || !runs[i]->bf.isContain(&key, sizeof(K))) {
+  V search(const K &key, bool &isFound, bool &isDeleted) {
+    return searchRuns(getActiveRuns(), key, isFound, isDeleted);
+  }
+
+  // 从新到旧查找一组 runs，找到墓碑时 isFound 和 isDeleted 都为 true
+  static V searchRuns(const std::vector<DiskRunRef<K, V>> &refs, const K &key,
+                      bool &isFound, bool &isDeleted) {
+    KeyView k = KeyTraits::view(key);
+    for (int i = static_cast<int>(refs.size()) - 1; i >= 0; i--) {
+      DiskRun<K, V> *run = refs[i].run.get();
+      if (run->isEmpty() || k < KeyTraits::view(run->minKey) ||
+          k > KeyTraits::view(run->maxKey)) {
+        continue;
+      }
+      run->tick(FILTER_PROBES);
+      if (!refs[i].bf->isContain(k)) {
+        run->tick(FILTER_NEGATIVES);
         continue;
       }
 
-      V lookupRet = runs[i]->search(key, isFound);
+      V lookupRet = run->search(key, isFound, isDeleted);
       if (isFound) {
         return lookupRet;
       }
+      run->tick(FILTER_FALSE_POSITIVES);
     }
 
-    return static_cast<V>(NULL);
+    return V();
+  }
+
+  // 批量查找 batch 中还没有找到的 keys。从新到旧每个 run 先用 filter
+  // 筛出候选，再把候选要读的 blocks 一次读进来
+  static void multiSearchRuns(const std::vector<DiskRunRef<K, V>> &refs,
+                              LookupBatch<K, V> &batch) {
+    for (int i = static_cast<int>(refs.size()) - 1; i >= 0 && !batch.done();
+         i--) {
+      DiskRun<K, V> *run = refs[i].run.get();
+      if (run->isEmpty()) continue;
+
+      long probed = batch.probe(*refs[i].bf, KeyTraits::view(run->minKey),
+                                KeyTraits::view(run->maxKey));
+      long passed = batch.candidates.size();
+      if (probed > 0) {
+        run->tick(FILTER_PROBES, probed);
+        run->tick(FILTER_NEGATIVES, probed - passed);
+      }
+      if (passed == 0) continue;
+      run->multiSearch(batch.keys.data(), batch.candidates,
+                       batch.values.data(), batch.resolved.get(),
+                       batch.deleted.get());
+      size_t pending = batch.pending.size();
+      batch.removeResolved();
+      run->tick(FILTER_FALSE_POSITIVES,
+                passed - (pending - batch.pending.size()));
+    }
   }
 
   long eltsNums() {
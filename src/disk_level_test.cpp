@@ -0,0 +1,182 @@
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "disk_level.hpp"
+#include "lsm.hpp"
+#include "test_util.hpp"
+
+typedef DiskLevel<int, int> Level;
+typedef std::shared_ptr<DiskRun<int, int>> RunPtr;
+
+const int kKeySpace = 150000;
+const int kNumInputs = 3;
+
+// 期望的归并结果：key 对应 (value, isDeleted)
+typedef std::map<int, std::pair<int, bool>> Model;
+
+// 依次写入 run 的元素，新的覆盖旧的
+void applyRun(Model &model, const std::vector<kvPair<int, int>> &run) {
+  for (auto &kv : run) model[kv.key] = std::make_pair(kv.value, kv.isDeleted);
+}
+
+// 在 src 中写入 kNumInputs 个 runs，从旧到新，元素也放进 entries。
+// 每个 run 有大约 2/3 的 keys，其中一部分是墓碑
+std::vector<RunPtr> writeInputs(
+    Level &src, std::vector<std::vector<kvPair<int, int>>> &entries) {
+  std::mt19937 rng(1);
+  entries.resize(kNumInputs);
+  for (int r = 0; r < kNumInputs; r++) {
+    for (int key = 0; key < kKeySpace; key++) {
+      if (key % kNumInputs == r) continue;
+      bool isDeleted = rng() % 10 == 0;
+      int value = isDeleted ? 0 : r * 1000000 + key;
+      entries[r].push_back(kvPair<int, int>{key, value, isDeleted});
+    }
+    CHECK(src.addRunByArray(entries[r].data(), entries[r].size()));
+  }
+  return src.getRunsToMerge();
+}
+
+// 把 inputs 归并进 dst，结果和 model 一致：不是最后一层时保留墓碑，
+// 最后一层时去掉
+void checkMerge(Level &dst, std::vector<RunPtr> inputs, const Model &model,
+                bool isLastLevel) {
+  dst.addRuns(inputs, isLastLevel);
+  CHECK(dst._activeRunIdx == 1);
+
+  auto expected = model.begin();
+  auto skipDropped = [&]() {
+    while (expected != model.end() && isLastLevel &&
+           expected->second.second) {
+      ++expected;
+    }
+  };
+  typename DiskRun<int, int>::Iterator it(dst.runs[0]);
+  for (it.seekToFirst(); it.valid(); it.next()) {
+    skipDropped();
+    CHECK(expected != model.end());
+    CHECK(it.key() == expected->first);
+    CHECK(it.isDeleted() == expected->second.second);
+    if (!it.isDeleted()) CHECK(it.value() == expected->second.first);
+    ++expected;
+  }
+  skipDropped();
+  CHECK(expected == model.end());
+}
+
+// 输入足够大时按 key 范围切成多个分区并行归并。tiering 和 leveling 的层、
+// 是否最后一层，结果都和单线程的模型一致
+void testPartitionedMerge() {
+  TempDir tmp;
+  Level src(16, 1, kKeySpace, kNumInputs, kNumInputs, 0.01);
+  src.setDirectory(tmp.path());
+  std::vector<std::vector<kvPair<int, int>>> entries;
+  std::vector<RunPtr> inputs = writeInputs(src, entries);
+
+  long total = 0;
+  for (auto &run : inputs) total += run->getCapacity();
+  CHECK(total >= 3 * Level::kMinPartitionSize);
+
+  // leveling 的层已有的 run 是最旧的输入
+  std::vector<kvPair<int, int>> old;
+  for (int key = 0; key < kKeySpace; key += 5) {
+    old.push_back(kvPair<int, int>{key, -key, false});
+  }
+
+  for (int leveled = 0; leveled < 2; leveled++) {
+    Model model;
+    if (leveled) applyRun(model, old);
+    for (int r = 0; r < kNumInputs; r++) applyRun(model, entries[r]);
+
+    for (int last = 0; last < 2; last++) {
+      for (int threads : {1, 4}) {
+        Level dst(16, 2, 2 * total, leveled ? 1 : 2, 1, 0.01, leveled);
+        dst.setDirectory(tmp.path());
+        dst.setMergeThreads(threads);
+        std::vector<int> splitters = dst.chooseSplitters(inputs, total);
+        CHECK(splitters.size() == (threads == 1 ? 0u : 3u));
+
+        if (leveled) CHECK(dst.addRunByArray(old.data(), old.size()));
+        checkMerge(dst, inputs, model, last);
+      }
+    }
+  }
+}
+
+// 通过 LSM 写入：runs 大到第 2 层的归并会被分区，tiering 和 leveling
+// 都读到正确的内容，包括跨分区的删除。重新打开时 merge 线程已经结束，
+// 第 2 层一定已经写好
+void testLSMParallelMerge() {
+  const int keySpace = 600000;
+  for (int leveling = 0; leveling < 2; leveling++) {
+    TempDir tmp;
+    auto open = [&]() {
+      std::unique_ptr<TestLSM> lsm(new TestLSM(15000, 4, 1.0, 0.01, 16, 3));
+      lsm->setMergeThreads(4);
+      if (leveling) {
+        lsm->setCompactionPolicy(std::make_shared<LevelingPolicy>(3));
+      }
+      lsm->open(tmp.path(), WalSyncMode::NONE);
+      return lsm;
+    };
+
+    std::map<int, int> ref;
+    writeRandom(*open(), ref, 260000, 1, keySpace, 10);
+    auto lsm = open();
+    // 第 2 层的 run 是一次归并的输出，不会比输入多
+    StatsSnapshot stats = lsm->getStats();
+    CHECK(stats.levels.size() >= 3);
+    CHECK(stats.levels[2].entries >= 2 * Level::kMinPartitionSize);
+    checkContents(*lsm, ref, keySpace);
+  }
+}
+
+// 只有一层 leveling 的 disk level 时，flush 进来的删除不会再遮住
+// 更老的数据，归并时直接丢掉，层中不留下墓碑
+void testLastLevelDropsTombstones() {
+  TempDir tmp;
+  std::string dir = tmp.file("db");
+  std::map<int, int> ref;
+  {
+    auto lsm = openLSM(dir, true);
+    for (int key = 0; key < 400; key++) {
+      int value = key;
+      lsm->insertKey(key, value);
+      ref[key] = value;
+    }
+    for (int key = 0; key < 400; key++) {
+      lsm->deleteKey(key);
+      ref.erase(key);
+    }
+    // 把上面的写入都 flush 到 disk level
+    for (int key = 1000; key < 1800; key++) {
+      int value = key;
+      lsm->insertKey(key, value);
+      ref[key] = value;
+    }
+    checkContents(*lsm, ref, 2000);
+  }
+
+  // 重新打开时 merge 线程已经结束
+  auto lsm = openLSM(dir, true);
+  CHECK(lsm->diskLevels.size() == 1);
+  DiskLevel<int, int> *level = lsm->diskLevels[0];
+  for (int i = 0; i < level->_activeRunIdx; i++) {
+    typename DiskRun<int, int>::Iterator it(level->runs[i]);
+    for (it.seekToFirst(); it.valid(); it.next()) {
+      CHECK(!it.isDeleted());
+    }
+  }
+  checkContents(*lsm, ref, 2000);
+}
+
+int main() {
+  RUN_TEST(testPartitionedMerge);
+  RUN_TEST(testLSMParallelMerge);
+  RUN_TEST(testLastLevelDropsTombstones);
+  return 0;
+}
@@ -7,228 +7,872 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <type_traits>
 
+#include "block_cache.hpp"
 #include "bloom_filter.hpp"
-#include "climits"
+#include "compress.hpp"
+#include "fence_index.hpp"
+#include "io_engine.hpp"
+#include "iterator.hpp"
 #include "run.hpp"
+#include "slice.hpp"
+#include "stats.hpp"
 
 template <class K, class V>
 class DiskLevel;
+
+// 磁盘上的 run。数据先写入缓冲区 map，constructIndex 时按
+// _blockSize 个元素一个 block 编码写入文件，之后通过只读 mmap 访问。
+// 文件格式: block 0 | block 1 | ... | block index | filter | footer
+// block: BlockHeader | keys | 墓碑 bitmap | values。整数 key 存成第一个 key
+// 加上差值的 varint，其他定长的 key 和 value 原样存放，std::string 按 slotted
+// 格式存放，查找时直接用指向 block 的 Slice 比较。墓碑在 bitmap 中标记，
+// 没有墓碑的 block 不存 bitmap。values 在开启压缩并且能变小时用 LZCodec 压缩。
+// block index 在内存中常驻，每个 block 的第一个 key 取代原来的 fence pointers。
+// 设置了 block cache 的 run 不 mmap 文件，按 block 用 pread 读进 cache，
+// 内存占用由 cache 的预算决定；归并读的 blocks 不进 cache。
+// 设置了目录的 run 是持久化的，析构时只删除被 merge 掉的文件
 template <class K, class V>
 class DiskRun {
   friend class DiskLevel<K, V>;
 
+ public:
+  typedef kvPair<K, V> KVPair_t;
+  typedef SliceTraits<K> KeyTraits;
+  typedef SliceTraits<V> ValueTraits;
+  typedef typename KeyTraits::View KeyView;
+  typedef typename ValueTraits::View ValueView;
+
  private:
+  struct BlockHeader {
+    uint32_t count;
+    uint32_t keyBytes;
+    uint32_t deletedBytes;   // 墓碑 bitmap 的字节数，没有墓碑时为 0
+    uint32_t valueBytes;     // values 在文件中的字节数
+    uint32_t rawValueBytes;  // 解压之后的字节数
+    uint32_t valueCodec;
+  };
+  enum ValueCodec : uint32_t { RAW_VALUES = 0, LZ_VALUES = 1 };
+
+  struct BlockHandle {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t count;
+  };
+
+  // block index 是 numBlocks 个 BlockHandle | 第一个 key，之后是 maxKey，
+  // key 按 SliceTraits 编码
+  struct Footer {
+    double bfFalsePositive;  // 文件中 filter 的假阳性率
+    uint64_t indexOffset;
+    uint64_t filterOffset;
+    uint64_t numElts;
+    uint32_t numBlocks;
+    uint32_t magic;
+  };
+  static const uint32_t kMagic = 0x32534c43;  // "CLS2"
+  static const size_t kWriteBufferSize = 1 << 20;
+  static const long kMaxReadAhead = 8;  // 遍历时最多一次读几个 blocks
+
   long _capacity;
+  size_t _fileSize;
+  std::string _dir;       // 为空时文件写在当前目录，析构时删除
   std::string _filename;
-  std::vector<K> _fencePointers;
-  int _maxFP;
+  uint64_t _fileID;
+  bool _isObsolete;       // 已经被 merge 掉，文件可以删除
+  std::vector<K> _blockKeys;  // 每个 block 的第一个 key
+  FenceIndex<KeyView> _fence;  // _blockKeys 的 Eytzinger 布局，用于查找
+  std::vector<BlockHandle> _blocks;
+  const char *_data;          // 只读 mmap 的文件内容，用 block cache 时为空
+  std::shared_ptr<BlockCache> _cache;
+  uint64_t _cacheID;          // 在 cache 中的编号
+  std::shared_ptr<IOEngine> _io;  // 批量读 blocks，为空时逐个 pread
+  std::shared_ptr<EngineStats> _stats;  // run 释放时把计数累加到所在 level
+  ThreadCounters<NUM_LEVEL_TICKERS> _tickers;  // 本 run 的计数
   int _runID;
   int _level;
+  bool _compressValues;
 
   double _bfFalsePositive;  // bloom filter false positive
 
-  void doMunmap() {
-    size_t filesize = _capacity * sizeof(KVPair_t);
-
-    if (munmap(map, filesize) == -1) {
-      perror("Error un-mmapping the file");
-    }
+  // 一个 block 的编码数据。pread 读出的 block 由 holder 持有，
+  // 被 cache 淘汰之后仍然有效
+  struct BlockData {
+    const char *data;
+    BlockCache::Block holder;
+  };
 
-    close(fd);
-    fd = -2;  // 设置成 -2，和错误的 -1 区分开
+  void releaseStaging() {
+    delete[] map;
+    map = nullptr;
   }
 
  public:
-  typedef kvPair<K, V> KVPair_t;
-  KVPair_t *map;
+  KVPair_t *map;  // 写入缓冲区，stage 时分配，constructIndex 之后释放
   int fd;
   int _blockSize;
-  BloomFilter<K> bf;
+  // 读者通过 DiskRunRef 持有 filter 的引用，重建时换成新的对象
+  std::shared_ptr<BlockedBloomFilter<K>> bf;
+
+  K minKey = K(), maxKey = K();
+
+  // 逐个 block 解码遍历，持有 run 的引用，run 被 merge 之后文件仍然保留。
+  // fillCache 为 false 时读到的 blocks 不放进 block cache，归并时使用。
+  // 读到预读窗口之外的 block 时一次读入后面的几个 blocks，
+  // 窗口从 1 开始每次翻倍，短的范围查询不会多读
+  class Iterator : public KVIterator<K, V> {
+   public:
+    explicit Iterator(std::shared_ptr<DiskRun> run, bool fillCache = true)
+        : _run(std::move(run)),
+          _fillCache(fillCache),
+          _block(_run->_blocks.size()),
+          _pos(0),
+          _deleted(nullptr),
+          _aheadStart(0),
+          _readAhead(1) {}
+
+    bool valid() { return _block < static_cast<long>(_run->_blocks.size()); }
+
+    void seekToFirst() {
+      _readAhead = 1;
+      loadBlock(0);
+    }
 
-  K minKey = INT_MIN, maxKey = INT_MAX;
+    void seek(const K &key) {
+      _readAhead = 1;
+      KeyView target = KeyTraits::view(key);
+      long b = std::max(_run->findBlock(target), 0L);
+      loadBlock(b);
+      if (!valid()) return;
+      _pos = lowerBound(_keys.data(), _keys.size(), target);
+      if (_pos == static_cast<long>(_keys.size())) {
+        loadBlock(b + 1);
+      }
+    }
+
+    void next() {
+      if (++_pos == static_cast<long>(_keys.size())) {
+        loadBlock(_block + 1);
+      }
+    }
+
+    K key() { return KeyTraits::fromView(_keys[_pos]); }
+    const KeyView &keyView() { return _keys[_pos]; }  // 读下一个 block 之前有效
+    V value() { return ValueTraits::fromView(_values[_pos]); }
+    bool isDeleted() { return isDeletedAt(_deleted, _pos); }
+
+   private:
+    std::shared_ptr<DiskRun> _run;
+    bool _fillCache;
+    long _block;
+    long _pos;
+    std::vector<KeyView> _keys;  // 变长的 key 指向 _ahead 中的 block
+    std::vector<ValueView> _values;
+    std::string _valueBuf;       // 压缩的 values 解压到这里
+    const char *_deleted;        // 当前 block 的墓碑 bitmap
+    long _aheadStart;               // _ahead[0] 的 block 下标
+    std::vector<BlockData> _ahead;  // 已经读入的连续 blocks
+    long _readAhead;
+
+    void loadBlock(long b) {
+      _block = b;
+      _pos = 0;
+      if (!valid()) return;
+
+      if (b < _aheadStart || b >= _aheadStart + (long)_ahead.size()) {
+        long n = std::min(_readAhead, (long)_run->_blocks.size() - b);
+        std::vector<long> blocks;
+        for (long i = 0; i < n; i++) blocks.push_back(b + i);
+        _ahead = _run->readBlocks(blocks, _fillCache);
+        _aheadStart = b;
+        _readAhead = _readAhead * 2 < kMaxReadAhead ? _readAhead * 2
+                                                    : kMaxReadAhead;
+      }
+      const BlockData &block = _ahead[b - _aheadStart];
+      _run->decodeKeys(b, block.data, _keys);
+      _run->decodeValues(b, block.data, _values, _valueBuf);
+      _deleted = _run->deletedBitmap(block.data);
+    }
+  };
 
   DiskRun<K, V>(long capacity, int blockSize, int level, int runID,
                 double bfFalsePositive)
       : _capacity(capacity),
+        _fileSize(0),
+        _fileID(0),
+        _isObsolete(false),
+        _data(nullptr),
+        _cacheID(BlockCache::newID()),
+        _runID(runID),
         _level(level),
-        _maxFP(0),
+        _compressValues(false),
         _bfFalsePositive(bfFalsePositive),
+        map(nullptr),
+        fd(-1),
         _blockSize(blockSize),
-        bf(capacity, bfFalsePositive) {
-    _filename =
-        "C_" + std::to_string(level) + "_" + std::to_string(runID) + ".clsm";
-
-    size_t filesize = capacity * sizeof(KVPair_t);
-
-    long long ret;
-
-    fd = open(_filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, (mode_t)0600);
-
+        bf(std::make_shared<BlockedBloomFilter<K>>(0, 1.0)) {}
+
+  // 打开之前写好的文件，只读取 footer、block index 和 filter。
+  // filter 的假阳性率和 bfFalsePositive 不同时从 keys 重建。
+  // cache 不为空时用 pread 读 blocks
+  DiskRun<K, V>(const std::string &dir, uint64_t fileID, int blockSize,
+                int level, int runID, double bfFalsePositive,
+                std::shared_ptr<BlockCache> cache = nullptr)
+      : _capacity(0),
+        _dir(dir),
+        _fileID(fileID),
+        _isObsolete(false),
+        _data(nullptr),
+        _cache(std::move(cache)),
+        _cacheID(BlockCache::newID()),
+        _runID(runID),
+        _level(level),
+        _compressValues(false),
+        _bfFalsePositive(bfFalsePositive),
+        map(nullptr),
+        _blockSize(blockSize) {
+    _filename = fileName(_dir, _level, _fileID);
+    fd = open(_filename.c_str(), O_RDWR);
     if (fd == -1) {
-      perror("Error opening file for writing");
+      perror(("Error opening file " + _filename).c_str());
       exit(EXIT_FAILURE);
     }
 
-    ret = lseek(fd, filesize - 1, SEEK_SET);
-    if (ret == -1) {
-      close(fd);
-      perror("Error calling lseek() to 'stretch' the file");
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+      perror(("Error reading size of file " + _filename).c_str());
       exit(EXIT_FAILURE);
     }
+    _fileSize = st.st_size;
+    if (_fileSize < sizeof(Footer)) {
+      corruptedFile();
+    }
 
-    ret = write(fd, "", 1);
-    if (ret != 1) {
-      close(fd);
-      perror("Error writing last byte of the file");
-      exit(EXIT_FAILURE);
+    Footer footer;
+    readAt(_fileSize - sizeof(Footer), (char *)&footer, sizeof(Footer));
+    if (footer.magic != kMagic || footer.numBlocks == 0 ||
+        footer.indexOffset > footer.filterOffset ||
+        footer.filterOffset > _fileSize - sizeof(Footer)) {
+      corruptedFile();
     }
 
-    map = (KVPair_t *)mmap(0, filesize, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
-                           0);
-    if (map == MAP_FAILED) {
-      close(fd);
-      perror("Error in mmapping the file");
-      exit(EXIT_FAILURE);
+    // block index 和 filter 是连续的，一次读出来
+    std::string meta(_fileSize - sizeof(Footer) - footer.indexOffset, '\0');
+    readAt(footer.indexOffset, &meta[0], meta.size());
+    mapFile();
+
+    _capacity = footer.numElts;
+    _blockKeys.resize(footer.numBlocks);
+    _blocks.resize(footer.numBlocks);
+    size_t indexBytes = footer.filterOffset - footer.indexOffset;
+    const char *p = meta.data(), *limit = meta.data() + indexBytes;
+    for (uint32_t b = 0; b < footer.numBlocks && p != nullptr; b++) {
+      if (limit - p < static_cast<long>(sizeof(BlockHandle))) {
+        corruptedFile();
+      }
+      memcpy(&_blocks[b], p, sizeof(BlockHandle));
+      p = KeyTraits::decode(p + sizeof(BlockHandle), limit, _blockKeys[b]);
+    }
+    if (p != nullptr) {
+      p = KeyTraits::decode(p, limit, maxKey);
+    }
+    if (p != limit) {
+      corruptedFile();
+    }
+    minKey = _blockKeys[0];
+    buildFence();
+
+    bf = std::make_shared<BlockedBloomFilter<K>>(0, 1.0);
+    if (footer.bfFalsePositive != _bfFalsePositive ||
+        !bf->deserialize(meta.data() + indexBytes, meta.size() - indexBytes)) {
+      bf = buildFilter();
     }
   }
 
   ~DiskRun<K, V>() {
-    fsync(fd);
-    doMunmap();
+    if (_stats) {
+      for (int t = 0; t < NUM_LEVEL_TICKERS; t++) {
+        _stats->add(_level, static_cast<LevelTicker>(t), _tickers.get(t));
+      }
+    }
+    releaseStaging();
+    if (fd < 0) return;  // 没有写入过数据的 run 没有文件
+
+    if (_data != nullptr && munmap((void *)_data, _fileSize) == -1) {
+      perror("Error un-mmapping the file");
+    }
+    if (_cache) {
+      _cache->erase(_cacheID, _blocks.size());
+    }
+    close(fd);
 
+    if (!_dir.empty() && !_isObsolete) {
+      return;  // 持久化的 run 由 manifest 引用，保留文件
+    }
     if (remove(_filename.c_str())) {
       perror(("Error removing file " + std::string(_filename)).c_str());
       exit(EXIT_FAILURE);
     }
   }
 
+  // 文件编号全局递增，文件名不随 run 在 level 中的位置变化，
+  // 旧 version 还在读的 run 不会被同名的新 run 覆盖
+  static std::atomic<uint64_t> &fileIDCounter() {
+    static std::atomic<uint64_t> fileID(0);
+    return fileID;
+  }
+
+  // 重新打开目录之后，新的文件编号要跳过已经用过的
+  static void reserveFileIDs(uint64_t next) {
+    uint64_t cur = fileIDCounter().load();
+    while (cur < next && !fileIDCounter().compare_exchange_weak(cur, next)) {
+    }
+  }
+
+  static std::string fileName(const std::string &dir, int level,
+                              uint64_t fileID) {
+    return (dir.empty() ? "" : dir + "/") + "C_" + std::to_string(level) +
+           "_" + std::to_string(fileID) + ".clsm";
+  }
+
+  // 之后写入的文件放在 dir 中并且持久化
+  void setDirectory(const std::string &dir) { _dir = dir; }
+
+  void markObsolete() { _isObsolete = true; }
+
+  // 之后的批量读通过 io 提交，需要在开始读之前设置
+  void setIOEngine(std::shared_ptr<IOEngine> io) { _io = std::move(io); }
+
+  void setStats(std::shared_ptr<EngineStats> stats) {
+    _stats = std::move(stats);
+  }
+
+  // 只记在本 run 上，level 的计数是已经释放的 runs 加上现存的 runs
+  void tick(LevelTicker t, uint64_t n = 1) { _tickers.add(t, n); }
+
+  uint64_t getTicker(LevelTicker t) const { return _tickers.get(t); }
+
+  // 之后写入的文件改用 pread 和 cache 读，已经写完的 run 不变
+  void setBlockCache(std::shared_ptr<BlockCache> cache) {
+    if (fd < 0) {
+      _cache = std::move(cache);
+    }
+  }
+
+  uint64_t getFileID() { return _fileID; }
+
   void setCapacity(const long newCapacity) { _capacity = newCapacity; }
 
+  // 之后写入的文件是否压缩 values
+  void setValueCompression(bool compressValues) {
+    _compressValues = compressValues;
+  }
+
+  // 把文件同步写回磁盘。之后 manifest 会引用这个 run 并删掉能重建它的
+  // WAL segments，刷盘失败时不能继续，直接退出
+  void sync() {
+    if (fd >= 0 && fdatasync(fd) == -1) {
+      perror(("Error syncing file " + _filename).c_str());
+      exit(EXIT_FAILURE);
+    }
+  }
+
   long getCapacity() { return _capacity; }
 
+  size_t getFileSize() { return _fileSize; }
+
+  // 分配能放下 n 个元素的写入缓冲区，由调用方填入之后 setCapacity
+  KVPair_t *stage(long n) {
+    releaseStaging();
+    map = new KVPair_t[n > 0 ? n : 1];
+    return map;
+  }
+
   void writeData(const KVPair_t *run, const size_t offset, const long len) {
-    memcpy(map + offset, run, len * sizeof(KVPair_t));
+    std::copy(run, run + len, stage(offset + len) + offset);
     _capacity = len;
   }
 
+  // 还没有写入数据
+  bool isEmpty() { return _blocks.empty(); }
+
+  // 写完缓冲区之后调用：构建 filter，编码写入文件并释放缓冲区。
+  // filter 按实际元素个数分配
   void constructIndex() {
-    _fencePointers.reserve(_capacity / _blockSize);
-    _maxFP = -1;
+    if (_capacity > 0) {
+      bf = buildFilter();
+      minKey = map[0].key;
+      maxKey = map[_capacity - 1].key;
+      writeBlocks();
+    }
+    releaseStaging();
+  }
+
+  // 假阳性率变化后按新的大小重建 filter
+  void setFalsePositive(double bfFalsePositive, bool rebuild) {
+    _bfFalsePositive = bfFalsePositive;
+    if (rebuild) {
+      bf = buildFilter();
+    }
+  }
 
-    for (auto i = 0; i < _capacity; i++) {
-      bf.add((K *)&map[i].key, sizeof(K));
-      if (i % _blockSize == 0) {
-        _fencePointers.push_back(map[i].key);
-        _maxFP++;
+  std::shared_ptr<BlockedBloomFilter<K>> buildFilter() {
+    auto filter =
+        std::make_shared<BlockedBloomFilter<K>>(_capacity, _bfFalsePositive);
+    if (map != nullptr) {
+      for (auto i = 0; i < _capacity; i++) {
+        filter->add(KeyTraits::view(map[i].key));
       }
+      return filter;
     }
 
-    if (_maxFP >= 0) {
-      _fencePointers.resize(_maxFP + 1);
+    std::vector<KeyView> keys;
+    for (long b = 0; b < static_cast<long>(_blocks.size()); b++) {
+      BlockData block = readBlock(b, false);
+      decodeKeys(b, block.data, keys);
+      for (auto &key : keys) {
+        filter->add(key);
+      }
     }
+    return filter;
+  }
 
-    minKey = map[0].key;
-    maxKey = map[_capacity - 1].key;
+  // 最后一个第一个 key <= key 的 block，key 比所有 key 都小时返回 -1
+  long findBlock(const KeyView &key) {
+    tick(FENCE_SEARCHES);
+    return _fence.upperBound(key) - 1;
   }
 
-  long binarySearch(const long offset, const long n, const K &key,
-                    bool &isFound) {
-    if (n == 0) {
-      isFound = true;
-      return offset;
+  V search(const K &sKey, bool &isFound, bool &isDeleted) {
+    KeyView key = KeyTraits::view(sKey);
+    long b = findBlock(key);
+    if (b < 0) {
+      return V();
     }
-    long le = offset, ri = offset + n - 1, mid;
-    while (le < ri) {
-      mid = le + (ri - le) / 2;
-      if (key > map[mid].key) {
-        le = mid + 1;
-      } else if (key < map[mid].key) {
-        ri = mid - 1;
-      } else {
-        isFound = true;
-        return mid;
-      }
+
+    static thread_local std::vector<KeyView> keys;
+    BlockData block = readBlock(b, true);
+    decodeKeys(b, block.data, keys);
+    long i = lowerBound(keys.data(), keys.size(), key);
+    if (i == static_cast<long>(keys.size()) || keys[i] != key) {
+      return V();
     }
-    return le;
+
+    isFound = true;
+    isDeleted = isDeletedAt(deletedBitmap(block.data), i);
+    return decodeValue(b, block.data, i);
   }
 
-  void getFencePointers(const K &key, long &start, long &end) {
-    if (_maxFP == 0) {
-      start = 0;
-      end = _capacity;
-    } else if (key < _fencePointers[1]) {
-      start = 0;
-      end = _blockSize;
-    } else if (key >= _fencePointers[_maxFP]) {
-      start = _blockSize * _maxFP;
-      end = _capacity;
-    } else {
-      int le = 0, ri = _maxFP, mid;
-      while (le < ri) {
-        mid = le + (ri - le) / 2;
-        if (key > _fencePointers[mid]) {
-          if (key < _fencePointers[mid + 1]) {
-            start = mid * _blockSize;
-            end = start + _blockSize;
-            return;
-          }
-          le = mid + 1;
-        } else if (key < _fencePointers[mid]) {
-          if (key >= _fencePointers[mid - 1]) {
-            start = (mid - 1) * _blockSize;
-            end = start + _blockSize;
-            return;
-          }
-          ri = mid - 1;
-        } else {
-          start = mid * _blockSize;
-          end = start;
-          return;
+  // 小于 key 的元素个数。归并切分 partition 时使用，和归并的读一样
+  // 不放进 block cache
+  long rank(const K &sKey) {
+    KeyView key = KeyTraits::view(sKey);
+    long b = findBlock(key);
+    if (b < 0) {
+      return 0;
+    }
+
+    long r = 0;
+    for (long i = 0; i < b; i++) r += _blocks[i].count;
+    static thread_local std::vector<KeyView> keys;
+    BlockData block = readBlock(b, false);
+    decodeKeys(b, block.data, keys);
+    return r + lowerBound(keys.data(), keys.size(), key);
+  }
+
+  // 读出第 b 个 block。mmap 时直接指向文件内容；否则先查 cache，
+  // 不在 cache 中时 pread，fillCache 为 false 的读不放进 cache，
+  // 也不留在 page cache 中
+  BlockData readBlock(long b, bool fillCache) {
+    if (_data != nullptr) {
+      tick(fillCache ? BYTES_READ : COMPACTION_BYTES_READ, _blocks[b].size);
+      return BlockData{_data + _blocks[b].offset, nullptr};
+    }
+
+    BlockCache::Block block = _cache->lookup(_cacheID, b);
+    if (!block) {
+      tick(fillCache ? BYTES_READ : COMPACTION_BYTES_READ, _blocks[b].size);
+      auto buf = std::make_shared<std::string>(_blocks[b].size, '\0');
+      readAt(_blocks[b].offset, &(*buf)[0], buf->size());
+      finishRead(b, buf, fillCache);
+      block = std::move(buf);
+    }
+    return BlockData{block->data(), block};
+  }
+
+  // 一次读出多个 blocks。pread 时不在 cache 中的 blocks 通过 I/O 引擎
+  // 同时提交；mmap 时让内核提前把这些页读进来
+  std::vector<BlockData> readBlocks(const std::vector<long> &blocks,
+                                    bool fillCache) {
+    std::vector<BlockData> out(blocks.size());
+    LevelTicker bytesRead = fillCache ? BYTES_READ : COMPACTION_BYTES_READ;
+    if (_data != nullptr) {
+      for (size_t i = 0; i < blocks.size(); i++) {
+        tick(bytesRead, _blocks[blocks[i]].size);
+        out[i] = BlockData{_data + _blocks[blocks[i]].offset, nullptr};
+        __builtin_prefetch(out[i].data);
+        if (blocks.size() > 1) {
+          adviseWillNeed(blocks[i]);
         }
       }
+      return out;
+    }
+
+    std::vector<ReadRequest> reqs;
+    std::vector<size_t> missing;
+    std::vector<std::shared_ptr<std::string>> bufs;
+    for (size_t i = 0; i < blocks.size(); i++) {
+      long b = blocks[i];
+      BlockCache::Block block = _cache->lookup(_cacheID, b);
+      if (block) {
+        out[i] = BlockData{block->data(), block};
+        continue;
+      }
+      tick(bytesRead, _blocks[b].size);
+      bufs.push_back(std::make_shared<std::string>(_blocks[b].size, '\0'));
+      reqs.push_back(ReadRequest{fd, _blocks[b].offset, _blocks[b].size,
+                                 &(*bufs.back())[0]});
+      missing.push_back(i);
+    }
+
+    if (_io && reqs.size() > 1) {
+      _io->read(reqs);
+    } else {
+      for (auto &req : reqs) readAt(req.offset, req.buf, req.len);
+    }
+    for (size_t j = 0; j < missing.size(); j++) {
+      finishRead(blocks[missing[j]], bufs[j], fillCache);
+      out[missing[j]] = BlockData{bufs[j]->data(), bufs[j]};
     }
+    return out;
   }
 
-  long getIndex(const K &key, bool &isFound) {
-    long start, end;
-    getFencePointers(key, start, end);
-    long ret = binarySearch(start, end - start, key, isFound);
-    return ret;
+  // 批量点查 keys 中下标在 idx 里的 keys，找到的写入 values、found 和 deleted。
+  // 先定位所有 blocks 一起读，再按 block 顺序查找，每个 block 只解码一次
+  void multiSearch(const K *keys, const std::vector<long> &idx, V *values,
+                   bool *found, bool *deleted) {
+    std::vector<std::pair<long, long>> byBlock;  // (block, key 的下标)
+    for (long i : idx) {
+      long b = findBlock(keys[i]);
+      if (b >= 0) byBlock.emplace_back(b, i);
+    }
+    std::sort(byBlock.begin(), byBlock.end());
+
+    std::vector<long> blocks;
+    for (auto &p : byBlock) {
+      if (blocks.empty() || blocks.back() != p.first) blocks.push_back(p.first);
+    }
+    std::vector<BlockData> data = readBlocks(blocks, true);
+
+    static thread_local std::vector<KeyView> blockKeys;
+    long cur = -1;
+    size_t bi = 0;
+    for (auto &p : byBlock) {
+      if (p.first != cur) {
+        cur = p.first;
+        while (blocks[bi] != cur) bi++;
+        decodeKeys(cur, data[bi].data, blockKeys);
+      }
+      KeyView key = KeyTraits::view(keys[p.second]);
+      long i = lowerBound(blockKeys.data(), blockKeys.size(), key);
+      if (i < static_cast<long>(blockKeys.size()) && blockKeys[i] == key) {
+        values[p.second] = decodeValue(cur, data[bi].data, i);
+        found[p.second] = true;
+        deleted[p.second] = isDeletedAt(deletedBitmap(data[bi].data), i);
+      }
+    }
   }
 
-  V search(const K &key, bool &isFound) {
-    long idx = getIndex(key, isFound);
-    V ret = map[idx].value;
-    return isFound ? ret : static_cast<V>(NULL);
+  // 变长的 keys 解码成指向 block 的 Slice，block 释放之前有效
+  void decodeKeys(long b, const char *block, std::vector<KeyView> &keys) {
+    BlockHeader header = readHeader(block);
+    const char *p = block + sizeof(BlockHeader);
+    keys.resize(header.count);
+    if (!::decodeKeys(p, p + header.keyBytes, header.count, keys.data(),
+                      std::is_integral<K>())) {
+      corrupted(b);
+    }
   }
 
-  void getRangeIndex(const K &k1, const K &k2, long &idx1, long idx2) {
-    idx1 = 0, idx2 = 0;
+  // 压缩的 values 解压到 buf，变长的 values 指向 block 或者 buf
+  void decodeValues(long b, const char *block, std::vector<ValueView> &values,
+                    std::string &buf) {
+    BlockHeader header = readHeader(block);
+    const char *p = valuesOf(b, block, header, buf);
+    values.resize(header.count);
+    if (!decodeValueViews(p, p + header.rawValueBytes, header.count,
+                          values.data(), FixedValue())) {
+      corrupted(b);
+    }
+  }
 
-    if (k1 > maxKey || k2 < minKey) {
-      return;
+  // 未压缩的 block 直接读出第 i 个 value
+  V decodeValue(long b, const char *block, long i) {
+    static thread_local std::string buf;
+    BlockHeader header = readHeader(block);
+    return valueAt(valuesOf(b, block, header, buf), header.count, i,
+                   FixedValue());
+  }
+
+  // 第 i 个元素是不是墓碑，bits 为空表示 block 中没有墓碑
+  static bool isDeletedAt(const char *bits, long i) {
+    return bits != nullptr && ((bits[i >> 3] >> (i & 7)) & 1);
+  }
+
+  const char *deletedBitmap(const char *block) {
+    BlockHeader header = readHeader(block);
+    return header.deletedBytes == 0
+               ? nullptr
+               : block + sizeof(BlockHeader) + header.keyBytes;
+  }
+
+  void printAll() {
+    std::vector<KeyView> keys;
+    for (long b = 0; b < static_cast<long>(_blocks.size()); b++) {
+      BlockData block = readBlock(b, true);
+      decodeKeys(b, block.data, keys);
+      for (auto &key : keys) std::cout << key << " ";
     }
-    if (k1 >= minKey) {
-      bool isFound = false;
-      idx1 = getIndex(k1, isFound);
+    std::cout << std::endl;
+  }
+
+ private:
+  BlockHeader readHeader(const char *block) {
+    BlockHeader header;
+    memcpy(&header, block, sizeof(BlockHeader));
+    return header;
+  }
+
+  // pread 读出的 block：放进 cache，或者归并读时从 page cache 中丢掉
+  void finishRead(long b, const std::shared_ptr<std::string> &buf,
+                  bool fillCache) {
+    if (fillCache) {
+      _cache->insert(_cacheID, b, buf, _level);
+    } else {
+      posix_fadvise(fd, _blocks[b].offset, _blocks[b].size,
+                    POSIX_FADV_DONTNEED);
+    }
+  }
+
+  void adviseWillNeed(long b) {
+    static const long pageSize = sysconf(_SC_PAGESIZE);
+    uint64_t start = _blocks[b].offset / pageSize * pageSize;
+    size_t len = _blocks[b].offset + _blocks[b].size - start;
+    madvise((void *)(_data + start), len, MADV_WILLNEED);
+  }
+
+  typedef std::integral_constant<bool, ValueTraits::kFixedSize> FixedValue;
+
+  // 解压之后的 values 区域，没有压缩时直接指向 block
+  const char *valuesOf(long b, const char *block, const BlockHeader &header,
+                       std::string &buf) {
+    const char *p = block + sizeof(BlockHeader) + header.keyBytes +
+                    header.deletedBytes;
+    if (header.valueCodec == RAW_VALUES) {
+      return p;
+    }
+    buf.resize(header.rawValueBytes);
+    if (!LZCodec::decompress(p, header.valueBytes, &buf[0],
+                             header.rawValueBytes)) {
+      corrupted(b);
+    }
+    return buf.data();
+  }
+
+  // 定长的 values 是连续的数组，墓碑的位置是 V()
+  static void encodeValues(const ValueView *values, long n, std::string &out,
+                           std::true_type) {
+    out.append((const char *)values, n * sizeof(V));
+  }
+  static void encodeValues(const ValueView *values, long n, std::string &out,
+                           std::false_type) {
+    encodeSlices(values, n, out);
+  }
+
+  static bool decodeValueViews(const char *p, const char *limit, long n,
+                               ValueView *values, std::true_type) {
+    if (limit - p != static_cast<long>(n * sizeof(V))) return false;
+    memcpy((void *)values, p, n * sizeof(V));
+    return true;
+  }
+  static bool decodeValueViews(const char *p, const char *limit, long n,
+                               ValueView *values, std::false_type) {
+    return decodeSlices(p, limit, n, values);
+  }
+
+  static V valueAt(const char *p, long, long i, std::true_type) {
+    V value;
+    memcpy((void *)&value, p + i * sizeof(V), sizeof(V));
+    return value;
+  }
+  static V valueAt(const char *p, long n, long i, std::false_type) {
+    return ValueTraits::fromView(sliceAt(p, n, i));
+  }
+
+  void buildFence() {
+    std::vector<KeyView> fences(_blockKeys.begin(), _blockKeys.end());
+    _fence.build(fences);
+  }
+
+  void readAt(uint64_t offset, char *dst, size_t len) {
+    while (len > 0) {
+      ssize_t ret = pread(fd, dst, len, offset);
+      if (ret <= 0) {
+        if (ret == -1 && errno == EINTR) continue;
+        perror(("Error reading file " + _filename).c_str());
+        exit(EXIT_FAILURE);
+      }
+      dst += ret;
+      offset += ret;
+      len -= ret;
     }
-    if (k2 > maxKey) {
-      idx2 = _capacity;
+  }
+
+  // 没有 cache 时只读 mmap 整个文件；有 cache 时按 block 随机读，关掉预读
+  void mapFile() {
+    if (_cache) {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
       return;
-    } else {
-      bool isFound = false;
-      idx2 = getIndex(k2, isFound);
+    }
+    _data = (const char *)mmap(0, _fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    if (_data == MAP_FAILED) {
+      close(fd);
+      perror("Error in mmapping the file");
+      exit(EXIT_FAILURE);
     }
   }
 
-  void printAll() {
-    for (auto i = 0; i < _capacity; i++) std::cout << map[i].key << " ";
-    std::cout << std::endl;
+  void corrupted(long b) {
+    fprintf(stderr, "Corrupted block %ld in file %s\n", b, _filename.c_str());
+    exit(EXIT_FAILURE);
+  }
+
+  void corruptedFile() {
+    fprintf(stderr, "Corrupted run file %s\n", _filename.c_str());
+    exit(EXIT_FAILURE);
+  }
+
+  // 把缓冲区中的 [0, _capacity) 按 block 编码写入文件，然后只读 mmap 文件
+  void writeBlocks() {
+    _fileID = fileIDCounter().fetch_add(1);
+    _filename = fileName(_dir, _level, _fileID);
+    fd = open(_filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, (mode_t)0600);
+    if (fd == -1) {
+      perror("Error opening file for writing");
+      exit(EXIT_FAILURE);
+    }
+
+    std::string buf, encodedKeys, rawValues, encodedValues, deleted;
+    std::vector<KeyView> keys(_blockSize);
+    std::vector<ValueView> values(_blockSize);
+    uint64_t offset = 0;
+    for (long start = 0; start < _capacity; start += _blockSize) {
+      long n = std::min(static_cast<long>(_blockSize), _capacity - start);
+      deleted.assign((n + 7) / 8, '\0');
+      bool hasDeleted = false;
+      for (long i = 0; i < n; i++) {
+        const KVPair_t &kv = map[start + i];
+        keys[i] = KeyTraits::view(kv.key);
+        if (kv.isDeleted) {
+          values[i] = ValueView();
+          deleted[i >> 3] |= 1 << (i & 7);
+          hasDeleted = true;
+        } else {
+          values[i] = ValueTraits::view(kv.value);
+        }
+      }
+      if (!hasDeleted) deleted.clear();
+
+      encodedKeys.clear();
+      rawValues.clear();
+      encodedValues.clear();
+      ::encodeKeys(keys.data(), n, encodedKeys, std::is_integral<K>());
+      encodeValues(values.data(), n, rawValues, FixedValue());
+
+      BlockHeader header{static_cast<uint32_t>(n),
+                         static_cast<uint32_t>(encodedKeys.size()),
+                         static_cast<uint32_t>(deleted.size()),
+                         0,
+                         static_cast<uint32_t>(rawValues.size()),
+                         RAW_VALUES};
+      if (_compressValues) {
+        LZCodec::compress(rawValues.data(), rawValues.size(), encodedValues);
+      }
+      if (_compressValues && encodedValues.size() < rawValues.size()) {
+        header.valueCodec = LZ_VALUES;
+      } else {
+        encodedValues.swap(rawValues);
+      }
+      header.valueBytes = static_cast<uint32_t>(encodedValues.size());
+
+      size_t size = sizeof(BlockHeader) + encodedKeys.size() + deleted.size() +
+                    encodedValues.size();
+      buf.append((const char *)&header, sizeof(BlockHeader));
+      buf.append(encodedKeys);
+      buf.append(deleted);
+      buf.append(encodedValues);
+      _blockKeys.push_back(map[start].key);
+      _blocks.push_back(
+          BlockHandle{offset, static_cast<uint32_t>(size),
+                      static_cast<uint32_t>(n)});
+      offset += size;
+
+      if (buf.size() >= kWriteBufferSize) {
+        writeAll(buf);
+        buf.clear();
+      }
+    }
+
+    // block index、filter 和 footer 写在文件末尾，重新打开时只读这些元数据
+    Footer footer;
+    memset(&footer, 0, sizeof(Footer));
+    footer.bfFalsePositive = _bfFalsePositive;
+    footer.indexOffset = offset;
+    footer.numElts = _capacity;
+    footer.numBlocks = static_cast<uint32_t>(_blocks.size());
+    footer.magic = kMagic;
+    size_t indexStart = buf.size();
+    for (size_t b = 0; b < _blocks.size(); b++) {
+      buf.append((const char *)&_blocks[b], sizeof(BlockHandle));
+      KeyTraits::encode(buf, _blockKeys[b]);
+    }
+    KeyTraits::encode(buf, maxKey);
+    footer.filterOffset = offset + (buf.size() - indexStart);
+    std::string filter;
+    bf->serialize(filter);
+    buf.append(filter);
+    buf.append((const char *)&footer, sizeof(Footer));
+    writeAll(buf);
+    _fileSize = footer.filterOffset + filter.size() + sizeof(Footer);
+    tick(BYTES_WRITTEN, _fileSize);
+    buildFence();
+    if (!_dir.empty()) {
+      sync();
+    }
+    mapFile();
+  }
+
+  void writeAll(const std::string &buf) {
+    const char *p = buf.data();
+    size_t len = buf.size();
+    while (len > 0) {
+      ssize_t ret = write(fd, p, len);
+      if (ret == -1) {
+        perror(("Error writing file " + _filename).c_str());
+        exit(EXIT_FAILURE);
+      }
+      p += ret;
+      len -= ret;
+    }
   }
 };
 
-#endif  // LSMTREE_DISK_RUN_HPP
\ No newline at end of file
+#endif  // LSMTREE_DISK_RUN_HPP
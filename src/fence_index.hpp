@@ -0,0 +1,165 @@
+#ifndef LSMTREE_FENCE_INDEX_HPP
+#define LSMTREE_FENCE_INDEX_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <type_traits>
+#include <vector>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define LSMTREE_HAVE_AVX2_DISPATCH 1
+#endif
+
+// 磁盘 run 点查时 block 定位和 block 内查找用到的无分支查找
+
+// 有序数组中第一个 >= key 的下标。先用无分支的二分把范围缩小到
+// kLinearWindow 个元素以内，再数窗口里有几个元素 < key。
+// 4/8 字节的整数 key 在支持 AVX2 的 CPU 上一次比较一个 256 位向量
+template <class K>
+struct LowerBoundSIMD
+    : std::integral_constant<bool, std::is_integral<K>::value &&
+                                       (sizeof(K) == 4 || sizeof(K) == 8)> {
+};
+
+const long kLinearWindow = 64;
+
+template <class K>
+inline long countLess(const K *a, long n, const K &key) {
+  long c = 0;
+  for (long i = 0; i < n; i++) c += a[i] < key;
+  return c;
+}
+
+#ifdef LSMTREE_HAVE_AVX2_DISPATCH
+// 有符号比较指令，无符号的 key 先翻转符号位。按 sizeof(K) 选择 4 字节或
+// 8 字节的版本
+template <class K>
+__attribute__((target("avx2"))) long countLessAVX2(
+    const K *a, long n, const K &key, std::integral_constant<size_t, 4>) {
+  const int32_t flip = std::is_signed<K>::value ? 0 : INT32_MIN;
+  const __m256i sign = _mm256_set1_epi32(flip);
+  const __m256i kv = _mm256_set1_epi32(static_cast<int32_t>(key) ^ flip);
+  long c = 0, i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_xor_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)), sign);
+    __m256i lt = _mm256_cmpgt_epi32(kv, x);
+    c += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(lt)));
+  }
+  return c + countLess(a + i, n - i, key);
+}
+
+template <class K>
+__attribute__((target("avx2"))) long countLessAVX2(
+    const K *a, long n, const K &key, std::integral_constant<size_t, 8>) {
+  const int64_t flip = std::is_signed<K>::value ? 0 : INT64_MIN;
+  const __m256i sign = _mm256_set1_epi64x(flip);
+  const __m256i kv = _mm256_set1_epi64x(static_cast<int64_t>(key) ^ flip);
+  long c = 0, i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_xor_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)), sign);
+    __m256i lt = _mm256_cmpgt_epi64(kv, x);
+    c += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(lt)));
+  }
+  return c + countLess(a + i, n - i, key);
+}
+
+inline bool cpuHasAVX2() {
+  static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+  return hasAVX2;
+}
+#endif
+
+template <class K>
+inline long countLessWindow(const K *a, long n, const K &key, std::true_type) {
+#ifdef LSMTREE_HAVE_AVX2_DISPATCH
+  if (cpuHasAVX2()) {
+    return countLessAVX2(a, n, key,
+                         std::integral_constant<size_t, sizeof(K)>());
+  }
+#endif
+  return countLess(a, n, key);
+}
+
+template <class K>
+inline long countLessWindow(const K *a, long n, const K &key,
+                            std::false_type) {
+  return countLess(a, n, key);
+}
+
+template <class K>
+long lowerBound(const K *a, long n, const K &key) {
+  const K *base = a;
+  // 答案始终在 [base, base + n] 中，条件赋值编译成 cmov
+  while (n > kLinearWindow) {
+    long half = n / 2;
+    base = base[half] < key ? base + half : base;
+    n -= half;
+  }
+  return (base - a) + countLessWindow(base, n, key, LowerBoundSIMD<K>());
+}
+
+// 每个 block 第一个 key 组成的 fence pointers，按 Eytzinger（BFS）顺序存放：
+// 节点 i 的孩子是 2i 和 2i+1。查找路径只依赖比较结果，没有分支预测失败；
+// 一个 cache line 放 kPerLine 个 key，提前预取 log2(kPerLine) 层之后的
+// 孙子节点，它们在同一个 cache line 里
+// <https://arxiv.org/abs/1509.05053>
+template <class K>
+class FenceIndex {
+ public:
+  FenceIndex() : _n(0), _tree(nullptr), _rank(1, 0) {}
+  FenceIndex(const FenceIndex &) = delete;
+  FenceIndex &operator=(const FenceIndex &) = delete;
+  ~FenceIndex() { free(_tree); }
+
+  // keys 必须有序
+  void build(const std::vector<K> &keys) {
+    free(_tree);
+    _n = keys.size();
+    // 下标从 1 开始，起始地址按 64 字节对齐，同一个节点的后代落在一个 cache line
+    size_t bytes = ((_n + 1) * sizeof(K) + 63) / 64 * 64;
+    if (posix_memalign(reinterpret_cast<void **>(&_tree), 64, bytes) != 0) {
+      perror("Error allocating fence index");
+      exit(EXIT_FAILURE);
+    }
+    _rank.assign(_n + 1, _n);
+    long i = 0;
+    fill(keys, i, 1);
+  }
+
+  // 第一个 > key 的 fence 在有序数组中的下标，没有时返回 size()
+  long upperBound(const K &key) const {
+    unsigned long k = 1;
+    while (k <= _n) {
+      __builtin_prefetch(_tree + k * kPerLine);
+      k = 2 * k + !(key < _tree[k]);
+    }
+    // 去掉末尾连续的右转和最后一次左转，回到第一个 > key 的节点
+    k >>= __builtin_ffsl(~k);
+    return _rank[k];
+  }
+
+  long size() const { return _n; }
+
+ private:
+  static const unsigned long kPerLine =
+      sizeof(K) >= 64 ? 1 : 64 / sizeof(K);
+
+  unsigned long _n;
+  K *_tree;
+  std::vector<long> _rank;  // Eytzinger 下标 -> 有序下标，_rank[0] = n
+
+  // 中序遍历的顺序就是有序数组的顺序
+  void fill(const std::vector<K> &keys, long &i, unsigned long k) {
+    if (k > _n) return;
+    fill(keys, i, 2 * k);
+    _tree[k] = keys[i];
+    _rank[k] = i++;
+    fill(keys, i, 2 * k + 1);
+  }
+};
+
+#endif  // LSMTREE_FENCE_INDEX_HPP
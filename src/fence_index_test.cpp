@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "fence_index.hpp"
+#include "test_util.hpp"
+
+// n 个有序的随机 keys。span 小时有大量重复的 key
+template <class K>
+std::vector<K> sortedKeys(std::mt19937_64 &rng, long n, uint64_t span) {
+  std::vector<K> keys;
+  for (long i = 0; i < n; i++) {
+    keys.push_back(static_cast<K>(span == 0 ? rng() : rng() % span));
+  }
+  std::sort(keys.begin(), keys.end());
+  return keys;
+}
+
+// 查找的 keys：数组中的每个 key、它们的前后一个值，以及随机值和两端的值
+template <class K>
+std::vector<K> probes(std::mt19937_64 &rng, const std::vector<K> &keys,
+                      uint64_t span) {
+  std::vector<K> out = {std::numeric_limits<K>::min(),
+                        std::numeric_limits<K>::max(), K(0)};
+  for (const K &key : keys) {
+    out.push_back(key);
+    out.push_back(static_cast<K>(static_cast<uint64_t>(key) - 1));
+    out.push_back(static_cast<K>(static_cast<uint64_t>(key) + 1));
+  }
+  for (int i = 0; i < 100; i++) {
+    out.push_back(static_cast<K>(span == 0 ? rng() : rng() % span));
+  }
+  return out;
+}
+
+// lowerBound 和 countLess（包括 AVX2 的版本）的结果和 std::lower_bound 一样
+template <class K>
+void checkLowerBound(std::mt19937_64 &rng, uint64_t span) {
+  for (long n : {0L, 1L, 2L, 3L, 7L, 8L, 9L, 63L, 64L, 65L, 100L, 1000L}) {
+    std::vector<K> keys = sortedKeys<K>(rng, n, span);
+    for (const K &key : probes(rng, keys, span)) {
+      long expected =
+          std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+      CHECK(lowerBound(keys.data(), n, key) == expected);
+      if (n <= kLinearWindow) {
+        CHECK(countLess(keys.data(), n, key) == expected);
+#ifdef LSMTREE_HAVE_AVX2_DISPATCH
+        if (cpuHasAVX2()) {
+          CHECK(countLessAVX2(keys.data(), n, key,
+                              std::integral_constant<size_t, sizeof(K)>()) ==
+                expected);
+        }
+#endif
+      }
+    }
+  }
+}
+
+// 有符号和无符号的 4 / 8 字节 key，负数、两端的值和重复的 key
+void testLowerBound() {
+  std::mt19937_64 rng(1);
+  for (int round = 0; round < 10; round++) {
+    checkLowerBound<int32_t>(rng, 0);
+    checkLowerBound<int32_t>(rng, 10);
+    checkLowerBound<uint32_t>(rng, 0);
+    checkLowerBound<uint32_t>(rng, 10);
+    checkLowerBound<int64_t>(rng, 0);
+    checkLowerBound<int64_t>(rng, 10);
+    checkLowerBound<uint64_t>(rng, 0);
+    checkLowerBound<uint64_t>(rng, 10);
+  }
+
+  // 负数在翻转符号位之后仍然排在正数前面
+  std::vector<int> keys = {INT_MIN, -100, -1, 0, 1, 100, INT_MAX, INT_MAX};
+  for (int key : {INT_MIN, -101, -100, -2, -1, 0, 2, INT_MAX}) {
+    long expected =
+        std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+    CHECK(lowerBound(keys.data(), keys.size(), key) == expected);
+  }
+}
+
+// 不走 SIMD 的 key 类型
+void testLowerBoundGeneric() {
+  std::vector<std::string> keys;
+  for (int i = 0; i < 300; i++) keys.push_back(std::to_string(i * 3));
+  std::sort(keys.begin(), keys.end());
+  for (int i = -1; i < 1000; i++) {
+    std::string key = std::to_string(i);
+    long expected =
+        std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+    CHECK(lowerBound(keys.data(), keys.size(), key) == expected);
+  }
+}
+
+// FenceIndex::upperBound 和 std::upper_bound 一样，包括空的 index
+template <class K>
+void checkFenceIndex(std::mt19937_64 &rng, uint64_t span) {
+  for (long n : {0L, 1L, 2L, 3L, 15L, 16L, 17L, 255L, 256L, 1000L}) {
+    std::vector<K> keys = sortedKeys<K>(rng, n, span);
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    FenceIndex<K> index;
+    index.build(keys);
+    CHECK(index.size() == static_cast<long>(keys.size()));
+    for (const K &key : probes(rng, keys, span)) {
+      long expected =
+          std::upper_bound(keys.begin(), keys.end(), key) - keys.begin();
+      CHECK(index.upperBound(key) == expected);
+    }
+  }
+}
+
+void testFenceIndex() {
+  std::mt19937_64 rng(2);
+  for (int round = 0; round < 10; round++) {
+    checkFenceIndex<int32_t>(rng, 0);
+    checkFenceIndex<int32_t>(rng, 3000);
+    checkFenceIndex<uint64_t>(rng, 0);
+    checkFenceIndex<int16_t>(rng, 0);
+  }
+
+  // 重新 build 时替换掉原来的内容
+  FenceIndex<int> index;
+  index.build(std::vector<int>{1, 2, 3});
+  index.build(std::vector<int>{-5, 10});
+  CHECK(index.size() == 2);
+  CHECK(index.upperBound(-6) == 0);
+  CHECK(index.upperBound(-5) == 1);
+  CHECK(index.upperBound(10) == 2);
+}
+
+int main() {
+  RUN_TEST(testLowerBound);
+  RUN_TEST(testLowerBoundGeneric);
+  RUN_TEST(testFenceIndex);
+  return 0;
+}
@@ -0,0 +1,348 @@
+#ifndef LSMTREE_IO_ENGINE_HPP
+#define LSMTREE_IO_ENGINE_HPP
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define LSMTREE_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+// 一次读请求，buf 至少有 len 字节
+struct ReadRequest {
+  int fd;
+  uint64_t offset;
+  uint32_t len;
+  char *buf;
+};
+
+// 批量读的 I/O 引擎：一次提交多个读请求，全部完成后返回，
+// 调用方的多个 block 读同时在设备上排队。读失败时退出
+class IOEngine {
+ public:
+  virtual ~IOEngine() = default;
+  virtual void read(std::vector<ReadRequest> &reqs) = 0;
+  virtual const char *name() = 0;
+
+  // 优先用 io_uring，内核不支持或者被禁用时退回线程池
+  static std::shared_ptr<IOEngine> create(unsigned queueDepth = 64,
+                                          int poolThreads = 8);
+
+ protected:
+  // 同步读完 [offset, offset + len)，失败时退出
+  static void preadFully(const ReadRequest &req, uint32_t done = 0) {
+    while (done < req.len) {
+      ssize_t ret =
+          pread(req.fd, req.buf + done, req.len - done, req.offset + done);
+      if (ret <= 0) {
+        if (ret == -1 && errno == EINTR) continue;
+        if (ret == 0) errno = EIO;  // 读到文件末尾之后
+        perror("Error reading block");
+        exit(EXIT_FAILURE);
+      }
+      done += ret;
+    }
+  }
+};
+
+// 每个请求在线程池中做一次 pread，调用方等待整批完成
+class ThreadPoolEngine : public IOEngine {
+ public:
+  explicit ThreadPoolEngine(int threads) : _stop(false) {
+    for (int i = 0; i < threads; i++) {
+      _workers.emplace_back([this]() { work(); });
+    }
+  }
+
+  ~ThreadPoolEngine() {
+    {
+      std::lock_guard<std::mutex> lk(_lock);
+      _stop = true;
+    }
+    _cv.notify_all();
+    for (auto &worker : _workers) {
+      worker.join();
+    }
+  }
+
+  void read(std::vector<ReadRequest> &reqs) {
+    if (reqs.size() <= 1 || _workers.empty()) {
+      for (auto &req : reqs) preadFully(req);
+      return;
+    }
+
+    Batch batch;
+    batch.pending = reqs.size();
+    {
+      std::lock_guard<std::mutex> lk(_lock);
+      for (auto &req : reqs) _queue.push_back(Task{&req, &batch});
+    }
+    _cv.notify_all();
+
+    std::unique_lock<std::mutex> lk(batch.lock);
+    batch.done.wait(lk, [&batch]() { return batch.pending == 0; });
+  }
+
+  const char *name() { return "threadpool"; }
+
+ private:
+  struct Batch {
+    std::mutex lock;
+    std::condition_variable done;
+    size_t pending;
+  };
+  struct Task {
+    ReadRequest *req;
+    Batch *batch;
+  };
+
+  std::mutex _lock;
+  std::condition_variable _cv;
+  std::deque<Task> _queue;
+  std::vector<std::thread> _workers;
+  bool _stop;
+
+  void work() {
+    while (true) {
+      Task task;
+      {
+        std::unique_lock<std::mutex> lk(_lock);
+        _cv.wait(lk, [this]() { return _stop || !_queue.empty(); });
+        if (_queue.empty()) return;
+        task = _queue.front();
+        _queue.pop_front();
+      }
+
+      preadFully(*task.req);
+      std::lock_guard<std::mutex> lk(task.batch->lock);
+      if (--task.batch->pending == 0) {
+        task.batch->done.notify_one();
+      }
+    }
+  }
+};
+
+#ifdef LSMTREE_HAVE_IO_URING
+// 直接用系统调用的 io_uring，不依赖 liburing。每个 ring 同一时间只给一个
+// 调用方用，空闲的 rings 放在池里，并发的调用方各自拿一个
+// <https://kernel.dk/io_uring.pdf>
+class UringEngine : public IOEngine {
+ public:
+  explicit UringEngine(unsigned queueDepth) : _queueDepth(queueDepth) {}
+
+  ~UringEngine() {
+    for (auto ring : _rings) {
+      destroyRing(ring);
+    }
+  }
+
+  // 当前内核能否创建 ring
+  bool init() {
+    Ring *ring = createRing();
+    if (ring == nullptr) return false;
+    _rings.push_back(ring);
+    _free.push_back(ring);
+    return true;
+  }
+
+  void read(std::vector<ReadRequest> &reqs) {
+    Ring *ring = acquire();
+    if (ring == nullptr) {
+      for (auto &req : reqs) preadFully(req);
+      return;
+    }
+
+    size_t next = 0, completed = 0;
+    while (completed < reqs.size()) {
+      // 在 ring 容量之内尽量多提交
+      unsigned toSubmit = ring->unsubmitted;
+      unsigned tail = *ring->sqTail;
+      while (next < reqs.size() && ring->inflight < ring->entries) {
+        unsigned idx = tail & *ring->sqMask;
+        io_uring_sqe *sqe = &ring->sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = reqs[next].fd;
+        sqe->addr = reinterpret_cast<uint64_t>(reqs[next].buf);
+        sqe->len = reqs[next].len;
+        sqe->off = reqs[next].offset;
+        sqe->user_data = next;
+        ring->sqArray[idx] = idx;
+        tail++;
+        next++;
+        toSubmit++;
+        ring->inflight++;
+      }
+      __atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+
+      int ret = enter(ring->fd, toSubmit, 1, IORING_ENTER_GETEVENTS);
+      if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        perror("Error in io_uring_enter");
+        exit(EXIT_FAILURE);
+      }
+      // 内核没有取走的 sqes 留到下一次提交
+      ring->unsubmitted = ret < 0 ? toSubmit : toSubmit - ret;
+
+      unsigned head = *ring->cqHead;
+      while (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+        io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+        ReadRequest &req = reqs[cqe->user_data];
+        // 短读补齐剩下的部分；内核不支持 IORING_OP_READ 等错误由 pread
+        // 重试，真正的 I/O 错误在 pread 中报告
+        preadFully(req, cqe->res > 0 ? static_cast<uint32_t>(cqe->res) : 0);
+        head++;
+        completed++;
+        ring->inflight--;
+      }
+      __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    release(ring);
+  }
+
+  const char *name() { return "io_uring"; }
+
+ private:
+  struct Ring {
+    int fd;
+    unsigned entries;
+    unsigned inflight;     // 已经放进 sq 还没有完成的请求数
+    unsigned unsubmitted;  // 已经放进 sq 还没有提交给内核的请求数
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    io_uring_sqe *sqes;
+    io_uring_cqe *cqes;
+    void *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize, sqesSize;
+  };
+
+  unsigned _queueDepth;
+  std::mutex _lock;
+  std::vector<Ring *> _rings;  // 所有 rings
+  std::vector<Ring *> _free;   // 空闲的 rings
+
+  static int enter(int fd, unsigned toSubmit, unsigned minComplete,
+                   unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit,
+                                    minComplete, flags, nullptr, 0));
+  }
+
+  Ring *acquire() {
+    {
+      std::lock_guard<std::mutex> lk(_lock);
+      if (!_free.empty()) {
+        Ring *ring = _free.back();
+        _free.pop_back();
+        return ring;
+      }
+    }
+    Ring *ring = createRing();
+    if (ring != nullptr) {
+      std::lock_guard<std::mutex> lk(_lock);
+      _rings.push_back(ring);
+    }
+    return ring;
+  }
+
+  void release(Ring *ring) {
+    std::lock_guard<std::mutex> lk(_lock);
+    _free.push_back(ring);
+  }
+
+  Ring *createRing() {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = static_cast<int>(
+        syscall(__NR_io_uring_setup, _queueDepth, &params));
+    if (fd < 0) {
+      return nullptr;
+    }
+
+    Ring *ring = new Ring();
+    ring->fd = fd;
+    ring->entries = params.sq_entries;
+    ring->inflight = 0;
+    ring->unsubmitted = 0;
+    ring->sqRingSize =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+      ring->sqRingSize = ring->cqRingSize =
+          std::max(ring->sqRingSize, ring->cqRingSize);
+    }
+    ring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+    ring->sqRing = mmap(0, ring->sqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    ring->cqRing =
+        single ? ring->sqRing
+               : mmap(0, ring->cqRingSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    ring->sqes = (io_uring_sqe *)mmap(0, ring->sqesSize,
+                                      PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_POPULATE, fd,
+                                      IORING_OFF_SQES);
+    if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED ||
+        ring->sqes == MAP_FAILED) {
+      perror("Error in mmapping io_uring");
+      exit(EXIT_FAILURE);
+    }
+
+    char *sq = (char *)ring->sqRing;
+    ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+    char *cq = (char *)ring->cqRing;
+    ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    return ring;
+  }
+
+  static void destroyRing(Ring *ring) {
+    munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRing != ring->sqRing) {
+      munmap(ring->cqRing, ring->cqRingSize);
+    }
+    munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->fd);
+    delete ring;
+  }
+};
+#endif
+
+inline std::shared_ptr<IOEngine> IOEngine::create(unsigned queueDepth,
+                                                  int poolThreads) {
+#ifdef LSMTREE_HAVE_IO_URING
+  std::shared_ptr<UringEngine> uring(new UringEngine(queueDepth));
+  if (uring->init()) {
+    return uring;
+  }
+#endif
+  return std::make_shared<ThreadPoolEngine>(poolThreads);
+}
+
+#endif  // LSMTREE_IO_ENGINE_HPP
@@ -0,0 +1,111 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "block_cache.hpp"
+#include "io_engine.hpp"
+#include "lsm.hpp"
+#include "test_util.hpp"
+
+const int kKeySpace = 5000;
+
+// 把请求交给 inner，记下经过的请求个数，确认 LSM 的读确实走了引擎
+class CountingEngine : public IOEngine {
+ public:
+  explicit CountingEngine(std::shared_ptr<IOEngine> inner)
+      : _inner(std::move(inner)), _reads(0) {}
+
+  void read(std::vector<ReadRequest> &reqs) {
+    _reads += reqs.size();
+    _inner->read(reqs);
+  }
+
+  const char *name() { return _inner->name(); }
+  long reads() const { return _reads.load(); }
+
+ private:
+  std::shared_ptr<IOEngine> _inner;
+  std::atomic<long> _reads;
+};
+
+// 所有要测的引擎：IOEngine::create() 选出的，强制的线程池，
+// 没有线程的线程池（逐个 pread），以及内核支持时直接创建的 io_uring
+std::vector<std::shared_ptr<IOEngine>> allEngines(unsigned queueDepth) {
+  std::vector<std::shared_ptr<IOEngine>> engines;
+  engines.push_back(IOEngine::create(queueDepth, 4));
+  engines.push_back(std::make_shared<ThreadPoolEngine>(4));
+  engines.push_back(std::make_shared<ThreadPoolEngine>(0));
+#ifdef LSMTREE_HAVE_IO_URING
+  std::shared_ptr<UringEngine> uring(new UringEngine(queueDepth));
+  if (uring->init()) engines.push_back(uring);
+#endif
+  return engines;
+}
+
+// 一批比队列深度多得多、长短和位置随机的读请求，每个引擎读出的内容
+// 都和文件中的一样
+void testEngineReads() {
+  TempDir tmp;
+  std::string filename = tmp.file("data");
+  std::string content(1 << 20, '\0');
+  std::mt19937 rng(1);
+  for (auto &c : content) c = static_cast<char>(rng());
+  int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  CHECK(fd != -1);
+  CHECK(write(fd, content.data(), content.size()) ==
+        static_cast<ssize_t>(content.size()));
+
+  for (auto &engine : allEngines(8)) {
+    std::vector<std::string> bufs(300);
+    std::vector<ReadRequest> reqs;
+    for (auto &buf : bufs) {
+      uint32_t len = 1 + rng() % 8192;
+      uint64_t offset = rng() % (content.size() - len);
+      buf.assign(len, '\0');
+      reqs.push_back(ReadRequest{fd, offset, len, &buf[0]});
+    }
+    engine->read(reqs);
+    for (size_t i = 0; i < reqs.size(); i++) {
+      CHECK(bufs[i] == content.substr(reqs[i].offset, reqs[i].len));
+    }
+
+    std::vector<ReadRequest> none;
+    engine->read(none);
+  }
+  close(fd);
+}
+
+// disk runs 用 pread 和一个很小的 cache 读，multiGet 和范围查询经过各个
+// 引擎批量读 blocks，结果和不设置引擎、逐个 pread 时一样
+void testLSMReadsThroughEngines() {
+  std::vector<std::shared_ptr<IOEngine>> engines = allEngines(64);
+  engines.insert(engines.begin(), nullptr);
+  for (auto &engine : engines) {
+    TempDir tmp;
+    TestLSM lsm(200, 4, 0.5, 0.01, 16, 3);
+    lsm.setBlockCache(std::make_shared<BlockCache>(16 << 10));
+    std::shared_ptr<CountingEngine> counting;
+    if (engine) {
+      counting = std::make_shared<CountingEngine>(engine);
+      lsm.setIOEngine(counting);
+    }
+    lsm.open(tmp.path(), WalSyncMode::NONE);
+
+    std::map<int, int> ref;
+    writeRandom(lsm, ref, 30000, 1, kKeySpace);
+    checkContents(lsm, ref, kKeySpace);
+    if (counting) CHECK(counting->reads() > 0);
+  }
+}
+
+int main() {
+  RUN_TEST(testEngineReads);
+  RUN_TEST(testLSMReadsThroughEngines);
+  return 0;
+}
@@ -0,0 +1,109 @@
+#ifndef LSMTREE_ITERATOR_HPP
+#define LSMTREE_ITERATOR_HPP
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+// 按 key 升序遍历一个 run 的迭代器
+template <class K, class V>
+class KVIterator {
+ public:
+  virtual bool valid() = 0;
+  virtual void seekToFirst() = 0;
+  virtual void seek(const K &key) = 0;  // 定位到第一个 >= key 的元素
+  virtual void next() = 0;
+  virtual K key() = 0;
+  virtual V value() = 0;
+  virtual bool isDeleted() = 0;  // 当前元素是墓碑
+  virtual ~KVIterator() = default;
+};
+
+// 把多个 runs 的迭代器按 key 归并，同一个 key 只输出最新的版本，
+// 最新版本是墓碑的 key 直接跳过。
+// 堆中每个子迭代器只占一项，内存是 O(runs 数)
+template <class K, class V>
+class MergingIterator : public KVIterator<K, V> {
+ public:
+  typedef std::unique_ptr<KVIterator<K, V>> ChildPtr;
+
+  // children 从新到旧排列，相同的 key 以下标小的为准
+  explicit MergingIterator(std::vector<ChildPtr> children)
+      : _children(std::move(children)) {
+    _heap.reserve(_children.size());
+  }
+
+  bool valid() { return !_heap.empty(); }
+
+  void seekToFirst() {
+    for (auto &child : _children) child->seekToFirst();
+    rebuildHeap();
+  }
+
+  void seek(const K &key) {
+    for (auto &child : _children) child->seek(key);
+    rebuildHeap();
+  }
+
+  void next() {
+    skipCurrentKey();
+    skipDeleted();
+  }
+
+  K key() { return _heap.front().key; }
+  V value() { return _children[_heap.front().idx]->value(); }
+  bool isDeleted() { return false; }
+
+ private:
+  struct HeapItem {
+    K key;
+    int idx;
+  };
+
+  std::vector<ChildPtr> _children;
+  std::vector<HeapItem> _heap;  // 以 (key, idx) 为序的最小堆
+
+  // std::push_heap 默认是最大堆，比较反过来
+  static bool greater(const HeapItem &a, const HeapItem &b) {
+    return a.key > b.key || (a.key == b.key && a.idx > b.idx);
+  }
+
+  void push(int idx) {
+    _heap.push_back(HeapItem{_children[idx]->key(), idx});
+    std::push_heap(_heap.begin(), _heap.end(), greater);
+  }
+
+  void rebuildHeap() {
+    _heap.clear();
+    for (int i = 0; i < static_cast<int>(_children.size()); i++) {
+      if (_children[i]->valid()) {
+        _heap.push_back(HeapItem{_children[i]->key(), i});
+      }
+    }
+    std::make_heap(_heap.begin(), _heap.end(), greater);
+    skipDeleted();
+  }
+
+  // 所有停在堆顶 key 上的子迭代器都前进一步，旧 runs 中的版本一起跳过
+  void skipCurrentKey() {
+    K cur = _heap.front().key;
+    while (!_heap.empty() && _heap.front().key == cur) {
+      int idx = _heap.front().idx;
+      std::pop_heap(_heap.begin(), _heap.end(), greater);
+      _heap.pop_back();
+
+      _children[idx]->next();
+      if (_children[idx]->valid()) {
+        push(idx);
+      }
+    }
+  }
+
+  void skipDeleted() {
+    while (valid() && _children[_heap.front().idx]->isDeleted()) {
+      skipCurrentKey();
+    }
+  }
+};
+
+#endif  // LSMTREE_ITERATOR_HPP
@@ -0,0 +1,108 @@
+#ifndef LSMTREE_LOSER_TREE_HPP
+#define LSMTREE_LOSER_TREE_HPP
+
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+// 败者树中一个输入当前的比较值：先比 key，key 相同时下标小的输入先输出，
+// 已经读完的输入比任何 key 都大
+template <class K, class Enable = void>
+struct MergeWord {
+  K key;
+  int idx;
+  bool isEnd;
+
+  static MergeWord make(const K &key, int idx) {
+    return MergeWord{key, idx, false};
+  }
+  static MergeWord end(int idx) { return MergeWord{K(), idx, true}; }
+
+  bool operator<(const MergeWord &other) const {
+    if (isEnd || other.isEnd) {
+      return !isEnd;
+    }
+    return key < other.key || (!(other.key < key) && idx < other.idx);
+  }
+};
+
+// 不超过 32 位的整数 key 和输入下标拼成一个 64 位无符号数，一次比较完成。
+// 有符号的 key 翻转符号位之后按无符号数比较，顺序不变
+template <class K>
+struct MergeWord<K, typename std::enable_if<std::is_integral<K>::value &&
+                                            sizeof(K) <= 4>::type> {
+  uint64_t word;
+
+  static MergeWord make(const K &key, int idx) {
+    uint32_t u = static_cast<typename std::make_unsigned<K>::type>(key);
+    if (std::is_signed<K>::value) {
+      u ^= uint32_t(1) << (sizeof(K) * 8 - 1);
+    }
+    return MergeWord{(static_cast<uint64_t>(u) << 32) |
+                     static_cast<uint32_t>(idx)};
+  }
+  static MergeWord end(int) { return MergeWord{UINT64_MAX}; }
+
+  bool operator<(const MergeWord &other) const { return word < other.word; }
+};
+
+// k 路归并的败者树。内部节点 [1, k) 保存这一场比赛的败者，_tree[0] 是
+// 最终的胜者；输入 s 的叶子是 s + k，父节点是 /2，k 不要求是 2 的幂。
+// 胜者的输入前进之后只需要从它的叶子到根重赛一次，比较次数是 log k
+template <class K>
+class LoserTree {
+ public:
+  typedef MergeWord<K> Word;
+
+  explicit LoserTree(int k) : _k(k), _tree(k > 0 ? k : 1, 0) {
+    for (int i = 0; i < k; i++) _words.push_back(Word::end(i));
+  }
+
+  void set(int idx, const K &key) { _words[idx] = Word::make(key, idx); }
+  void setEnd(int idx) { _words[idx] = Word::end(idx); }
+
+  // 所有输入 set 之后建树
+  void build() {
+    if (_k == 0) return;
+    std::vector<int> winner(2 * _k);
+    for (int s = 0; s < _k; s++) winner[s + _k] = s;
+    for (int t = _k - 1; t > 0; t--) {
+      int a = winner[2 * t], b = winner[2 * t + 1];
+      if (_words[a] < _words[b]) {
+        winner[t] = a;
+        _tree[t] = b;
+      } else {
+        winner[t] = b;
+        _tree[t] = a;
+      }
+    }
+    _tree[0] = _k > 1 ? winner[1] : 0;
+  }
+
+  // 当前 key 最小的输入，empty() 时没有意义
+  int top() const { return _tree[0]; }
+
+  bool empty() const { return _k == 0 || isEnd(_tree[0]); }
+
+  // top() 的输入 set / setEnd 之后调用
+  void replay() {
+    int winner = _tree[0];
+    for (int t = (winner + _k) / 2; t > 0; t /= 2) {
+      if (_words[_tree[t]] < _words[winner]) {
+        int tmp = _tree[t];
+        _tree[t] = winner;
+        winner = tmp;
+      }
+    }
+    _tree[0] = winner;
+  }
+
+ private:
+  int _k;
+  std::vector<int> _tree;
+  std::vector<Word> _words;
+
+  bool isEnd(int idx) const { return !(_words[idx] < Word::end(idx)); }
+};
+
+#endif  // LSMTREE_LOSER_TREE_HPP
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "loser_tree.hpp"
+#include "test_util.hpp"
+
+// 用败者树归并有序的 inputs，返回 (key, 输入下标) 的输出顺序
+template <class K>
+std::vector<std::pair<K, int>> mergeAll(
+    const std::vector<std::vector<K>> &inputs) {
+  int k = inputs.size();
+  LoserTree<K> tree(k);
+  std::vector<size_t> pos(k, 0);
+  for (int i = 0; i < k; i++) {
+    if (inputs[i].empty()) {
+      tree.setEnd(i);
+    } else {
+      tree.set(i, inputs[i][0]);
+    }
+  }
+  tree.build();
+
+  std::vector<std::pair<K, int>> out;
+  while (!tree.empty()) {
+    int i = tree.top();
+    out.emplace_back(inputs[i][pos[i]], i);
+    if (++pos[i] < inputs[i].size()) {
+      tree.set(i, inputs[i][pos[i]]);
+    } else {
+      tree.setEnd(i);
+    }
+    tree.replay();
+  }
+  return out;
+}
+
+// 输出按 key 有序，key 相同时下标小的输入在前，同一个输入中保持原来的顺序
+template <class K>
+void checkMerge(const std::vector<std::vector<K>> &inputs) {
+  std::vector<std::tuple<K, int, size_t>> all;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    for (size_t j = 0; j < inputs[i].size(); j++) {
+      all.emplace_back(inputs[i][j], i, j);
+    }
+  }
+  std::sort(all.begin(), all.end());
+
+  std::vector<std::pair<K, int>> out = mergeAll(inputs);
+  CHECK(out.size() == all.size());
+  for (size_t i = 0; i < out.size(); i++) {
+    CHECK(out[i].first == std::get<0>(all[i]));
+    CHECK(out[i].second == std::get<1>(all[i]));
+  }
+}
+
+// k 个有序的随机输入，keys 在 [lo, lo + span) 中，有一些空的输入
+template <class K>
+std::vector<std::vector<K>> randomInputs(std::mt19937_64 &rng, int k, K lo,
+                                         uint64_t span) {
+  std::vector<std::vector<K>> inputs;
+  for (int i = 0; i < k; i++) {
+    std::vector<K> input;
+    size_t n = rng() % 4 == 0 ? 0 : rng() % 200;
+    for (size_t j = 0; j < n; j++) {
+      uint64_t offset = rng() % span;
+      input.push_back(static_cast<K>(static_cast<uint64_t>(lo) + offset));
+    }
+    std::sort(input.begin(), input.end());
+    inputs.push_back(std::move(input));
+  }
+  return inputs;
+}
+
+// 32 位以内的整数 key 走拼成一个 64 位数比较的版本，负数要排在正数前面，
+// key 相同时按输入下标
+void testPackedKeys() {
+  std::mt19937_64 rng(1);
+  for (int k : {0, 1, 2, 3, 5, 8, 13, 64}) {
+    for (int round = 0; round < 20; round++) {
+      checkMerge(randomInputs<int>(rng, k, -50, 100));  // 大量相同的 key
+      checkMerge(randomInputs<int>(rng, k, INT_MIN, UINT32_MAX));
+      checkMerge(randomInputs<int16_t>(rng, k, -1000, 2000));
+      checkMerge(randomInputs<uint32_t>(rng, k, 0, UINT32_MAX));
+    }
+  }
+
+  checkMerge(std::vector<std::vector<int>>{
+      {INT_MIN, -1, 0, INT_MAX}, {INT_MIN, INT_MIN, INT_MAX}, {}, {-1, -1}});
+  checkMerge(std::vector<std::vector<uint32_t>>{
+      {0, UINT32_MAX}, {UINT32_MAX, UINT32_MAX}, {0}});
+}
+
+// 其他的 key 走通用的比较
+void testGenericKeys() {
+  std::mt19937_64 rng(2);
+  for (int k : {1, 2, 3, 7, 16}) {
+    for (int round = 0; round < 20; round++) {
+      checkMerge(randomInputs<long>(rng, k, -100, 200));
+      checkMerge(randomInputs<int64_t>(rng, k, LLONG_MIN, UINT64_MAX));
+
+      std::vector<std::vector<std::string>> strs(k);
+      for (auto &input : strs) {
+        size_t n = rng() % 50;
+        for (size_t j = 0; j < n; j++) {
+          input.push_back(std::string(rng() % 3, 'a' + rng() % 3));
+        }
+        std::sort(input.begin(), input.end());
+      }
+      checkMerge(strs);
+    }
+  }
+}
+
+int main() {
+  RUN_TEST(testPackedKeys);
+  RUN_TEST(testGenericKeys);
+  return 0;
+}
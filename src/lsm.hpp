@@ -1,40 +1,109 @@
 #ifndef LSMTREE_LSM_HPP
 #define LSMTREE_LSM_HPP
 
+#include <dirent.h>
+#include <sys/stat.h>
+
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <thread>
 
 #include "bloom_filter.hpp"
+#include "concurrent_skip_list.hpp"
 #include "disk_level.hpp"
-#include "hash_map.hpp"
+#include "iterator.hpp"
+#include "loser_tree.hpp"
+#include "manifest.hpp"
 #include "run.hpp"
-#include "skip_list.hpp"
+#include "stats.hpp"
+#include "value_log.hpp"
+#include "wal.hpp"
+#include "write_batch.hpp"
 
 template <class K, class V>
 class LSM {
-  typedef SkipList<K, V> RunType;
+  typedef ConcurrentSkipList<K, V> RunType;
+  typedef BlockedBloomFilter<K> FilterType;
+  typedef WriteAheadLog<K, V> WALType;
+  typedef SliceTraits<K> KeyTraits;
+  typedef SliceTraits<V> ValueTraits;
+  typedef typename KeyTraits::View KeyView;
+
+  // 读者看到的一致视图：已经移出 C_0、正在写盘的 immutable runs，以及各层
+  // 已经写完的 disk runs。merge 线程改完 diskLevels 之后发布新的 version，
+  // 读者持有 version 期间其中的 runs、filters 和文件都不会被释放
+  struct Version {
+    std::vector<std::shared_ptr<RunType>> immutables;  // 从旧到新
+    std::vector<std::shared_ptr<FilterType>> immFilters;
+    std::vector<std::vector<DiskRunRef<K, V>>> levels;
+    std::shared_ptr<const ValueLogFileSet> valueLogFiles;  // 开启 value log 时
+  };
+
+  // 一次 search 在内存 runs 上的 filter 计数，结束时一起记到 level 0 上
+  struct MemFilterCounts {
+    EngineStats &stats;
+    uint64_t probes, negatives, falsePositives;
+
+    explicit MemFilterCounts(EngineStats &s)
+        : stats(s), probes(0), negatives(0), falsePositives(0) {}
+    ~MemFilterCounts() {
+      if (probes == 0) return;
+      stats.add(0, FILTER_PROBES, probes);
+      stats.add(0, FILTER_NEGATIVES, negatives);
+      stats.add(0, FILTER_FALSE_POSITIVES, falsePositives);
+    }
+  };
 
   long _eltsPerRun;
   long _n;
 
   double _fracRunsMerged; // 合并的倍数，(0, 1]
   double _bfFalsePositive; // 假阳性的概率
+  double _bfBitsBudget;    // disk levels filter 的总 bits，0 表示不按预算分配
+  bool _compressValues;    // disk runs 的 values 是否用 LZ 压缩
+  size_t _valueThreshold;  // 不小于这么多字节的 values 分离到 value log，0 表示不分离
+  uint64_t _valueLogFileBytes;       // value log 每个文件的大小
+  std::shared_ptr<ValueLog<K>> _vlog;  // open 时创建
+  int _mergeThreads;       // disk levels 之间归并的线程数，0 表示 CPU 核数
+  std::shared_ptr<BlockCache> _blockCache;  // 为空时 disk runs 用 mmap 读
+  std::shared_ptr<IOEngine> _ioEngine;      // disk runs 批量读用的 I/O 引擎
+  std::shared_ptr<CompactionPolicy> _policy;  // 决定每层 disk level 的形状
+  std::shared_ptr<EngineStats> _stats;        // 按线程分片的计数
 
-  int _activeRunIdx;
+  std::atomic<int> _activeRunIdx;
   int _numRuns; // 内存最大 run 数目
   int _numDiskLevels;
   int _diskRunsPerLevel; // 每层 level 数
   int _numToMerge; // C_0 一次 Merge 的 runs 数
   int _blockSize;
 
+  uint64_t _retiredRuns; // 已经交给 merge 的 runs 数，加上下标就是 run 的序号
+
   std::thread mergeThread;
+  std::thread gcThread;  // 定期对 value log 做 GC
+  bool _isGCReady;       // open 完成之后 GC 线程才开始工作
+  bool _isGCStopping;
+  WALType *wal;
+  Manifest *manifest;  // open 之后才有，记录 disk levels 的结构
+  std::shared_ptr<const Version> _version;
 
  public:
-  V V_TOMBSTONE = static_cast<V>(TOMBSTONE);
   std::mutex *mergeLock;
-  std::vector<Run<K, V> *> C_0;
-  std::vector<BloomFilter<K> *> filters;
+  // 写者和读者对 C_0 加共享锁，只有 flush 时替换 C_0 中的 runs 才加独占锁，
+  // run 内部的插入和查找都是无锁的
+  std::shared_timed_mutex *c0Lock;
+  std::mutex *flushLock;    // 串行化 flush，持有时等待上一次 merge 结束
+  std::mutex *versionLock;  // 保护 _version 指针本身，最内层的锁
+  std::mutex *gcLock;       // 串行化 value log 的 GC，也保护 GC 线程的状态
+  std::condition_variable *gcCv;
+  std::vector<std::shared_ptr<RunType>> C_0;
+  std::vector<std::shared_ptr<FilterType>> filters;
   std::vector<DiskLevel<K, V> *> diskLevels;
   LSM<K, V>(const LSM<K, V> &other) = default;
   LSM<K, V>(LSM<K, V> &&other) = default;
@@ -42,140 +111,283 @@ class LSM {
   LSM<K, V>(long eltsPerRun, int numRuns, double fracMerged,
             double bfFalsePositive, int blockSize, int diskRunsPerLevel)
       : _eltsPerRun(eltsPerRun),
-        _numRuns(numRuns),
+        _n(0),
         _fracRunsMerged(fracMerged),
+        _bfFalsePositive(bfFalsePositive),
+        _bfBitsBudget(0),
+        _compressValues(false),
+        _valueThreshold(0),
+        _valueLogFileBytes(kDefaultValueLogFileBytes),
+        _mergeThreads(0),
+        _policy(std::make_shared<TieringPolicy>(diskRunsPerLevel, fracMerged)),
+        _stats(std::make_shared<EngineStats>()),
+        _activeRunIdx(0),
+        _numRuns(numRuns),
         _diskRunsPerLevel(diskRunsPerLevel),
         _numToMerge(ceil(_fracRunsMerged * _numRuns)),
         _blockSize(blockSize),
-        _bfFalsePositive(bfFalsePositive),
-        _activeRunIdx(0),
-        _n(0) {
+        _retiredRuns(0),
+        _isGCReady(false),
+        _isGCStopping(false),
+        wal(nullptr),
+        manifest(nullptr),
+        _version(std::make_shared<Version>()) {
+    LevelShape shape = _policy->shape(1, _numToMerge * _eltsPerRun, true);
     DiskLevel<K, V> *diskLevel = new DiskLevel<K, V>(
-        blockSize, 1, _numToMerge * _eltsPerRun, _diskRunsPerLevel,
-        ceil(_diskRunsPerLevel * _fracRunsMerged), _bfFalsePositive);
+        blockSize, 1, shape.runSize, shape.numRuns, shape.mergeSize,
+        _bfFalsePositive, shape.leveled);
+    diskLevel->setStats(_stats);
 
     diskLevels.push_back(diskLevel);
     _numDiskLevels = 1;
 
     for (auto i = 0; i < _numRuns; i++) {
-      RunType *run = new RunType(INT32_MIN, INT32_MAX);
+      auto run = std::make_shared<RunType>();
       run->setSize(_eltsPerRun);
       C_0.push_back(run);
-
-      BloomFilter<K> *bf = new BloomFilter<K>(_eltsPerRun, _bfFalsePositive);
-      filters.push_back(bf);
+      filters.push_back(
+          std::make_shared<FilterType>(_eltsPerRun, _bfFalsePositive));
     }
 
     mergeLock = new std::mutex();
+    c0Lock = new std::shared_timed_mutex();
+    flushLock = new std::mutex();
+    versionLock = new std::mutex();
+    gcLock = new std::mutex();
+    gcCv = new std::condition_variable();
   }
 
   ~LSM<K, V>() {
+    if (gcThread.joinable()) {
+      {
+        std::lock_guard<std::mutex> lk(*gcLock);
+        _isGCStopping = true;
+      }
+      gcCv->notify_all();
+      gcThread.join();
+    }
     if (mergeThread.joinable()) {
       mergeThread.join();
     }
     delete mergeLock;
-    for (auto i = 0; i < C_0.size(); i++) {
-      delete C_0[i];
-      delete filters[i];
-    }
+    delete c0Lock;
+    delete flushLock;
+    delete versionLock;
+    delete gcLock;
+    delete gcCv;
+    delete wal;
+    delete manifest;
+    _version.reset();
 
-    for (auto i = 0; i < diskLevels.size(); i++) {
+    for (size_t i = 0; i < diskLevels.size(); i++) {
       delete diskLevels[i];
     }
   }
 
-  void insertKey(K &key, V &value) {
-    if (C_0[_activeRunIdx]->eltsNums() >= _eltsPerRun) {
-      ++_activeRunIdx;
+  // 把 dir 作为数据目录打开，需要在写入之前调用。已有 manifest 时按它恢复
+  // disk levels，只读取每个 run 文件末尾的元数据；不在 manifest 中的 run 文件
+  // 是崩溃时留下的，直接删除。C_0 由 dir/wal 中的 WAL 恢复
+  void open(const std::string &dir, WalSyncMode mode = WalSyncMode::NONE,
+            int syncIntervalMs = 0) {
+    if (mkdir(dir.c_str(), 0700) == -1 && errno != EEXIST) {
+      perror(("Error creating directory " + dir).c_str());
+      exit(EXIT_FAILURE);
+    }
+
+    {
+      std::lock_guard<std::mutex> lk(*mergeLock);
+      manifest = new Manifest(dir);
+      std::vector<ManifestLevel> levels;
+      uint64_t nextFileID = 0;
+      manifest->load(levels, nextFileID);
+      DiskRun<K, V>::reserveFileIDs(nextFileID);
+
+      // 先建好所有层，filter 的假阳性率确定之后再打开 runs，
+      // 文件中的 filter 才能直接使用
+      while (static_cast<size_t>(_numDiskLevels) < levels.size()) {
+        addDiskLevel();
+      }
+      for (size_t i = 0; i < levels.size(); i++) {
+        if (levels[i].runSize != diskLevels[i]->_runSize) {
+          fprintf(stderr, "Manifest in %s does not match LSM parameters\n",
+                  dir.c_str());
+          exit(EXIT_FAILURE);
+        }
+
+        std::vector<std::shared_ptr<DiskRun<K, V>>> restored;
+        for (size_t j = 0; j < levels[i].fileIDs.size(); j++) {
+          restored.push_back(std::make_shared<DiskRun<K, V>>(
+              dir, levels[i].fileIDs[j], _blockSize, diskLevels[i]->_level, j,
+              diskLevels[i]->_bfFalsePositive, _blockCache));
+        }
+        diskLevels[i]->restoreRuns(restored);
+      }
+      for (auto i = 0; i < _numDiskLevels; i++) {
+        diskLevels[i]->setDirectory(dir);
+      }
+
+      removeOrphanFiles(dir, levels);
+      saveManifest();
+      updateVersion([this](Version &v) { v.levels = levelSnapshot(); });
     }
 
-    if (_activeRunIdx >= _numRuns) {
-      doMerge();
+    // WAL 回放时的 flush 就可能写 value log，要先打开
+    if (_valueThreshold > 0) {
+      _vlog = std::make_shared<ValueLog<K>>(dir + "/vlog", _valueLogFileBytes);
+      updateVersion([this](Version &v) { v.valueLogFiles = _vlog->files(); });
     }
+    enableWAL(dir + "/wal", mode, syncIntervalMs);
 
-    C_0[_activeRunIdx]->insertKey(key, value);
+    std::lock_guard<std::mutex> lk(*gcLock);
+    _isGCReady = true;
   }
 
+  void insertKey(K &key, V &value) { putKey(WALType::PUT, key, value); }
+
+  // 把 batch 作为一个整体写入：排序去重之后一次预留 run 中的位置，
+  // 整批写进同一个 run 和同一条 WAL 记录，按 key 顺序插入时复用上一个
+  // key 的查找路径。并发的读者可能看到写了一部分的 batch。
+  // 去重之后超过 maxBatchSize 个 keys 的 batch 放不进一个 run，
+  // 不写入任何内容，返回 false
+  bool write(const WriteBatch<K, V> &batch) {
+    std::vector<typename WriteBatch<K, V>::Entry> entries = batch.sorted();
+    if (static_cast<long>(entries.size()) > maxBatchSize()) {
+      return false;
+    }
+    if (!entries.empty()) {
+      putBatch(entries.data(), entries.size());
+    }
+    return true;
+  }
+
+  // write 一次最多写入的 keys 个数，也就是一个 C_0 run 的大小
+  long maxBatchSize() const { return _eltsPerRun; }
+
+  // 不等待后台 merge：C_0 之后依次查 version 中的 immutable runs 和 disk levels
   bool search(K &key, V &value) {
-    bool isFound = false;
-    for (int i = _activeRunIdx; i >= 0; i--) {
-      if (key < C_0[i]->getMin() || key > C_0[i]->getMax() ||
-          !filters[i]->isContain(&key, sizeof(K))) {
-        continue;
-      }
+    _stats->add(POINT_LOOKUPS);
+    std::shared_ptr<const Version> version;
+    bool inMemory;
+    if (!lookup(key, value, inMemory, version)) {
+      return false;
+    }
+    if (!inMemory) {
+      resolveStored(*version, value);
+    }
+    _stats->add(USER_BYTES_READ, entryBytes(key, value));
+    return true;
+  }
 
-      value = C_0[i]->search(key, isFound);
-      if (isFound) {
-        return value != V_TOMBSTONE;
+  // 批量查找 keys[0, n)，found[i] 表示 keys[i] 是否存在。keys 排序之后
+  // 按 run 从新到旧查：每个 run 用 key 范围截出还没找到的 keys，先预取
+  // 它们的 filter lines 再一起测试，disk run 的候选 blocks 一次读入。
+  // 找到的 key 不再查后面的 runs
+  void multiGet(const K *keys, long n, V *values, bool *found) {
+    _stats->add(POINT_LOOKUPS, n);
+    std::vector<long> order(n);
+    for (long i = 0; i < n; i++) order[i] = i;
+    std::sort(order.begin(), order.end(),
+              [keys](long a, long b) { return keys[a] < keys[b]; });
+    std::vector<K> sorted(n);
+    for (long i = 0; i < n; i++) sorted[i] = keys[order[i]];
+    LookupBatch<K, V> batch(std::move(sorted));
+
+    std::shared_ptr<const Version> version;
+    {
+      std::shared_lock<std::shared_timed_mutex> lk(*c0Lock);
+      version = getVersion();
+      for (int i = _activeRunIdx.load(); i >= 0 && !batch.done(); i--) {
+        searchMemRun(C_0[i].get(), *filters[i], batch);
       }
     }
 
-    if (mergeThread.joinable()) {
-      mergeThread.join();
+    for (int i = static_cast<int>(version->immutables.size()) - 1;
+         i >= 0 && !batch.done(); i--) {
+      searchMemRun(version->immutables[i].get(), *version->immFilters[i],
+                   batch);
     }
+    // 在内存中找到的 values 不需要从 value log 还原
+    std::vector<bool> inMemory(batch.resolved.get(), batch.resolved.get() + n);
 
-    for (auto i = 0; i < _numDiskLevels; i++) {
-      value = diskLevels[i]->search(key, isFound);
-      if (isFound) {
-        return value != V_TOMBSTONE;
-      }
+    for (auto &level : version->levels) {
+      if (batch.done()) break;
+      DiskLevel<K, V>::multiSearchRuns(level, batch);
     }
 
-    return false;
+    uint64_t bytesRead = 0;
+    for (long i = 0; i < n; i++) {
+      found[order[i]] = batch.resolved[i] && !batch.deleted[i];
+      if (found[order[i]]) {
+        if (!inMemory[i]) resolveStored(*version, batch.values[i]);
+        bytesRead += entryBytes(batch.keys[i], batch.values[i]);
+      }
+      values[order[i]] = std::move(batch.values[i]);
+    }
+    _stats->add(USER_BYTES_READ, bytesRead);
   }
 
-  void deleteKey(K &key) { insertKey(key, V_TOMBSTONE); }
+  void deleteKey(K &key) {
+    V value = V();
+    putKey(WALType::DELETE, key, value);
+  }
 
+  // [k1, k2) 中的有效元素，由 newIterator 流式归并得到
   std::vector<kvPair<K, V>> range(K &k1, K &k2) {
+    std::vector<kvPair<K, V>> elts_in_range = std::vector<kvPair<K, V>>();
     if (k2 <= k1) {
-      return std::vector<kvPair<K, V>>{};
+      return elts_in_range;
     }
 
-    auto hashtable = HashTable<K, V>(4096 * 1000);
-    std::vector<kvPair<K, V>> elts_in_range = std::vector<kvPair<K, V>>();
-
-    for (int i = _activeRunIdx; i >= 0; i--) {
-      std::vector<kvPair<K, V>> cur_elts = C_0[i]->getAllInRange(k1, k2);
-      if (cur_elts.size() != 0) {
-        elts_in_range.reserve(elts_in_range.size() + cur_elts.size());
+    auto it = newIterator();
+    uint64_t bytesRead = 0;
+    for (it->seek(k1); it->valid() && it->key() < k2; it->next()) {
+      elts_in_range.push_back(kvPair<K, V>{it->key(), it->value()});
+      bytesRead += entryBytes(elts_in_range.back().key,
+                              elts_in_range.back().value);
+    }
+    _stats->add(RANGE_SCANS);
+    _stats->add(USER_BYTES_READ, bytesRead);
+    return elts_in_range;
+  }
 
-        for (auto j = 0; j < cur_elts.size(); j++) {
-          V dummy = hashtable.putIfEmpty(cur_elts[j].key, cur_elts[j].value);
-          if (!dummy && cur_elts[j].value != V_TOMBSTONE) {
-            elts_in_range.push_back(cur_elts[j]);
-          }
-        }
+  // 遍历整个 LSM 的迭代器，按 key 升序输出每个 key 最新的有效值。
+  // 创建时固定 C_0 和 version 中的 runs，之后不持有任何锁；
+  // 创建之后的写入可能看得到也可能看不到
+  std::unique_ptr<MergingIterator<K, V>> newIterator() {
+    std::vector<typename MergingIterator<K, V>::ChildPtr> children;
+    std::shared_ptr<const Version> version;
+    {
+      std::shared_lock<std::shared_timed_mutex> lk(*c0Lock);
+      version = getVersion();
+      for (int i = _activeRunIdx.load(); i >= 0; i--) {
+        children.emplace_back(new typename RunType::Iterator(C_0[i]));
       }
     }
 
-    if (mergeThread.joinable()) {
-      mergeThread.join();
+    for (int i = static_cast<int>(version->immutables.size()) - 1; i >= 0;
+         i--) {
+      children.emplace_back(
+          new typename RunType::Iterator(version->immutables[i]));
     }
-
-    for (auto i = 0; i < _numDiskLevels; i++) {
-      for (auto j = diskLevels[i]->_activeRunIdx - 1; j >= 0; j--) {
-        long i1, i2;
-        diskLevels[i]->runs[j]->getRangeIndex(k1, k2, i1, i2);
-
-        if (i2 - i1 != 0) {
-          auto oldSize = elts_in_range.size();
-          elts_in_range.reserve(oldSize + (i2 - i1));
-          for (long k = i1; k < i2; k++) {
-            auto kv = diskLevels[i]->runs[j]->map[k];
-            V dummy = hashtable.putIfEmpty(kv.key, kv.value);
-            if (!dummy && kv.value != V_TOMBSTONE) {
-              elts_in_range.push_back(kv);
-            }
-          }
+    for (auto &level : version->levels) {
+      for (int j = static_cast<int>(level.size()) - 1; j >= 0; j--) {
+        typename MergingIterator<K, V>::ChildPtr it(
+            new typename DiskRun<K, V>::Iterator(level[j].run));
+        if (_vlog) {
+          it.reset(new ValueLogIterator<K, V>(std::move(it),
+                                              version->valueLogFiles));
         }
+        children.push_back(std::move(it));
       }
     }
 
-    return elts_in_range;
+    return std::unique_ptr<MergingIterator<K, V>>(
+        new MergingIterator<K, V>(std::move(children)));
   }
 
   void printElts() {
-    if (mergeThread.joinable()) mergeThread.join();
+    std::shared_lock<std::shared_timed_mutex> c0Lk(*c0Lock);
+    std::shared_ptr<const Version> version = getVersion();
     std::cout << "MEMORY BUFFER:\n";
     for (auto i = 0; i < _activeRunIdx; i++) {
       std::cout << "MEMORY BUFFER RUN: " << i << std::endl;
@@ -186,14 +398,24 @@ class LSM {
       std::cout << std::endl;
     }
 
+    std::cout << "IMMUTABLE BUFFER:\n";
+    for (size_t i = 0; i < version->immutables.size(); i++) {
+      std::cout << "IMMUTABLE RUN: " << i << std::endl;
+      auto all = version->immutables[i]->getAll();
+      for (auto &c : all) {
+        std::cout << c.key << ":" << c.value << " ";
+      }
+      std::cout << std::endl;
+    }
+
     std::cout << "DISK BUFFER:\n";
-    for (auto i = 0; i < _numDiskLevels; i++) {
+    for (size_t i = 0; i < version->levels.size(); i++) {
       std::cout << "DISK LEVEL: " << i << std::endl;
-      for (auto j = 0; j < diskLevels[i]->_activeRunIdx; j++) {
+      for (size_t j = 0; j < version->levels[i].size(); j++) {
+        typename DiskRun<K, V>::Iterator it(version->levels[i][j].run);
         std::cout << "RUN: " << j << std::endl;
-        for (auto k = 0; k < diskLevels[i]->runs[j]->getCapacity(); k++) {
-          std::cout << diskLevels[i]->runs[j]->map[k].key << ":"
-                    << diskLevels[i]->runs[j]->map[k].value << " ";
+        for (it.seekToFirst(); it.valid(); it.next()) {
+          std::cout << it.key() << ":" << it.value() << " ";
         }
         std::cout << std::endl;
       }
@@ -202,18 +424,472 @@ class LSM {
     }
   }
 
-  void printStats() {
-    std::cout << "Number of Elements: " << size() << std::endl;
-    std::cout << "Number of Elements in Buffer (including deletes): "
-              << bufferNums() << std::endl;
+  // 各项计数的快照，只读取计数器和当前的 version，不影响读写。
+  // levels[0] 是内存中的 runs，之后是各个 disk level
+  StatsSnapshot getStats() {
+    StatsSnapshot snap;
+    for (int t = 0; t < NUM_ENGINE_TICKERS; t++) {
+      snap.tickers[t] = _stats->get(static_cast<EngineTicker>(t));
+    }
+    snap.cacheHits = _blockCache ? _blockCache->getHits() : 0;
+    snap.cacheMisses = _blockCache ? _blockCache->getMisses() : 0;
+    snap.cacheUsage = _blockCache ? _blockCache->getUsage() : 0;
+
+    std::shared_ptr<const Version> version = getVersion();
+    LevelStats memory = levelStats(0);
+    memory.entries = bufferNums();
+    for (auto &run : version->immutables) memory.entries += run->eltsNums();
+    snap.levels.push_back(memory);
+
+    for (int i = 0; i < static_cast<int>(version->levels.size()); i++) {
+      LevelStats level = levelStats(i + 1);
+      for (auto &ref : version->levels[i]) {
+        RunStats run;
+        run.runID = static_cast<int>(level.runs.size());
+        run.fileID = ref.run->getFileID();
+        run.entries = ref.run->getCapacity();
+        run.fileBytes = ref.run->getFileSize();
+        for (int t = 0; t < NUM_LEVEL_TICKERS; t++) {
+          run.tickers[t] = ref.run->getTicker(static_cast<LevelTicker>(t));
+        }
+        for (int t = 0; t < NUM_LEVEL_TICKERS; t++) {
+          level.tickers[t] += run.tickers[t];
+        }
+        level.entries += run.entries;
+        level.fileBytes += run.fileBytes;
+        level.runs.push_back(run);
+      }
+      snap.levels.push_back(level);
+    }
+    return snap;
+  }
+
+  void printStats() { std::cout << getStats().toString(); }
+
+  // 开启 filter 内存预算模式：disk levels 的 filter 总共使用 totalBits 个 bit，
+  // 按 Monkey 的方式分配到各层，使 zero-result lookup 的期望 I/O 最小。
+  // 传 0 关闭预算模式，所有层恢复成 _bfFalsePositive
+  void setFilterBitsBudget(double totalBits) {
+    mergeLock->lock();
+    _bfBitsBudget = totalBits;
+    if (_bfBitsBudget > 0) {
+      allocateFilterBits();
+    } else {
+      for (auto i = 0; i < _numDiskLevels; i++) {
+        diskLevels[i]->setFalsePositive(_bfFalsePositive);
+      }
+    }
+    updateVersion([this](Version &v) { v.levels = levelSnapshot(); });
+    mergeLock->unlock();
+  }
+
+  // disk runs 的 values 是否用 LZ 压缩，只影响之后写入的 runs。
+  // keys 总是按差值编码
+  void setValueCompression(bool compressValues) {
+    std::lock_guard<std::mutex> lk(*mergeLock);
+    _compressValues = compressValues;
+    for (auto i = 0; i < _numDiskLevels; i++) {
+      diskLevels[i]->setValueCompression(_compressValues);
+    }
+  }
 
-    for (int i = 0; i < diskLevels.size(); i++) {
-      std::cout << "Number of Elements in Disk Level: " << i
-                << "(including deletes): " << diskLevels[i]->eltsNums()
-                << std::endl;
+  // 开启 key-value 分离：flush 时不小于 threshold 字节的 values 追加到
+  // dir/vlog 中，disk runs 只保存指针，之后的归并不再搬运这些 values。
+  // gcIntervalMs > 0 时后台线程每隔这么久调用一次 collectValueLog。
+  // 只支持 std::string 的 values，需要在 open 之前调用，
+  // 之后每次 open 同一个目录都要开启
+  void setValueSeparation(size_t threshold, int gcIntervalMs = 0,
+                          uint64_t maxFileBytes = kDefaultValueLogFileBytes) {
+    static_assert(std::is_same<V, std::string>::value,
+                  "value separation requires std::string values");
+    _valueThreshold = threshold;
+    _valueLogFileBytes = maxFileBytes;
+    if (gcIntervalMs > 0 && !gcThread.joinable()) {
+      gcThread = std::thread(&LSM::gcLoop, this, gcIntervalMs);
     }
-    std::cout << "KEY VALUE DUMP BY LEVEL" << std::endl;
-    printElts();
+  }
+
+  // value log 的 GC。从旧到新找到第一个仍被引用的字节不超过 maxLiveRatio
+  // 的文件，把其中仍被引用的 values 重新写入 LSM，等这些写入 flush 之后
+  // 删除文件。返回回收的字节数，没有这样的文件时返回 0
+  uint64_t collectValueLog(double maxLiveRatio = 0.5) {
+    static_assert(std::is_same<V, std::string>::value,
+                  "value separation requires std::string values");
+    std::lock_guard<std::mutex> gcLk(*gcLock);
+    if (!_vlog) return 0;
+    for (auto &file : _vlog->sealedFiles()) {
+      std::vector<std::pair<ValuePointer, kvPair<K, V>>> live;
+      uint64_t liveBytes = 0;
+      _vlog->scan(*file, [&](K &key, V &value, const ValuePointer &ptr) {
+        if (isValueLive(key, ptr)) {
+          live.emplace_back(ptr, kvPair<K, V>{key, value, false});
+          liveBytes += ptr.size;
+        }
+      });
+      if (liveBytes > maxLiveRatio * file->size()) continue;
+
+      // 文件要等写回的 runs 都 flush 之后才能去掉，没有写回时可以直接去掉
+      uint64_t runSeq = 0;
+      for (auto &r : live) {
+        runSeq = std::max(runSeq,
+                          rewriteValue(r.second.key, r.second.value, r.first));
+      }
+      _vlog->retire(file->id(), runSeq);
+      if (runSeq == 0 && _vlog->releaseRetired(0)) {
+        updateVersion([this](Version &v) { v.valueLogFiles = _vlog->files(); });
+      }
+      // 之前 open 时留下的空文件直接去掉，继续找下一个
+      uint64_t reclaimed = file->size() - liveBytes;
+      if (reclaimed == 0) continue;
+      _stats->add(VALUE_LOG_BYTES_RECLAIMED, reclaimed);
+      return reclaimed;
+    }
+    return 0;
+  }
+
+  // disk runs 改用 pread 按 block 读进 cache，内存占用不超过 cache 的预算。
+  // 需要在 open 和写入之前调用，多个 LSM 可以共用一个 cache
+  void setBlockCache(std::shared_ptr<BlockCache> cache) {
+    std::lock_guard<std::mutex> lk(*mergeLock);
+    _blockCache = std::move(cache);
+    for (auto i = 0; i < _numDiskLevels; i++) {
+      diskLevels[i]->setBlockCache(_blockCache);
+    }
+  }
+
+  // 让 multiGet 和范围查询的预读通过 io 同时提交多个 block 读，
+  // 一般用 IOEngine::create()。需要在 open 和读写之前调用
+  void setIOEngine(std::shared_ptr<IOEngine> io) {
+    std::lock_guard<std::mutex> lk(*mergeLock);
+    _ioEngine = std::move(io);
+    for (auto i = 0; i < _numDiskLevels; i++) {
+      diskLevels[i]->setIOEngine(_ioEngine);
+    }
+  }
+
+  // 默认是 TieringPolicy(diskRunsPerLevel, fracMerged)，也就是每层
+  // diskRunsPerLevel 个 runs，满了之后合并最旧的 fracMerged。
+  // 需要在 open 和写入之前调用
+  void setCompactionPolicy(std::shared_ptr<CompactionPolicy> policy) {
+    std::lock_guard<std::mutex> lk(*mergeLock);
+    _policy = std::move(policy);
+    bool reshaped = false;
+    for (auto i = 0; i < _numDiskLevels; i++) {
+      reshaped |= reshapeLevel(i);
+    }
+    if (reshaped && _bfBitsBudget > 0) {
+      allocateFilterBits();
+    }
+  }
+
+  // disk levels 之间归并时最多用几个线程
+  void setMergeThreads(int mergeThreads) {
+    std::lock_guard<std::mutex> lk(*mergeLock);
+    _mergeThreads = mergeThreads;
+    for (auto i = 0; i < _numDiskLevels; i++) {
+      diskLevels[i]->setMergeThreads(_mergeThreads);
+    }
+  }
+
+  long bufferNums() {
+    std::shared_lock<std::shared_timed_mutex> lk(*c0Lock);
+    long sum = 0;
+    for (auto i = 0; i <= _activeRunIdx.load(); i++) sum += C_0[i]->eltsNums();
+    return sum;
+  }
+
+  long size() {
+    long n = 0;
+    auto it = newIterator();
+    for (it->seekToFirst(); it->valid(); it->next()) n++;
+    return n;
+  }
+
+  static const uint64_t kDefaultValueLogFileBytes = 64 << 20;
+
+ private:
+  // 开启 WAL，dir 中已有的 segments 会先回放到 C_0。只由 open 调用：
+  // flush 之后会删掉已经写进 run 的 segments，没有持久化的 runs 时
+  // 这些写入在重启之后就丢了
+  void enableWAL(const std::string &dir, WalSyncMode mode,
+                 int syncIntervalMs = 0) {
+    wal = new WALType(dir, mode, syncIntervalMs);
+    wal->replay(
+        [this](typename WALType::RecordType type, K &key, V &value) {
+          int idx = _activeRunIdx.load();
+          C_0[idx]->reserveSlot();
+          putToRun(idx, key, value, type == WALType::DELETE);
+        },
+        [this]() { nextRun(); });
+  }
+
+  // 按每层的容量重新计算每层的假阳性率，调用方需持有 mergeLock
+  void allocateFilterBits() {
+    std::vector<long> runSizes;
+    std::vector<int> runNums;
+    for (auto i = 0; i < _numDiskLevels; i++) {
+      runSizes.push_back(diskLevels[i]->_runSize);
+      runNums.push_back(diskLevels[i]->_numRunsPerLevel);
+    }
+
+    std::vector<double> fp =
+        monkeyFalsePositives(runSizes, runNums, _bfBitsBudget);
+    for (auto i = 0; i < _numDiskLevels; i++) {
+      diskLevels[i]->setFalsePositive(fp[i]);
+    }
+  }
+
+  // 查找 key 最新的有效版本。inMemory 表示在 C_0 或者 immutables 中找到，
+  // 否则 value 是 disk runs 中保存的形式，需要用 version 还原
+  bool lookup(const K &key, V &value, bool &inMemory,
+              std::shared_ptr<const Version> &version) {
+    MemFilterCounts counts(*_stats);
+    bool isFound = false, isDeleted = false;
+    inMemory = true;
+    {
+      // 在 C_0 的共享锁内取 version，flush 移走的 runs 要么还在 C_0 中，
+      // 要么已经在 version 的 immutables 中
+      std::shared_lock<std::shared_timed_mutex> lk(*c0Lock);
+      version = getVersion();
+      for (int i = _activeRunIdx.load(); i >= 0; i--) {
+        value = searchMemRun(C_0[i].get(), *filters[i], key, isFound,
+                             isDeleted, counts);
+        if (isFound) {
+          return !isDeleted;
+        }
+      }
+    }
+
+    for (int i = static_cast<int>(version->immutables.size()) - 1; i >= 0;
+         i--) {
+      value = searchMemRun(version->immutables[i].get(),
+                           *version->immFilters[i], key, isFound, isDeleted,
+                           counts);
+      if (isFound) {
+        return !isDeleted;
+      }
+    }
+
+    inMemory = false;
+    for (auto &level : version->levels) {
+      value = DiskLevel<K, V>::searchRuns(level, key, isFound, isDeleted);
+      if (isFound) {
+        return !isDeleted;
+      }
+    }
+    return false;
+  }
+
+  // 开启 value log 时把 disk runs 中保存的 value 还原成用户的 value
+  void resolveStored(const Version &version, V &value) {
+    if (_vlog) {
+      _stats->add(VALUE_LOG_BYTES_READ,
+                  resolveValue<K>(*version.valueLogFiles, value));
+    }
+  }
+
+  // key 最新的版本是不是 disk runs 中指向 ptr 的指针
+  bool isValueLive(const K &key, const ValuePointer &ptr) {
+    std::shared_ptr<const Version> version;
+    V stored;
+    bool inMemory;
+    ValuePointer current;
+    return lookup(key, stored, inMemory, version) && !inMemory &&
+           decodeValuePointer(stored, current) && current == ptr;
+  }
+
+  // GC 把仍然指向 ptr 的 key 重新写入 C_0，返回写入的 run 的序号 + 1，
+  // key 已经有更新的版本时返回 0。写入之前在 c0Lock 的独占锁内确认 C_0 中
+  // 没有这个 key，检查之后并发的写入不会被覆盖；期间有 runs 被 flush 时重新检查
+  uint64_t rewriteValue(K &key, V &value, const ValuePointer &ptr) {
+    while (true) {
+      uint64_t retired;
+      {
+        std::shared_lock<std::shared_timed_mutex> lk(*c0Lock);
+        retired = _retiredRuns;
+      }
+      if (!isValueLive(key, ptr)) {
+        return 0;
+      }
+
+      int idx;
+      {
+        std::unique_lock<std::shared_timed_mutex> lk(*c0Lock);
+        if (_retiredRuns != retired) continue;
+        idx = _activeRunIdx.load();
+        for (int i = 0; i <= idx; i++) {
+          bool isFound = false, isDeleted = false;
+          C_0[i]->search(key, isFound, isDeleted);
+          if (isFound) return 0;
+        }
+        if (C_0[idx]->reserveSlot()) {
+          if (wal) {
+            _stats->add(WAL_BYTES_WRITTEN,
+                        wal->append(_retiredRuns + idx, WALType::PUT, key,
+                                    value));
+          }
+          putToRun(idx, key, value, false);
+          return _retiredRuns + idx + 1;
+        }
+        if (idx + 1 < _numRuns) {
+          _activeRunIdx.store(idx + 1);
+          continue;
+        }
+      }
+      flushRuns(idx, false);
+    }
+  }
+
+  void gcLoop(int intervalMs) {
+    std::unique_lock<std::mutex> lk(*gcLock);
+    while (!_isGCStopping) {
+      gcCv->wait_for(lk, std::chrono::milliseconds(intervalMs));
+      if (_isGCStopping || !_isGCReady) continue;
+      lk.unlock();
+      collectValueLog();
+      lk.lock();
+    }
+  }
+
+  // 在一个内存中的 run 里查找 key。run 可能还在被写入，filter 用原子的探测
+  V searchMemRun(RunType *run, const FilterType &filter, const K &key,
+                 bool &isFound, bool &isDeleted, MemFilterCounts &counts) {
+    KeyView k = KeyTraits::view(key), lo, hi;
+    if (!run->getBounds(lo, hi) || k < lo || k > hi) {
+      return V();
+    }
+    counts.probes++;
+    if (!filter.isContainConcurrent(k)) {
+      counts.negatives++;
+      return V();
+    }
+    V value = run->search(key, isFound, isDeleted);
+    counts.falsePositives += !isFound;
+    return value;
+  }
+
+  // multiGet 在一个内存中的 run 里查找 batch 中的候选
+  void searchMemRun(RunType *run, const FilterType &filter,
+                    LookupBatch<K, V> &batch) {
+    KeyView lo, hi;
+    if (!run->getBounds(lo, hi)) return;
+    // run 可能还在被写入，filter 用原子的探测
+    long probed = batch.probe(filter, lo, hi, true);
+    long passed = batch.candidates.size();
+    if (probed > 0) {
+      _stats->add(0, FILTER_PROBES, probed);
+      _stats->add(0, FILTER_NEGATIVES, probed - passed);
+    }
+    if (passed == 0) return;
+    for (long i : batch.candidates) {
+      batch.values[i] =
+          run->search(batch.keys[i], batch.resolved[i], batch.deleted[i]);
+    }
+    size_t pending = batch.pending.size();
+    batch.removeResolved();
+    _stats->add(0, FILTER_FALSE_POSITIVES,
+                passed - (pending - batch.pending.size()));
+  }
+
+  // 一个 key 和 value 的字节数，墓碑的 value 是 V()
+  static uint64_t entryBytes(const K &key, const V &value) {
+    return KeyTraits::size(KeyTraits::view(key)) +
+           ValueTraits::size(ValueTraits::view(value));
+  }
+
+  // 记录用户写入了 n 个 keys，一共 bytes 个字节，WAL 中占 walBytes 个字节
+  void countWrites(uint64_t n, uint64_t bytes, uint64_t walBytes) {
+    _stats->add(KEYS_WRITTEN, n);
+    _stats->add(USER_BYTES_WRITTEN, bytes);
+    if (wal) {
+      _stats->add(WAL_BYTES_WRITTEN, walBytes);
+    }
+  }
+
+  // diskLevels[i] 每次从上面收到的 run 最多有几个元素
+  long incomingSize(int i) {
+    if (i == 0) return _numToMerge * _eltsPerRun;
+    return diskLevels[i - 1]->_runSize * diskLevels[i - 1]->_mergeSize;
+  }
+
+  // 按 policy 重新确定 diskLevels[i] 的形状，只有空的层会被修改，
+  // 返回是否修改了。调用方需持有 mergeLock
+  bool reshapeLevel(int i) {
+    LevelShape shape =
+        _policy->shape(i + 1, incomingSize(i), i + 1 == _numDiskLevels);
+    if (!diskLevels[i]->isLevelEmpty() || diskLevels[i]->hasShape(shape)) {
+      return false;
+    }
+    diskLevels[i]->reshape(shape);
+    return true;
+  }
+
+  // 在最深处加一层，调用方需持有 mergeLock
+  void addDiskLevel() {
+    DiskLevel<K, V> *last = diskLevels[_numDiskLevels - 1];
+    LevelShape shape =
+        _policy->shape(_numDiskLevels + 1, incomingSize(_numDiskLevels), true);
+    DiskLevel<K, V> *newLevel = new DiskLevel<K, V>(
+        _blockSize, _numDiskLevels + 1, shape.runSize, shape.numRuns,
+        shape.mergeSize, _bfFalsePositive, shape.leveled);
+    newLevel->setValueCompression(_compressValues);
+    newLevel->setBlockCache(_blockCache);
+    newLevel->setIOEngine(_ioEngine);
+    newLevel->setStats(_stats);
+    if (_mergeThreads > 0) {
+      newLevel->setMergeThreads(_mergeThreads);
+    }
+    newLevel->setDirectory(last->_dir);
+    diskLevels.push_back(newLevel);
+    _numDiskLevels++;
+    // 原来的最后一层如果是空的，按新的位置确定形状，否则等它被清空
+    reshapeLevel(_numDiskLevels - 2);
+    if (_bfBitsBudget > 0) {
+      allocateFilterBits();
+    }
+  }
+
+  // 把当前 disk levels 的结构写入 manifest，调用方需持有 mergeLock。
+  // 新的 runs 在写文件时已经 fsync，被替换的 runs 在 version 释放之后才删除
+  void saveManifest() {
+    if (manifest == nullptr) return;
+    std::vector<ManifestLevel> levels;
+    for (auto i = 0; i < _numDiskLevels; i++) {
+      levels.push_back(
+          ManifestLevel{diskLevels[i]->_runSize, diskLevels[i]->getFileIDs()});
+    }
+    manifest->save(levels, DiskRun<K, V>::fileIDCounter().load());
+  }
+
+  // 删除目录中不被 manifest 引用的 run 文件
+  void removeOrphanFiles(const std::string &dir,
+                         const std::vector<ManifestLevel> &levels) {
+    std::vector<uint64_t> live;
+    for (auto &level : levels) {
+      live.insert(live.end(), level.fileIDs.begin(), level.fileIDs.end());
+    }
+    std::sort(live.begin(), live.end());
+
+    DIR *d = opendir(dir.c_str());
+    if (d == nullptr) {
+      perror(("Error opening directory " + dir).c_str());
+      exit(EXIT_FAILURE);
+    }
+    struct dirent *ent;
+    while ((ent = readdir(d)) != nullptr) {
+      int level, len = 0;
+      unsigned long long id;
+      if (sscanf(ent->d_name, "C_%d_%llu.clsm%n", &level, &id, &len) != 2 ||
+          len == 0 || ent->d_name[len] != '\0' ||
+          std::binary_search(live.begin(), live.end(), id)) {
+        continue;
+      }
+      std::string filename = dir + "/" + ent->d_name;
+      if (remove(filename.c_str())) {
+        perror(("Error removing file " + filename).c_str());
+      }
+    }
+    closedir(d);
   }
 
   // 从 disk[level - 1] 中拿到 runs add 到当前 level 
@@ -221,96 +897,296 @@ class LSM {
     bool isLastLevel = false;
 
     if (level == _numDiskLevels) {
-      DiskLevel<K, V> *newLevel = new DiskLevel<K, V>(
-          _blockSize, level + 1,
-          diskLevels[level - 1]->_runSize * diskLevels[level - 1]->_mergeSize,
-          _diskRunsPerLevel, ceil(_diskRunsPerLevel * _fracRunsMerged),
-          _bfFalsePositive);
-      diskLevels.push_back(newLevel);
-      _numDiskLevels++;
+      addDiskLevel();
     }
 
-    if (diskLevels[level]->isLevelFull()) {
+    // 从 disklevel 中得到用于 merge 的 runs [0, _mergeSize)
+    std::vector<std::shared_ptr<DiskRun<K, V>>> runs_to_merge =
+        diskLevels[level - 1]->getRunsToMerge();
+    long incoming = 0;
+    for (auto &run : runs_to_merge) incoming += run->getCapacity();
+
+    if (!diskLevels[level]->canAccept(incoming)) {
       mergeRunsToLevel(level + 1);
     }
 
-    if (level + 1 == _numDiskLevels && diskLevels[level]->isLevelEmpty()) {
+    // leveling 的层会把已有的 run 一起归并，结果就是最后一层的全部数据
+    if (level + 1 == _numDiskLevels &&
+        (diskLevels[level]->isLevelEmpty() || diskLevels[level]->_leveled)) {
       isLastLevel = true;
     }
 
-    // 从 disklevel 中得到用于 merge 的 runs [0, _mergeSize)
-    std::vector<DiskRun<K, V> *> runs_to_merge =
-        diskLevels[level - 1]->getRunsToMerge();
-    long runLen = diskLevels[level - 1]->_runSize;
-    diskLevels[level]->addRuns(runs_to_merge, runLen, isLastLevel);
+    auto start = std::chrono::steady_clock::now();
+    diskLevels[level]->addRuns(runs_to_merge, isLastLevel);
+    countMerge(diskLevels[level]->_level,
+               std::chrono::steady_clock::now() - start);
     diskLevels[level - 1]->freeMergedRuns(runs_to_merge);
+    if (reshapeLevel(level - 1) && _bfBitsBudget > 0) {
+      allocateFilterBits();
+    }
   }
 
-  // merge 的主函数，把 runs merge 到磁盘的最浅层级当中
-  void mergeRuns(std::vector<Run<K, V> *> runs_to_merge,
-                 std::vector<BloomFilter<K> *> bf_to_merge) {
+  // merge 的主函数，把 runs merge 到磁盘的最浅层级当中。
+  // retiredRuns 是这次 merge 之后已经退出 C_0 的 runs 总数
+  void mergeRuns(std::vector<std::shared_ptr<RunType>> runs_to_merge,
+                 uint64_t retiredRuns) {
+    auto start = std::chrono::steady_clock::now();
+    // runs 从旧到新排列，用败者树归并，相同的 key 只保留最新的值
+    int numRuns = static_cast<int>(runs_to_merge.size());
+    LoserTree<KeyView> tree(numRuns);
+    std::vector<typename RunType::Iterator> iters;
+    for (int i = 0; i < numRuns; i++) {
+      iters.emplace_back(runs_to_merge[i]);
+      iters[i].seekToFirst();
+      if (iters[i].valid()) {
+        tree.set(i, iters[i].keyView());
+      }
+    }
+    tree.build();
+
     std::vector<kvPair<K, V>> to_merge = std::vector<kvPair<K, V>>();
     to_merge.reserve(_eltsPerRun * _numToMerge);
-    for (auto i = 0; i < runs_to_merge.size(); i++) {
-      auto all = (runs_to_merge)[i]->getAll();
+    while (!tree.empty()) {
+      int k = tree.top();
+      if (to_merge.empty() ||
+          KeyTraits::view(to_merge.back().key) != iters[k].keyView()) {
+        to_merge.push_back(kvPair<K, V>{iters[k].key(), V(), false});
+      }
+      to_merge.back().value = iters[k].value();
+      to_merge.back().isDeleted = iters[k].isDeleted();
 
-      to_merge.insert(to_merge.begin(), all.begin(), all.end());
-      delete (runs_to_merge)[i];
-      delete (bf_to_merge)[i];
+      iters[k].next();
+      if (iters[k].valid()) {
+        tree.set(k, iters[k].keyView());
+      } else {
+        tree.setEnd(k);
+      }
+      tree.replay();
     }
 
-    sort(to_merge.begin(), to_merge.end());
+    // 大的 values 写到 value log，指针写进 run 之前先落盘
+    if (_vlog) {
+      _stats->add(VALUE_LOG_BYTES_WRITTEN,
+                  separateValues(*_vlog, to_merge.data(), to_merge.size(),
+                                 _valueThreshold));
+      _vlog->sync();
+    }
+
+    // 下面各层之间的归并各自计时，不算在这次 flush 里
+    auto elapsed = std::chrono::steady_clock::now() - start;
     mergeLock->lock();
-    if (diskLevels[0]->isLevelFull()) {
+    if (!diskLevels[0]->canAccept(to_merge.size())) {
       mergeRunsToLevel(1);
     }
-    diskLevels[0]->addRunByArray(&to_merge[0], to_merge.size());
+    // 和 mergeRunsToLevel 一样，写入之后第一层就是全部的 disk 数据时丢掉墓碑
+    bool isLastLevel =
+        _numDiskLevels == 1 &&
+        (diskLevels[0]->isLevelEmpty() || diskLevels[0]->_leveled);
+    start = std::chrono::steady_clock::now();
+    diskLevels[0]->addRunByArray(to_merge.data(), to_merge.size(),
+                                 isLastLevel);
+    countMerge(1, elapsed + (std::chrono::steady_clock::now() - start));
+    // open 之后 addRunByArray 写完文件就已经 fdatasync，失败时直接退出，
+    // manifest 只会引用已经落盘的 run
+    saveManifest();
+    if (wal && manifest) {
+      // 新的 run 写进 manifest 之后这些 runs 对应的 WAL segments
+      // 就不再需要了；归并结果为空时没有新的 run，同样不再需要
+      wal->releaseSegmentsBefore(retiredRuns);
+    }
+
+    // GC 写回的 values 已经落盘，等待删除的 value log 文件可以去掉了
+    if (_vlog) {
+      _vlog->releaseRetired(retiredRuns);
+    }
+
+    // 新写入的 run 和它替换掉的 immutable runs 在同一个 version 中切换
+    size_t flushed = runs_to_merge.size();
+    updateVersion([&](Version &v) {
+      v.immutables.erase(v.immutables.begin(),
+                         v.immutables.begin() + flushed);
+      v.immFilters.erase(v.immFilters.begin(),
+                         v.immFilters.begin() + flushed);
+      v.levels = levelSnapshot();
+      if (_vlog) v.valueLogFiles = _vlog->files();
+    });
     mergeLock->unlock();
   }
 
-  // 从 memory 向 disk merge
-  // mergeruns 是 C_0 [0, _numToMerge)
-  void doMerge() {
-    if (_numToMerge == 0) return;
-    std::vector<Run<K, V> *> runs_to_merge = std::vector<Run<K, V> *>();
-    std::vector<BloomFilter<K> *> bf_to_merge = std::vector<BloomFilter<K> *>();
-    for (auto i = 0; i < _numToMerge; i++) {
-      runs_to_merge.push_back(C_0[i]);
-      bf_to_merge.push_back(filters[i]);
+  void countMerge(int level, std::chrono::steady_clock::duration elapsed) {
+    auto micros =
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed);
+    _stats->add(level, MERGES);
+    _stats->add(level, MERGE_MICROS, micros.count());
+  }
+
+  LevelStats levelStats(int level) {
+    LevelStats stats;
+    stats.level = level;
+    stats.entries = 0;
+    stats.fileBytes = 0;
+    for (int t = 0; t < NUM_LEVEL_TICKERS; t++) {
+      stats.tickers[t] = _stats->get(level, static_cast<LevelTicker>(t));
+    }
+    return stats;
+  }
+
+  // 当前的 version，读者拿到之后不需要再持有任何锁
+  std::shared_ptr<const Version> getVersion() {
+    std::lock_guard<std::mutex> lk(*versionLock);
+    return _version;
+  }
+
+  // 复制当前 version，修改后替换，正在读旧 version 的读者不受影响
+  template <class Fn>
+  void updateVersion(Fn fn) {
+    std::lock_guard<std::mutex> lk(*versionLock);
+    auto next = std::make_shared<Version>(*_version);
+    fn(*next);
+    _version = next;
+  }
+
+  // 各层已经写完的 runs，调用方需持有 mergeLock
+  std::vector<std::vector<DiskRunRef<K, V>>> levelSnapshot() {
+    std::vector<std::vector<DiskRunRef<K, V>>> levels;
+    for (auto i = 0; i < _numDiskLevels; i++) {
+      levels.push_back(diskLevels[i]->getActiveRuns());
+    }
+    return levels;
+  }
+
+  // 多个写者可以并发调用。先在 active run 中预留位置，预留失败说明 run 已满，
+  // 用 CAS 把 _activeRunIdx 切换到下一个 run；最后一个 run 也满了就 flush。
+  void putKey(typename WALType::RecordType type, K &key, V &value) {
+    while (true) {
+      int idx;
+      {
+        std::shared_lock<std::shared_timed_mutex> lk(*c0Lock);
+        idx = _activeRunIdx.load();
+        if (C_0[idx]->reserveSlot()) {
+          size_t walBytes = 0;
+          if (wal) {
+            walBytes = wal->append(_retiredRuns + idx, type, key, value);
+          }
+          putToRun(idx, key, value, type == WALType::DELETE);
+          countWrites(1, entryBytes(key, value), walBytes);
+          return;
+        }
+
+        if (idx + 1 < _numRuns) {
+          _activeRunIdx.compare_exchange_strong(idx, idx + 1);
+          continue;
+        }
+      }
+      flushRuns(idx, false);
     }
+  }
 
+  void putBatch(typename WriteBatch<K, V>::Entry *entries, size_t n) {
+    std::vector<typename WALType::RecordType> types(n);
+    std::vector<K> keys(n);
+    std::vector<V> values(n);
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < n; i++) {
+      types[i] = static_cast<typename WALType::RecordType>(entries[i].type);
+      keys[i] = entries[i].key;
+      bool isDelete = entries[i].type == WriteBatch<K, V>::DELETE;
+      values[i] = isDelete ? V() : entries[i].value;
+      bytes += entryBytes(keys[i], values[i]);
+    }
+
+    while (true) {
+      int idx;
+      {
+        std::shared_lock<std::shared_timed_mutex> lk(*c0Lock);
+        idx = _activeRunIdx.load();
+        if (C_0[idx]->reserveSlots(n)) {
+          size_t walBytes = 0;
+          if (wal) {
+            walBytes = wal->appendBatch(_retiredRuns + idx, types.data(),
+                                        keys.data(), values.data(), n);
+          }
+          typename RunType::Splice splice;
+          for (size_t i = 0; i < n; i++) {
+            KeyView key = KeyTraits::view(keys[i]);
+            C_0[idx]->insertEntry(key, ValueTraits::view(values[i]),
+                                  types[i] == WALType::DELETE, splice);
+            filters[idx]->addConcurrent(key);
+          }
+          countWrites(n, bytes, walBytes);
+          return;
+        }
+
+        if (idx + 1 < _numRuns) {
+          _activeRunIdx.compare_exchange_strong(idx, idx + 1);
+          continue;
+        }
+      }
+      flushRuns(idx, false);
+    }
+  }
+
+  void putToRun(int idx, K &key, V &value, bool isDeleted) {
+    typename RunType::Splice splice;
+    C_0[idx]->insertEntry(KeyTraits::view(key), ValueTraits::view(value),
+                          isDeleted, splice);
+    filters[idx]->addConcurrent(KeyTraits::view(key));
+  }
+
+  // 回放 WAL 时切换到下一个 run
+  void nextRun() {
+    int idx = _activeRunIdx.load();
+    if (idx + 1 < _numRuns) {
+      _activeRunIdx.store(idx + 1);
+    } else {
+      flushRuns(idx, true);
+    }
+  }
+
+  // C_0 的最后一个 run 满了，把最老的 runs 交给 merge 线程。
+  // idx 是调用方看到的已满的 active run，已经被别的写者 flush 过就直接返回。
+  // 上一次 merge 还没结束时在这里等待，这期间不持有 c0Lock，读者不受影响
+  void flushRuns(int idx, bool force) {
+    std::lock_guard<std::mutex> flushLk(*flushLock);
     if (mergeThread.joinable()) {
       mergeThread.join();
     }
 
+    std::unique_lock<std::shared_timed_mutex> lk(*c0Lock);
+    if (_activeRunIdx.load() != idx || (!force && !C_0[idx]->isFull())) {
+      return;
+    }
+    doMerge();
+  }
+
+  // 从 memory 向 disk merge，调用方持有 c0Lock 的独占锁且上一次 merge 已经结束
+  // mergeruns 是 C_0 [0, _numToMerge)，移到 version 的 immutables 中继续供读者查找
+  void doMerge() {
+    if (_numToMerge == 0) return;
+    std::vector<std::shared_ptr<RunType>> runs_to_merge(
+        C_0.begin(), C_0.begin() + _numToMerge);
+    updateVersion([&](Version &v) {
+      v.immutables.insert(v.immutables.end(), C_0.begin(),
+                          C_0.begin() + _numToMerge);
+      v.immFilters.insert(v.immFilters.end(), filters.begin(),
+                          filters.begin() + _numToMerge);
+    });
+
+    _retiredRuns += _numToMerge;
     mergeThread =
-        std::thread(&LSM::mergeRuns, this, runs_to_merge, bf_to_merge);
+        std::thread(&LSM::mergeRuns, this, runs_to_merge, _retiredRuns);
 
     C_0.erase(C_0.begin(), C_0.begin() + _numToMerge);
     filters.erase(filters.begin(), filters.begin() + _numToMerge);
 
-    _activeRunIdx -= _numToMerge;
-    for (auto i = _activeRunIdx; i < _numRuns; i++) {
-      RunType *run = new RunType(INT32_MIN, INT32_MAX);
+    for (auto i = C_0.size(); i < static_cast<size_t>(_numRuns); i++) {
+      auto run = std::make_shared<RunType>();
       run->setSize(_eltsPerRun);
       C_0.push_back(run);
-
-      BloomFilter<K> *bf = new BloomFilter<K>(_eltsPerRun, _bfFalsePositive);
-      filters.push_back(bf);
+      filters.push_back(
+          std::make_shared<FilterType>(_eltsPerRun, _bfFalsePositive));
     }
-  }
-
-  long bufferNums() {
-    if (mergeThread.joinable()) mergeThread.join();
-    long sum = 0;
-    for (auto i = 0; i <= _activeRunIdx; i++) sum += C_0[i]->eltsNums();
-    return sum;
-  }
-
-  long size() {
-    K min = INT_MIN, max = INT_MAX;
-    auto r = range(min, max);
-    return r.size();
+    _activeRunIdx.store(_numRuns - _numToMerge);
   }
 };
 
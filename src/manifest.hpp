@@ -0,0 +1,127 @@
+#ifndef LSMTREE_MANIFEST_HPP
+#define LSMTREE_MANIFEST_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// disk level 在 manifest 中的记录
+struct ManifestLevel {
+  long runSize;                   // 每个 run 的最大元素个数，用来校验参数
+  std::vector<uint64_t> fileIDs;  // 已经写完的 runs，从旧到新
+};
+
+// 记录 disk levels 的结构和下一个可用的文件编号。run 自己的 min/max key、
+// block index 和 filter 保存在 run 文件末尾，打开时只需要读这些元数据。
+// 每次更新先写临时文件并 fsync，再 rename 覆盖，崩溃后看到的要么是旧的
+// manifest 要么是新的。文本格式:
+//   clsm-manifest 1
+//   next-file-id <id>
+//   levels <n>
+//   <runSize> <runs> <fileID>...    每层一行
+class Manifest {
+ public:
+  explicit Manifest(const std::string &dir)
+      : _dir(dir),
+        _filename(dir + "/MANIFEST"),
+        _tmpFilename(dir + "/MANIFEST.tmp") {}
+
+  // 目录中没有 manifest 时返回 false
+  bool load(std::vector<ManifestLevel> &levels, uint64_t &nextFileID) {
+    FILE *f = fopen(_filename.c_str(), "r");
+    if (f == nullptr) {
+      return false;
+    }
+
+    int version, numLevels;
+    unsigned long long next;
+    if (fscanf(f, "clsm-manifest %d next-file-id %llu levels %d", &version,
+               &next, &numLevels) != 3 ||
+        version != kVersion || numLevels < 0) {
+      corrupted();
+    }
+    nextFileID = next;
+
+    levels.clear();
+    for (int i = 0; i < numLevels; i++) {
+      ManifestLevel level;
+      int numRuns;
+      if (fscanf(f, "%ld %d", &level.runSize, &numRuns) != 2 || numRuns < 0) {
+        corrupted();
+      }
+      for (int j = 0; j < numRuns; j++) {
+        unsigned long long id;
+        if (fscanf(f, "%llu", &id) != 1) {
+          corrupted();
+        }
+        level.fileIDs.push_back(id);
+      }
+      levels.push_back(level);
+    }
+
+    fclose(f);
+    return true;
+  }
+
+  void save(const std::vector<ManifestLevel> &levels, uint64_t nextFileID) {
+    FILE *f = fopen(_tmpFilename.c_str(), "w");
+    if (f == nullptr) {
+      perror(("Error opening manifest " + _tmpFilename).c_str());
+      exit(EXIT_FAILURE);
+    }
+
+    fprintf(f, "clsm-manifest %d\nnext-file-id %llu\nlevels %d\n", kVersion,
+            static_cast<unsigned long long>(nextFileID),
+            static_cast<int>(levels.size()));
+    for (auto &level : levels) {
+      fprintf(f, "%ld %d", level.runSize,
+              static_cast<int>(level.fileIDs.size()));
+      for (auto id : level.fileIDs) {
+        fprintf(f, " %llu", static_cast<unsigned long long>(id));
+      }
+      fprintf(f, "\n");
+    }
+
+    if (fflush(f) != 0 || fdatasync(fileno(f)) == -1) {
+      perror(("Error writing manifest " + _tmpFilename).c_str());
+      exit(EXIT_FAILURE);
+    }
+    fclose(f);
+
+    if (rename(_tmpFilename.c_str(), _filename.c_str())) {
+      perror(("Error renaming manifest " + _tmpFilename).c_str());
+      exit(EXIT_FAILURE);
+    }
+    syncDir(_dir);
+  }
+
+  // 目录 fsync 之后其中新建和 rename 的文件才持久。WAL 新建 segment
+  // 也用它。失败时这些文件可能在掉电后丢失，直接退出
+  static void syncDir(const std::string &dir) {
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd == -1 || fsync(fd) == -1) {
+      perror(("Error syncing directory " + dir).c_str());
+      exit(EXIT_FAILURE);
+    }
+    close(fd);
+  }
+
+ private:
+  static const int kVersion = 1;
+
+  std::string _dir;
+  std::string _filename;
+  std::string _tmpFilename;
+
+  void corrupted() {
+    fprintf(stderr, "Corrupted manifest %s\n", _filename.c_str());
+    exit(EXIT_FAILURE);
+  }
+};
+
+#endif  // LSMTREE_MANIFEST_HPP
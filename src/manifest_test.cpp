@@ -0,0 +1,83 @@
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "lsm.hpp"
+#include "manifest.hpp"
+#include "test_util.hpp"
+
+// 写入的 levels 和 next-file-id 能原样读回来
+void testSaveAndLoad() {
+  TempDir tmp;
+  Manifest manifest(tmp.path());
+  std::vector<ManifestLevel> levels;
+  uint64_t nextFileID = 0;
+  CHECK(!manifest.load(levels, nextFileID));
+
+  levels = {ManifestLevel{1000, {7, 9}}, ManifestLevel{4000, {}},
+            ManifestLevel{16000, {3}}};
+  manifest.save(levels, 12);
+  levels.push_back(ManifestLevel{1, {1}});  // 下面的 load 要清掉已有的内容
+
+  std::vector<ManifestLevel> loaded;
+  CHECK(Manifest(tmp.path()).load(loaded, nextFileID));
+  CHECK(nextFileID == 12);
+  CHECK(loaded.size() == 3);
+  CHECK(loaded[0].runSize == 1000 &&
+        loaded[0].fileIDs == std::vector<uint64_t>({7, 9}));
+  CHECK(loaded[1].runSize == 4000 && loaded[1].fileIDs.empty());
+  CHECK(loaded[2].runSize == 16000 &&
+        loaded[2].fileIDs == std::vector<uint64_t>({3}));
+}
+
+const int kKeySpace = 5000;
+
+bool fileExists(const std::string &filename) {
+  struct stat st;
+  return stat(filename.c_str(), &st) == 0;
+}
+
+// 重新打开目录时按 manifest 恢复 disk levels，C_0 由 WAL 恢复，
+// 不在 manifest 中的 run 文件被删掉。再写入之后还能再次打开
+void testReopen(bool leveling) {
+  TempDir tmp;
+  std::string dir = tmp.file("db");
+  std::map<int, int> ref;
+  size_t diskLevels;
+  {
+    auto lsm = openLSM(dir, leveling);
+    writeRandom(*lsm, ref, 30000, 1, kKeySpace);
+    checkContents(*lsm, ref, kKeySpace);
+    diskLevels = lsm->getStats().levels.size();
+  }
+  CHECK(diskLevels > 2);  // level 0 是内存中的 runs
+
+  std::string orphan = dir + "/C_1_999999.clsm";
+  FILE *f = fopen(orphan.c_str(), "w");
+  CHECK(f != nullptr);
+  fclose(f);
+
+  {
+    auto lsm = openLSM(dir, leveling);
+    CHECK(!fileExists(orphan));
+    CHECK(lsm->getStats().levels.size() == diskLevels);
+    checkContents(*lsm, ref, kKeySpace);
+    writeRandom(*lsm, ref, 10000, 2, kKeySpace);
+  }
+
+  auto lsm = openLSM(dir, leveling);
+  checkContents(*lsm, ref, kKeySpace);
+}
+
+void testReopenTiering() { testReopen(false); }
+void testReopenLeveling() { testReopen(true); }
+
+int main() {
+  RUN_TEST(testSaveAndLoad);
+  RUN_TEST(testReopenTiering);
+  RUN_TEST(testReopenLeveling);
+  return 0;
+}
@@ -3,11 +3,14 @@
 
 #include <vector>
 
+// isDeleted 为 true 的是墓碑，value 没有意义。墓碑用这个标记表示，
+// 不占用 value 的任何取值
 template <typename K, typename V>
 class kvPair {
  public:
   K key;
   V value;
+  bool isDeleted = false;
   bool operator==(kvPair kv) const {
     return kv.key == key && kv.value == value;
   }
@@ -26,7 +29,8 @@ class Run {
   virtual K getMax() = 0;
   virtual void insertKey(const K &key, const V &value) = 0;
   virtual void deleteKey(const K &key) = 0;
-  virtual V search(const K &key, bool &isFound) = 0;
+  // 找到时 isFound 为 true，找到的是墓碑时 isDeleted 也为 true
+  virtual V search(const K &key, bool &isFound, bool &isDeleted) = 0;
   virtual long long eltsNums() = 0;
   virtual void setSize(const long size) = 0;
   virtual std::vector<kvPair<K, V>> getAll() = 0;
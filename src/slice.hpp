@@ -0,0 +1,131 @@
+#ifndef LSMTREE_SLICE_HPP
+#define LSMTREE_SLICE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <type_traits>
+
+// 一段字节的视图，不持有内存，指向 arena 或者 block 中的数据。
+// 按无符号字节序比较，是另一个的前缀时短的在前，和 std::string 的顺序一致
+class Slice {
+ public:
+  Slice() : _data(""), _size(0) {}
+  Slice(const char *data, size_t size) : _data(data), _size(size) {}
+  Slice(const std::string &s) : _data(s.data()), _size(s.size()) {}
+
+  const char *data() const { return _data; }
+  size_t size() const { return _size; }
+  std::string toString() const { return std::string(_data, _size); }
+
+  int compare(const Slice &other) const {
+    size_t n = _size < other._size ? _size : other._size;
+    int r = n == 0 ? 0 : memcmp(_data, other._data, n);
+    if (r == 0) {
+      r = _size < other._size ? -1 : (_size > other._size ? 1 : 0);
+    }
+    return r;
+  }
+
+  // 定义成友元，和 std::string 比较时两边都可以隐式转换
+  friend bool operator==(const Slice &a, const Slice &b) {
+    return a._size == b._size &&
+           (a._size == 0 || memcmp(a._data, b._data, a._size) == 0);
+  }
+  friend bool operator!=(const Slice &a, const Slice &b) { return !(a == b); }
+  friend bool operator<(const Slice &a, const Slice &b) {
+    return a.compare(b) < 0;
+  }
+  friend bool operator>(const Slice &a, const Slice &b) {
+    return a.compare(b) > 0;
+  }
+  friend bool operator<=(const Slice &a, const Slice &b) {
+    return a.compare(b) <= 0;
+  }
+  friend bool operator>=(const Slice &a, const Slice &b) {
+    return a.compare(b) >= 0;
+  }
+  friend std::ostream &operator<<(std::ostream &out, const Slice &s) {
+    return out.write(s._data, s._size);
+  }
+
+ private:
+  const char *_data;
+  size_t _size;
+};
+
+// K 和 V 在 LSM 内部的表示。定长的类型（整数、浮点数和其他可以按字节
+// 复制的类型）按原样存储；std::string 是变长的字节串，在 arena 和 block 中
+// 就地用 Slice 访问，只有返回给用户时才构造 std::string。
+// View 是查找和归并时比较用的形式，data / size 是计算 hash 和统计用的字节
+template <class T, class Enable = void>
+struct SliceTraits {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "keys and values must be trivially copyable or std::string");
+  static const bool kFixedSize = true;
+  typedef T View;
+
+  static const View &view(const T &v) { return v; }
+  static T fromView(const View &v) { return v; }
+  static const char *data(const View &v) {
+    return reinterpret_cast<const char *>(&v);
+  }
+  static size_t size(const View &) { return sizeof(T); }
+
+  // 放进 arena 时 View 之外还要几个字节，copy 把 v 的内容复制到 dst 中
+  static size_t extraBytes(const View &) { return 0; }
+  static View copy(const View &v, char *) { return v; }
+
+  // WAL 和 run 文件中的编码，原样存放
+  static size_t encodedSize(const View &) { return sizeof(T); }
+  static void encode(std::string &out, const View &v) {
+    out.append(data(v), sizeof(T));
+  }
+  // 越界时返回 nullptr
+  static const char *decode(const char *p, const char *limit, T &v) {
+    if (limit - p < static_cast<long>(sizeof(T))) return nullptr;
+    memcpy(&v, p, sizeof(T));
+    return p + sizeof(T);
+  }
+};
+
+// 编码成 4 字节的长度加上内容
+template <>
+struct SliceTraits<std::string> {
+  static const bool kFixedSize = false;
+  typedef Slice View;
+
+  static View view(const std::string &v) { return Slice(v); }
+  static std::string fromView(const View &v) { return v.toString(); }
+  static const char *data(const View &v) { return v.data(); }
+  static size_t size(const View &v) { return v.size(); }
+
+  static size_t extraBytes(const View &v) { return v.size(); }
+  static View copy(const View &v, char *dst) {
+    if (v.size() > 0) memcpy(dst, v.data(), v.size());
+    return Slice(dst, v.size());
+  }
+
+  static size_t encodedSize(const View &v) {
+    return sizeof(uint32_t) + v.size();
+  }
+  static void encode(std::string &out, const View &v) {
+    uint32_t len = static_cast<uint32_t>(v.size());
+    out.append(reinterpret_cast<const char *>(&len), sizeof(len));
+    out.append(v.data(), v.size());
+  }
+  static const char *decode(const char *p, const char *limit,
+                            std::string &v) {
+    uint32_t len;
+    if (limit - p < static_cast<long>(sizeof(len))) return nullptr;
+    memcpy(&len, p, sizeof(len));
+    p += sizeof(len);
+    if (static_cast<size_t>(limit - p) < len) return nullptr;
+    v.assign(p, len);
+    return p + len;
+  }
+};
+
+#endif  // LSMTREE_SLICE_HPP
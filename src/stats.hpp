@@ -0,0 +1,261 @@
+#ifndef LSMTREE_STATS_HPP
+#define LSMTREE_STATS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// 每个 level 和每个 run 各自统计的计数
+enum LevelTicker {
+  FILTER_PROBES,           // 用 filter 测试过的 keys
+  FILTER_NEGATIVES,        // filter 判定不存在的 keys
+  FILTER_FALSE_POSITIVES,  // filter 通过但是 run 中没有的 keys
+  FENCE_SEARCHES,          // fence pointers 上的查找
+  BYTES_READ,              // 查询从 run 文件读的 block 字节数，cache 命中不算
+  COMPACTION_BYTES_READ,   // 归并从 run 文件读的 block 字节数
+  BYTES_WRITTEN,           // 写入 run 文件的字节数
+  MERGES,                  // 归并进本层的次数，第 1 层包括 C_0 的 flush
+  MERGE_MICROS,            // 这些归并的总耗时
+  NUM_LEVEL_TICKERS
+};
+
+// 整个 LSM 的计数
+enum EngineTicker {
+  KEYS_WRITTEN,        // insertKey、deleteKey 和 write 写入的 keys
+  USER_BYTES_WRITTEN,  // 这些 keys 和 values 的字节数
+  WAL_BYTES_WRITTEN,
+  POINT_LOOKUPS,       // search 和 multiGet 查找的 keys
+  RANGE_SCANS,
+  USER_BYTES_READ,     // search、multiGet 和 range 返回的 keys 和 values 的字节数
+  VALUE_LOG_BYTES_WRITTEN,    // flush 时分离到 value log 的字节数
+  VALUE_LOG_BYTES_READ,       // 查询从 value log 读的字节数
+  VALUE_LOG_BYTES_RECLAIMED,  // GC 删除的 value log 中的无效字节数
+  NUM_ENGINE_TICKERS
+};
+
+const char *const kLevelTickerNames[NUM_LEVEL_TICKERS] = {
+    "filter_probes", "filter_negatives", "filter_false_positives",
+    "fence_searches", "bytes_read", "compaction_bytes_read",
+    "bytes_written", "merges", "merge_micros"};
+
+const char *const kEngineTickerNames[NUM_ENGINE_TICKERS] = {
+    "keys_written", "user_bytes_written", "wal_bytes_written",
+    "point_lookups", "range_scans", "user_bytes_read",
+    "value_log_bytes_written", "value_log_bytes_read",
+    "value_log_bytes_reclaimed"};
+
+const int kStatsSlots = 32;
+
+// 每个线程独占一个 slot，线程退出时归还。同时存在的线程多于
+// kStatsSlots 个时，多出来的线程和别的线程共用 slot
+class StatsSlots {
+ public:
+  static int acquire() {
+    std::lock_guard<std::mutex> lk(lock());
+    std::vector<int> &slots = freeSlots();
+    if (slots.empty()) {
+      static int shared = 0;
+      return shared++ % kStatsSlots;
+    }
+    int slot = slots.back();
+    slots.pop_back();
+    return slot;
+  }
+
+  static void release(int slot) {
+    std::lock_guard<std::mutex> lk(lock());
+    freeSlots().push_back(slot);
+  }
+
+ private:
+  static std::mutex &lock() {
+    static std::mutex mu;
+    return mu;
+  }
+
+  static std::vector<int> &freeSlots() {
+    static std::vector<int> slots = []() {
+      std::vector<int> all;
+      for (int i = kStatsSlots - 1; i >= 0; i--) all.push_back(i);
+      return all;
+    }();
+    return slots;
+  }
+};
+
+// 当前线程的 slot。热路径上只读一个 thread_local 的 int，
+// 第一次调用时才分配，并注册线程退出时的归还
+inline int statsThreadSlot() {
+  struct Slot {
+    int id;
+    Slot() : id(StatsSlots::acquire()) {}
+    ~Slot() { StatsSlots::release(id); }
+  };
+  static thread_local int id = -1;
+  if (id < 0) {
+    static thread_local Slot slot;
+    id = slot.id;
+  }
+  return id;
+}
+
+// N 个按线程分片的计数器。每个线程写自己 slot 中的计数，slot 之间隔开
+// 一个 cache line，热路径上的 fetch_add 不和别的线程争用 cache line；
+// 线程多于 kStatsSlots 个时共用 slot 的线程也不会丢失更新。
+// 读的时候把所有 slots 加起来，不阻塞写者，得到的是近似的瞬时值
+template <int N>
+class ThreadCounters {
+ public:
+  ThreadCounters() : _slots(new Slot[kStatsSlots]()) {}
+
+  void add(int i, uint64_t n) {
+    _slots[statsThreadSlot()].v[i].fetch_add(n, std::memory_order_relaxed);
+  }
+
+  uint64_t get(int i) const {
+    uint64_t sum = 0;
+    for (int s = 0; s < kStatsSlots; s++) {
+      sum += _slots[s].v[i].load(std::memory_order_relaxed);
+    }
+    return sum;
+  }
+
+ private:
+  struct Slot {
+    std::atomic<uint64_t> v[N];
+    char pad[64];
+  };
+  std::unique_ptr<Slot[]> _slots;
+};
+
+// LSM 的计数，level 0 是内存中的 runs (C_0 和 immutables)，
+// disk levels 从 1 开始，更深的层都记在 kMaxLevels - 1 上
+class EngineStats {
+ public:
+  static const int kMaxLevels = 32;
+
+  void add(int level, LevelTicker t, uint64_t n = 1) {
+    _levels.add(clampLevel(level) * NUM_LEVEL_TICKERS + t, n);
+  }
+  void add(EngineTicker t, uint64_t n = 1) { _engine.add(t, n); }
+
+  uint64_t get(int level, LevelTicker t) const {
+    return _levels.get(clampLevel(level) * NUM_LEVEL_TICKERS + t);
+  }
+  uint64_t get(EngineTicker t) const { return _engine.get(t); }
+
+ private:
+  ThreadCounters<kMaxLevels * NUM_LEVEL_TICKERS> _levels;
+  ThreadCounters<NUM_ENGINE_TICKERS> _engine;
+
+  static int clampLevel(int level) {
+    return level < 0 ? 0 : (level >= kMaxLevels ? kMaxLevels - 1 : level);
+  }
+};
+
+// getStats 返回的快照
+struct RunStats {
+  int runID;
+  uint64_t fileID;
+  long entries;  // 包括墓碑
+  size_t fileBytes;
+  uint64_t tickers[NUM_LEVEL_TICKERS];
+};
+
+struct LevelStats {
+  int level;      // 0 是内存中的 runs
+  long entries;   // 包括墓碑和被覆盖的旧值
+  size_t fileBytes;
+  uint64_t tickers[NUM_LEVEL_TICKERS];  // 本层历史上的累计值
+  std::vector<RunStats> runs;           // 当前的 disk runs
+
+  // 本层 run 文件写入的字节数 / 用户写入的字节数。各层之和加上 WAL 和
+  // value log 就是整体的写放大
+  double writeAmplification(uint64_t userBytesWritten) const {
+    return userBytesWritten == 0
+               ? 0
+               : double(tickers[BYTES_WRITTEN]) / userBytesWritten;
+  }
+
+  // 查询从本层 run 文件读的字节数 / 返回给用户的字节数
+  double readAmplification(uint64_t userBytesRead) const {
+    return userBytesRead == 0 ? 0
+                              : double(tickers[BYTES_READ]) / userBytesRead;
+  }
+};
+
+struct StatsSnapshot {
+  uint64_t tickers[NUM_ENGINE_TICKERS];
+  uint64_t cacheHits;
+  uint64_t cacheMisses;
+  size_t cacheUsage;
+  std::vector<LevelStats> levels;
+
+  uint64_t levelTotal(LevelTicker t) const {
+    uint64_t sum = 0;
+    for (auto &level : levels) sum += level.tickers[t];
+    return sum;
+  }
+
+  // WAL、value log 和所有 run 文件写入的字节数 / 用户写入的字节数
+  double writeAmplification() const {
+    uint64_t user = tickers[USER_BYTES_WRITTEN];
+    return user == 0 ? 0
+                     : double(tickers[WAL_BYTES_WRITTEN] +
+                              tickers[VALUE_LOG_BYTES_WRITTEN] +
+                              levelTotal(BYTES_WRITTEN)) / user;
+  }
+
+  // 查询从 run 文件和 value log 读的字节数 / 返回给用户的字节数
+  double readAmplification() const {
+    uint64_t user = tickers[USER_BYTES_READ];
+    return user == 0 ? 0
+                     : double(levelTotal(BYTES_READ) +
+                              tickers[VALUE_LOG_BYTES_READ]) / user;
+  }
+
+  // 每行一个 "名字 值"，方便监控直接抓取
+  std::string toString() const {
+    std::ostringstream out;
+    for (int t = 0; t < NUM_ENGINE_TICKERS; t++) {
+      out << "lsm." << kEngineTickerNames[t] << " " << tickers[t] << "\n";
+    }
+    out << "lsm.write_amplification " << writeAmplification() << "\n";
+    out << "lsm.read_amplification " << readAmplification() << "\n";
+    out << "lsm.block_cache.hits " << cacheHits << "\n";
+    out << "lsm.block_cache.misses " << cacheMisses << "\n";
+    out << "lsm.block_cache.usage " << cacheUsage << "\n";
+    for (auto &level : levels) {
+      std::string prefix = "lsm.level." + std::to_string(level.level) + ".";
+      out << prefix << "runs " << level.runs.size() << "\n";
+      out << prefix << "entries " << level.entries << "\n";
+      out << prefix << "file_bytes " << level.fileBytes << "\n";
+      out << prefix << "write_amplification "
+          << level.writeAmplification(tickers[USER_BYTES_WRITTEN]) << "\n";
+      out << prefix << "read_amplification "
+          << level.readAmplification(tickers[USER_BYTES_READ]) << "\n";
+      for (int t = 0; t < NUM_LEVEL_TICKERS; t++) {
+        out << prefix << kLevelTickerNames[t] << " " << level.tickers[t]
+            << "\n";
+      }
+      for (auto &run : level.runs) {
+        std::string runPrefix = prefix + "run." + std::to_string(run.runID) +
+                                ".";
+        out << runPrefix << "file_id " << run.fileID << "\n";
+        out << runPrefix << "entries " << run.entries << "\n";
+        out << runPrefix << "file_bytes " << run.fileBytes << "\n";
+        for (int t = 0; t < MERGES; t++) {
+          out << runPrefix << kLevelTickerNames[t] << " " << run.tickers[t]
+              << "\n";
+        }
+      }
+    }
+    return out.str();
+  }
+};
+
+#endif  // LSMTREE_STATS_HPP
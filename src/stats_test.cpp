@@ -0,0 +1,143 @@
+#include <thread>
+#include <vector>
+
+#include "lsm.hpp"
+#include "test_util.hpp"
+
+// int 的 key 和 value 各占 4 字节，WAL 的每条记录另有校验和与类型
+const uint64_t kEntryBytes = 2 * sizeof(int);
+const uint64_t kRecordBytes =
+    WriteAheadLog<int, int>::kHeaderSize + kEntryBytes;
+
+// 等 merge 线程把 immutable runs 写到 disk：内存中只剩 C_0 的元素
+void waitForMerges(TestLSM &lsm) {
+  while (lsm.getStats().levels[0].entries != lsm.bufferNums()) {
+    std::this_thread::yield();
+  }
+}
+
+// 只写入不重复的 keys，所有元素都留在某一层。每次 flush 把 C_0 的一半
+// (400 个元素) 写成第 1 层的一个 run，这些 runs 的文件一样大；更深的层
+// 每次归并写出一个 run，最深的层还没有被归并走，写入的字节数就是它
+// 现在的文件大小
+void testWriteCounters() {
+  TempDir tmp;
+  auto lsm = openLSM(tmp.path(), false);
+  const int n = 5000;
+  for (int key = 0; key < n; key++) {
+    int value = key * 2;
+    lsm->insertKey(key, value);
+  }
+  waitForMerges(*lsm);
+
+  StatsSnapshot stats = lsm->getStats();
+  CHECK(stats.tickers[KEYS_WRITTEN] == n);
+  CHECK(stats.tickers[USER_BYTES_WRITTEN] == n * kEntryBytes);
+  CHECK(stats.tickers[WAL_BYTES_WRITTEN] == n * kRecordBytes);
+  CHECK(stats.levels.size() >= 3);
+
+  long entries = 0;
+  uint64_t runBytes = 0;
+  for (auto &level : stats.levels) {
+    entries += level.entries;
+    runBytes += level.tickers[BYTES_WRITTEN];
+    CHECK(level.tickers[BYTES_WRITTEN] >= level.fileBytes);
+    double amp = double(level.tickers[BYTES_WRITTEN]) / (n * kEntryBytes);
+    CHECK(level.writeAmplification(n * kEntryBytes) == amp);
+  }
+  CHECK(entries == n);
+
+  const LevelStats &memory = stats.levels[0];
+  CHECK(memory.tickers[MERGES] == 0);
+  CHECK(memory.tickers[BYTES_WRITTEN] == 0);
+
+  const LevelStats &first = stats.levels[1];
+  uint64_t flushes = (n - memory.entries) / 400;
+  CHECK(first.tickers[MERGES] == flushes);
+  CHECK(!first.runs.empty());
+  for (auto &run : first.runs) {
+    CHECK(run.entries == 400);
+    CHECK(run.fileBytes == first.runs[0].fileBytes);
+  }
+  CHECK(first.tickers[BYTES_WRITTEN] == flushes * first.runs[0].fileBytes);
+
+  const LevelStats &last = stats.levels.back();
+  CHECK(last.tickers[MERGES] == last.runs.size());
+  CHECK(last.tickers[BYTES_WRITTEN] == last.fileBytes);
+  for (size_t i = 2; i < stats.levels.size(); i++) {
+    CHECK(stats.levels[i].tickers[MERGES] > 0);
+    CHECK(stats.levels[i].tickers[MERGE_MICROS] > 0);
+  }
+
+  double total = double(n * kRecordBytes + runBytes) / (n * kEntryBytes);
+  CHECK(stats.writeAmplification() == total);
+}
+
+// 删除和 WriteBatch 各自的计数，都还在 C_0 中
+void testUpdateCounters() {
+  TempDir tmp;
+  auto lsm = openLSM(tmp.path(), false);
+  for (int key = 0; key < 10; key++) {
+    int value = key;
+    lsm->insertKey(key, value);
+  }
+  for (int key = 0; key < 5; key++) lsm->deleteKey(key);
+
+  WriteBatch<int, int> batch;
+  for (int key = 10; key < 30; key++) batch.insertKey(key, key);
+  batch.deleteKey(5);
+  CHECK(lsm->write(batch));
+
+  StatsSnapshot stats = lsm->getStats();
+  uint64_t keys = 10 + 5 + 21;
+  CHECK(stats.tickers[KEYS_WRITTEN] == keys);
+  CHECK(stats.tickers[USER_BYTES_WRITTEN] == keys * kEntryBytes);
+  CHECK(stats.tickers[WAL_BYTES_WRITTEN] == keys * kRecordBytes);
+  CHECK(stats.levels.size() == 2);
+  CHECK(stats.levels[1].tickers[MERGES] == 0);
+  CHECK(stats.levels[1].tickers[BYTES_WRITTEN] == 0);
+  CHECK(stats.writeAmplification() == double(kRecordBytes) / kEntryBytes);
+}
+
+// 查找和范围查询的次数，以及返回给用户的字节数。被删除的 key
+// 不返回字节
+void testReadCounters() {
+  TempDir tmp;
+  auto lsm = openLSM(tmp.path(), false);
+  const int n = 2000;
+  for (int key = 0; key < n; key++) {
+    int value = key;
+    lsm->insertKey(key, value);
+  }
+  for (int key = 0; key < n; key += 2) lsm->deleteKey(key);
+  waitForMerges(*lsm);
+
+  uint64_t lookups = 0, bytes = 0;
+  for (int key = 0; key < n + 100; key++) {
+    int value;
+    if (lsm->search(key, value)) bytes += kEntryBytes;
+    lookups++;
+  }
+  int keys[] = {1, 2, 3, n + 1}, values[4];
+  bool found[4];
+  lsm->multiGet(keys, 4, values, found);
+  lookups += 4;
+  bytes += 2 * kEntryBytes;
+
+  int k1 = 100, k2 = 200;
+  CHECK(lsm->range(k1, k2).size() == 50);
+  bytes += 50 * kEntryBytes;
+
+  StatsSnapshot stats = lsm->getStats();
+  CHECK(stats.tickers[POINT_LOOKUPS] == lookups);
+  CHECK(stats.tickers[RANGE_SCANS] == 1);
+  CHECK(stats.tickers[USER_BYTES_READ] == bytes);
+  CHECK(bytes == (n / 2 + 2 + 50) * kEntryBytes);
+}
+
+int main() {
+  RUN_TEST(testWriteCounters);
+  RUN_TEST(testUpdateCounters);
+  RUN_TEST(testReadCounters);
+  return 0;
+}
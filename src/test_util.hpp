@@ -0,0 +1,152 @@
+#ifndef LSMTREE_TEST_UTIL_HPP
+#define LSMTREE_TEST_UTIL_HPP
+
+#include <dirent.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "lsm.hpp"
+
+// 测试用的断言，NDEBUG 下也会检查，失败时打印位置并退出
+#define CHECK(cond)                                                    \
+  do {                                                                 \
+    if (!(cond)) {                                                     \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, \
+              #cond);                                                  \
+      exit(EXIT_FAILURE);                                              \
+    }                                                                  \
+  } while (0)
+
+// 运行一个测试函数，通过时打印它的名字
+#define RUN_TEST(fn)            \
+  do {                          \
+    fn();                       \
+    printf("%s passed\n", #fn); \
+  } while (0)
+
+// 测试用的临时目录，析构时连同里面的文件一起删除
+class TempDir {
+ public:
+  TempDir() {
+    char name[] = "/tmp/lsmtree_test_XXXXXX";
+    if (mkdtemp(name) == nullptr) {
+      perror("Error creating temporary directory");
+      exit(EXIT_FAILURE);
+    }
+    _path = name;
+  }
+
+  ~TempDir() { nftw(_path.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS); }
+
+  TempDir(const TempDir &) = delete;
+  TempDir &operator=(const TempDir &) = delete;
+
+  const std::string &path() const { return _path; }
+  std::string file(const std::string &name) const { return _path + "/" + name; }
+
+ private:
+  std::string _path;
+
+  static int removeEntry(const char *path, const struct stat *, int,
+                         struct FTW *) {
+    return remove(path);
+  }
+};
+
+// dir 中编号最大的 WAL segment，也就是最后写入的那个
+inline std::string newestSegment(const std::string &dir) {
+  DIR *d = opendir(dir.c_str());
+  CHECK(d != nullptr);
+  std::string newest;
+  long newestID = -1;
+  struct dirent *ent;
+  while ((ent = readdir(d)) != nullptr) {
+    long id;
+    if (sscanf(ent->d_name, "wal_%ld.log", &id) == 1 && id > newestID) {
+      newestID = id;
+      newest = dir + "/" + ent->d_name;
+    }
+  }
+  closedir(d);
+  CHECK(newestID >= 0);
+  return newest;
+}
+
+// 模拟崩溃时写了一半的 record：去掉文件末尾的 n 个字节
+inline void chopTail(const std::string &filename, off_t n) {
+  struct stat st;
+  CHECK(stat(filename.c_str(), &st) == 0);
+  CHECK(st.st_size >= n);
+  CHECK(truncate(filename.c_str(), st.st_size - n) == 0);
+}
+
+typedef LSM<int, int> TestLSM;
+
+// 在 dir 中打开一个 runs 很小的 LSM，写几万个 keys 就会有好几层 disk levels
+inline std::unique_ptr<TestLSM> openLSM(const std::string &dir,
+                                        bool leveling) {
+  std::unique_ptr<TestLSM> lsm(new TestLSM(200, 4, 0.5, 0.01, 16, 3));
+  if (leveling) lsm->setCompactionPolicy(std::make_shared<LevelingPolicy>(3));
+  lsm->open(dir, WalSyncMode::NONE);
+  return lsm;
+}
+
+// 随机写入 n 次，keys 在 [0, keySpace) 中，其中 deletePercent% 是删除。
+// ref 记录期望的内容
+inline void writeRandom(TestLSM &lsm, std::map<int, int> &ref, int n,
+                        int seed, int keySpace, int deletePercent = 10) {
+  std::mt19937 rng(seed);
+  for (int i = 0; i < n; i++) {
+    int op = rng() % 100, key = rng() % keySpace;
+    if (op < deletePercent) {
+      lsm.deleteKey(key);
+      ref.erase(key);
+    } else {
+      int value = seed * 1000000 + i;
+      lsm.insertKey(key, value);
+      ref[key] = value;
+    }
+  }
+}
+
+// search、multiGet 和 range 在 [0, keySpace) 中读到的都是 ref
+inline void checkContents(TestLSM &lsm, const std::map<int, int> &ref,
+                          int keySpace) {
+  std::vector<int> keys;
+  for (int key = 0; key < keySpace; key++) {
+    int value;
+    auto it = ref.find(key);
+    CHECK(lsm.search(key, value) == (it != ref.end()));
+    if (it != ref.end()) CHECK(value == it->second);
+    keys.push_back(keySpace - 1 - key);
+  }
+
+  std::vector<int> values(keys.size());
+  std::unique_ptr<bool[]> found(new bool[keys.size()]);
+  lsm.multiGet(keys.data(), keys.size(), values.data(), found.get());
+  for (size_t i = 0; i < keys.size(); i++) {
+    auto it = ref.find(keys[i]);
+    CHECK(found[i] == (it != ref.end()));
+    if (it != ref.end()) CHECK(values[i] == it->second);
+  }
+
+  int lo = 0, hi = keySpace;
+  std::vector<kvPair<int, int>> all = lsm.range(lo, hi);
+  CHECK(all.size() == ref.size());
+  auto it = ref.begin();
+  for (auto &kv : all) {
+    CHECK(kv.key == it->first && kv.value == it->second);
+    ++it;
+  }
+}
+
+#endif  // LSMTREE_TEST_UTIL_HPP
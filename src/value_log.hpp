@@ -0,0 +1,426 @@
+#ifndef LSMTREE_VALUE_LOG_HPP
+#define LSMTREE_VALUE_LOG_HPP
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "iterator.hpp"
+#include "murmur3.hpp"
+#include "run.hpp"
+#include "slice.hpp"
+
+// value log 中一条 record 的位置
+struct ValuePointer {
+  uint64_t fileID;
+  uint64_t offset;
+  uint32_t size;
+
+  bool operator==(const ValuePointer &other) const {
+    return fileID == other.fileID && offset == other.offset &&
+           size == other.size;
+  }
+};
+
+// value log 的一个文件，只有最新的文件会追加。被 GC 之后 markObsolete，
+// 引用它的 version 都释放之后删除
+class ValueLogFile {
+ public:
+  ValueLogFile(const std::string &filename, uint64_t id)
+      : _filename(filename), _id(id), _isObsolete(false) {
+    _fd = open(_filename.c_str(), O_RDWR | O_CREAT, (mode_t)0600);
+    struct stat st;
+    if (_fd == -1 || fstat(_fd, &st) == -1) {
+      perror(("Error opening value log " + _filename).c_str());
+      exit(EXIT_FAILURE);
+    }
+    _size = st.st_size;
+  }
+
+  ~ValueLogFile() {
+    close(_fd);
+    if (_isObsolete && remove(_filename.c_str())) {
+      perror(("Error removing value log " + _filename).c_str());
+    }
+  }
+
+  uint64_t id() const { return _id; }
+  uint64_t size() const { return _size.load(std::memory_order_acquire); }
+
+  // 写入 len 个字节，返回起始偏移。只有一个写者
+  uint64_t append(const char *data, size_t len) {
+    uint64_t offset = size();
+    for (size_t done = 0; done < len;) {
+      ssize_t ret = pwrite(_fd, data + done, len - done, offset + done);
+      if (ret == -1) {
+        if (errno == EINTR) continue;
+        perror(("Error writing value log " + _filename).c_str());
+        exit(EXIT_FAILURE);
+      }
+      done += ret;
+    }
+    _size.store(offset + len, std::memory_order_release);
+    return offset;
+  }
+
+  void readAt(uint64_t offset, char *dst, size_t len) const {
+    for (size_t done = 0; done < len;) {
+      ssize_t ret = pread(_fd, dst + done, len - done, offset + done);
+      if (ret <= 0) {
+        if (ret == -1 && errno == EINTR) continue;
+        perror(("Error reading value log " + _filename).c_str());
+        exit(EXIT_FAILURE);
+      }
+      done += ret;
+    }
+  }
+
+  // disk runs 中的指针在这之后才写入，刷盘失败时不能继续，直接退出
+  void sync() {
+    if (fdatasync(_fd) == -1) {
+      perror(("Error syncing value log " + _filename).c_str());
+      exit(EXIT_FAILURE);
+    }
+  }
+  void markObsolete() { _isObsolete = true; }
+
+ private:
+  std::string _filename;
+  uint64_t _id;
+  int _fd;
+  std::atomic<uint64_t> _size;
+  std::atomic<bool> _isObsolete;
+};
+
+// 按编号排列的 value log 文件，读者通过 version 持有一份快照
+typedef std::map<uint64_t, std::shared_ptr<ValueLogFile>> ValueLogFileSet;
+
+// disk runs 中 value 的第一个字节：后面是 value 本身，或者是 ValuePointer
+const char kInlineValue = 0;
+const char kPointerValue = 1;
+
+// WiscKey 风格的 key-value 分离。flush 时不小于阈值的 values 追加到 value log，
+// disk runs 中只保存指针，之后各层之间的归并只搬运指针。
+// record 格式: checksum(4) | key | value，按 SliceTraits 编码，GC 扫描文件时
+// 用 key 到 LSM 中确认 record 是否还被引用。文件名是 vlog_<id>.log
+template <class K>
+class ValueLog {
+ public:
+  ValueLog(const std::string &dir, uint64_t maxFileBytes)
+      : _dir(dir), _maxFileBytes(maxFileBytes), _nextFileID(0) {
+    if (mkdir(_dir.c_str(), 0700) == -1 && errno != EEXIST) {
+      perror(("Error creating directory " + _dir).c_str());
+      exit(EXIT_FAILURE);
+    }
+
+    auto files = std::make_shared<ValueLogFileSet>();
+    for (uint64_t id : scanFiles()) {
+      (*files)[id] = std::make_shared<ValueLogFile>(fileName(id), id);
+      _nextFileID = id + 1;
+    }
+    _files = files;
+    rotate();
+  }
+
+  // 当前的文件集合，GC 去掉的文件在之前的快照中仍然可以读
+  std::shared_ptr<const ValueLogFileSet> files() {
+    std::lock_guard<std::mutex> lk(_mu);
+    return _files;
+  }
+
+  static void encodeRecord(std::string &out, const K &key,
+                           const std::string &value) {
+    size_t start = out.size();
+    out.append(sizeof(uint32_t), '\0');
+    SliceTraits<K>::encode(out, SliceTraits<K>::view(key));
+    SliceTraits<std::string>::encode(out, value);
+    uint32_t checksum;
+    MurmurHash3_x86_32(out.data() + start + sizeof(uint32_t),
+                       static_cast<int>(out.size() - start - sizeof(uint32_t)),
+                       0, &checksum);
+    memcpy(&out[start], &checksum, sizeof(uint32_t));
+  }
+
+  // 把 encodeRecord 拼好的一批 records 写入当前文件，返回第一条的位置。
+  // 当前文件超过 maxFileBytes 时先换一个新文件
+  ValuePointer append(const std::string &records) {
+    std::lock_guard<std::mutex> lk(_mu);
+    if (_head->size() >= _maxFileBytes) {
+      rotate();
+    }
+    uint64_t offset = _head->append(records.data(), records.size());
+    return ValuePointer{_head->id(), offset, 0};
+  }
+
+  void sync() {
+    std::lock_guard<std::mutex> lk(_mu);
+    _head->sync();
+  }
+
+  // 读出 ptr 指向的 record 中的 value
+  static void read(const ValueLogFileSet &files, const ValuePointer &ptr,
+                   std::string &value) {
+    auto it = files.find(ptr.fileID);
+    if (it == files.end()) {
+      fprintf(stderr, "Missing value log file %llu\n",
+              static_cast<unsigned long long>(ptr.fileID));
+      exit(EXIT_FAILURE);
+    }
+    static thread_local std::string buf;
+    buf.resize(ptr.size);
+    it->second->readAt(ptr.offset, &buf[0], ptr.size);
+    K key;
+    if (decodeRecord(buf.data(), buf.data() + buf.size(), key, value) !=
+        buf.data() + buf.size()) {
+      fprintf(stderr, "Corrupted value log record at %llu:%llu\n",
+              static_cast<unsigned long long>(ptr.fileID),
+              static_cast<unsigned long long>(ptr.offset));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // 可以 GC 的文件：不是正在写的文件，也没有在等待删除，从旧到新
+  std::vector<std::shared_ptr<ValueLogFile>> sealedFiles() {
+    std::lock_guard<std::mutex> lk(_mu);
+    std::vector<std::shared_ptr<ValueLogFile>> sealed;
+    for (auto &entry : *_files) {
+      if (entry.second != _head && _retired.count(entry.first) == 0) {
+        sealed.push_back(entry.second);
+      }
+    }
+    return sealed;
+  }
+
+  // 依次对文件中的 records 调用 fn(key, value, ptr)。
+  // 读到不完整或者校验失败的 record 时停止，它之后的内容没有被引用
+  template <class Fn>
+  void scan(const ValueLogFile &file, Fn fn) {
+    std::string data(file.size(), '\0');
+    file.readAt(0, &data[0], data.size());
+    const char *p = data.data(), *limit = data.data() + data.size();
+    K key;
+    std::string value;
+    while (p < limit) {
+      const char *end = decodeRecord(p, limit, key, value);
+      if (end == nullptr) break;
+      fn(key, value,
+         ValuePointer{file.id(), static_cast<uint64_t>(p - data.data()),
+                      static_cast<uint32_t>(end - p)});
+      p = end;
+    }
+  }
+
+  // GC 之后文件中还被引用的 values 已经写回 LSM，序号小于 runSeq 的
+  // runs 都 flush 之后才能从文件集合中去掉
+  void retire(uint64_t id, uint64_t runSeq) {
+    std::lock_guard<std::mutex> lk(_mu);
+    _retired[id] = runSeq;
+  }
+
+  // 去掉 runSeq 不超过 retiredRuns 的文件，返回文件集合是否有变化
+  bool releaseRetired(uint64_t retiredRuns) {
+    std::lock_guard<std::mutex> lk(_mu);
+    auto files = std::make_shared<ValueLogFileSet>(*_files);
+    bool changed = false;
+    for (auto it = _retired.begin(); it != _retired.end();) {
+      if (it->second > retiredRuns) {
+        ++it;
+        continue;
+      }
+      auto file = files->find(it->first);
+      file->second->markObsolete();
+      files->erase(file);
+      it = _retired.erase(it);
+      changed = true;
+    }
+    if (changed) {
+      _files = files;
+    }
+    return changed;
+  }
+
+ private:
+  std::string _dir;
+  uint64_t _maxFileBytes;
+  uint64_t _nextFileID;
+  std::shared_ptr<ValueLogFile> _head;            // 正在追加的文件
+  std::shared_ptr<const ValueLogFileSet> _files;  // 包括 _head
+  std::map<uint64_t, uint64_t> _retired;          // 等待删除的文件和 runSeq
+  std::mutex _mu;
+
+  std::string fileName(uint64_t id) {
+    return _dir + "/vlog_" + std::to_string(id) + ".log";
+  }
+
+  std::vector<uint64_t> scanFiles() {
+    DIR *d = opendir(_dir.c_str());
+    if (d == nullptr) {
+      perror(("Error opening value log directory " + _dir).c_str());
+      exit(EXIT_FAILURE);
+    }
+
+    std::vector<uint64_t> ids;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != nullptr) {
+      unsigned long long id;
+      char tail;
+      if (sscanf(ent->d_name, "vlog_%llu.lo%c", &id, &tail) == 2 &&
+          tail == 'g') {
+        ids.push_back(id);
+      }
+    }
+    closedir(d);
+    std::sort(ids.begin(), ids.end());
+    return ids;
+  }
+
+  // 换一个新的文件追加，调用方持有 _mu 或者在构造函数中
+  void rotate() {
+    uint64_t id = _nextFileID++;
+    _head = std::make_shared<ValueLogFile>(fileName(id), id);
+    auto files = std::make_shared<ValueLogFileSet>(*_files);
+    (*files)[id] = _head;
+    _files = files;
+  }
+
+  // 返回 record 的结尾，越界或者校验失败时返回 nullptr
+  static const char *decodeRecord(const char *p, const char *limit, K &key,
+                                  std::string &value) {
+    if (limit - p < static_cast<long>(sizeof(uint32_t))) return nullptr;
+    const char *end = SliceTraits<K>::decode(p + sizeof(uint32_t), limit, key);
+    if (end != nullptr) {
+      end = SliceTraits<std::string>::decode(end, limit, value);
+    }
+    if (end == nullptr) return nullptr;
+
+    uint32_t checksum, expected;
+    memcpy(&expected, p, sizeof(uint32_t));
+    MurmurHash3_x86_32(p + sizeof(uint32_t),
+                       static_cast<int>(end - p - sizeof(uint32_t)), 0,
+                       &checksum);
+    return checksum == expected ? end : nullptr;
+  }
+};
+
+// 指针在 disk runs 中的编码: kPointerValue | fileID(8) | offset(8) | size(4)
+const size_t kEncodedPointerSize = 1 + 8 + 8 + 4;
+
+inline void encodeValuePointer(const ValuePointer &ptr, std::string &out) {
+  out.assign(1, kPointerValue);
+  out.append(reinterpret_cast<const char *>(&ptr.fileID), 8);
+  out.append(reinterpret_cast<const char *>(&ptr.offset), 8);
+  out.append(reinterpret_cast<const char *>(&ptr.size), 4);
+}
+
+// disk runs 中保存的 value 是否指向 value log
+inline bool decodeValuePointer(const std::string &stored, ValuePointer &ptr) {
+  if (stored.size() != kEncodedPointerSize || stored[0] != kPointerValue) {
+    return false;
+  }
+  memcpy(&ptr.fileID, stored.data() + 1, 8);
+  memcpy(&ptr.offset, stored.data() + 9, 8);
+  memcpy(&ptr.size, stored.data() + 17, 4);
+  return true;
+}
+
+template <class V>
+bool decodeValuePointer(const V &, ValuePointer &) {
+  return false;
+}
+
+// flush 时把 kvs 中不小于 threshold 的 values 写到 log，换成指针，其余的
+// 加上 kInlineValue 标记。返回写入 log 的字节数。
+// 只有 std::string 的 values 会分离，其他类型不会开启 value log
+template <class K>
+uint64_t separateValues(ValueLog<K> &log, kvPair<K, std::string> *kvs, long n,
+                        size_t threshold) {
+  std::string records;
+  std::vector<std::pair<long, uint64_t>> separated;  // 下标和 record 的偏移
+  for (long i = 0; i < n; i++) {
+    if (kvs[i].isDeleted) continue;
+    if (kvs[i].value.size() < threshold) {
+      kvs[i].value.insert(kvs[i].value.begin(), kInlineValue);
+      continue;
+    }
+    separated.emplace_back(i, records.size());
+    ValueLog<K>::encodeRecord(records, kvs[i].key, kvs[i].value);
+  }
+  if (separated.empty()) return 0;
+
+  ValuePointer base = log.append(records);
+  for (size_t j = 0; j < separated.size(); j++) {
+    uint64_t end = j + 1 < separated.size() ? separated[j + 1].second
+                                            : records.size();
+    ValuePointer ptr{base.fileID, base.offset + separated[j].second,
+                     static_cast<uint32_t>(end - separated[j].second)};
+    encodeValuePointer(ptr, kvs[separated[j].first].value);
+  }
+  return records.size();
+}
+
+template <class K, class V>
+uint64_t separateValues(ValueLog<K> &, kvPair<K, V> *, long, size_t) {
+  return 0;
+}
+
+// 把 disk runs 中保存的 value 还原成用户的 value，返回从 log 读的字节数
+template <class K>
+uint64_t resolveValue(const ValueLogFileSet &files, std::string &value) {
+  ValuePointer ptr;
+  if (decodeValuePointer(value, ptr)) {
+    ValueLog<K>::read(files, ptr, value);
+    return ptr.size;
+  }
+  if (!value.empty()) {
+    value.erase(value.begin());
+  }
+  return 0;
+}
+
+template <class K, class V>
+uint64_t resolveValue(const ValueLogFileSet &, V &) {
+  return 0;
+}
+
+// disk run 的迭代器，value() 返回还原之后的 value。
+// 持有创建时的文件集合，迭代期间被 GC 的文件仍然可以读
+template <class K, class V>
+class ValueLogIterator : public KVIterator<K, V> {
+ public:
+  ValueLogIterator(std::unique_ptr<KVIterator<K, V>> child,
+                   std::shared_ptr<const ValueLogFileSet> files)
+      : _child(std::move(child)), _files(std::move(files)) {}
+
+  bool valid() { return _child->valid(); }
+  void seekToFirst() { _child->seekToFirst(); }
+  void seek(const K &key) { _child->seek(key); }
+  void next() { _child->next(); }
+  K key() { return _child->key(); }
+  V value() {
+    V value = _child->value();
+    resolveValue<K>(*_files, value);
+    return value;
+  }
+  bool isDeleted() { return _child->isDeleted(); }
+
+ private:
+  std::unique_ptr<KVIterator<K, V>> _child;
+  std::shared_ptr<const ValueLogFileSet> _files;
+};
+
+#endif  // LSMTREE_VALUE_LOG_HPP
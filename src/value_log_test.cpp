@@ -0,0 +1,154 @@
+#include <dirent.h>
+
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "lsm.hpp"
+#include "test_util.hpp"
+
+typedef LSM<std::string, std::string> StringLSM;
+
+const int kKeySpace = 2000;
+
+std::string keyOf(int i) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "k%05d", i);
+  return buf;
+}
+
+// 大的 values 分离到 value log，小的留在 run 中
+std::string valueOf(int round, int i) {
+  std::string v = std::to_string(round) + ":" + std::to_string(i) + ":";
+  return i % 5 == 0 ? v : v + std::string(100 + i % 37, 'a' + round % 26);
+}
+
+std::unique_ptr<StringLSM> openStringLSM(const std::string &dir) {
+  std::unique_ptr<StringLSM> lsm(new StringLSM(200, 4, 0.5, 0.01, 16, 3));
+  lsm->setValueSeparation(32, 0, 32 << 10);
+  lsm->open(dir, WalSyncMode::NONE);
+  return lsm;
+}
+
+// 每个 key 写入一轮新的 value，其中 1/8 删除
+void writeRound(StringLSM &lsm, std::map<std::string, std::string> &ref,
+                int round) {
+  std::mt19937 rng(round);
+  for (int i = 0; i < kKeySpace; i++) {
+    std::string key = keyOf(i);
+    if (rng() % 8 == 0) {
+      lsm.deleteKey(key);
+      ref.erase(key);
+    } else {
+      std::string value = valueOf(round, i);
+      lsm.insertKey(key, value);
+      ref[key] = value;
+    }
+  }
+}
+
+void checkContents(StringLSM &lsm,
+                   const std::map<std::string, std::string> &ref) {
+  for (int i = 0; i < kKeySpace; i++) {
+    std::string key = keyOf(i), value;
+    auto it = ref.find(key);
+    CHECK(lsm.search(key, value) == (it != ref.end()));
+    if (it != ref.end()) CHECK(value == it->second);
+  }
+  std::string lo = keyOf(0), hi = keyOf(kKeySpace);
+  auto all = lsm.range(lo, hi);
+  CHECK(all.size() == ref.size());
+  auto it = ref.begin();
+  for (auto &kv : all) {
+    CHECK(kv.key == it->first && kv.value == it->second);
+    ++it;
+  }
+}
+
+long countLogFiles(const std::string &dir) {
+  DIR *d = opendir(dir.c_str());
+  CHECK(d != nullptr);
+  long n = 0;
+  struct dirent *ent;
+  while ((ent = readdir(d)) != nullptr) {
+    n += std::string(ent->d_name).compare(0, 5, "vlog_") == 0;
+  }
+  closedir(d);
+  return n;
+}
+
+// 多轮覆盖之后旧的 value log 文件大部分是无效的 values。GC 把仍然有效的
+// values 重新写入，等它们 flush 之后删除文件。GC 前后和重新打开之后
+// 读到的都是最新的 values，删除的 keys 不会因为旧的 values 被写回而复活
+void testCollectRewritesLiveValues() {
+  TempDir tmp;
+  std::string dir = tmp.file("db");
+  std::map<std::string, std::string> ref;
+  long filesBefore;
+  {
+    auto lsm = openStringLSM(dir);
+    for (int round = 1; round <= 4; round++) writeRound(*lsm, ref, round);
+    checkContents(*lsm, ref);
+    filesBefore = countLogFiles(dir + "/vlog");
+    CHECK(filesBefore > 2);
+
+    uint64_t reclaimed = 0, n;
+    while ((n = lsm->collectValueLog(0.9)) > 0) {
+      reclaimed += n;
+      checkContents(*lsm, ref);
+    }
+    CHECK(reclaimed > 0);
+    CHECK(lsm->getStats().tickers[VALUE_LOG_BYTES_RECLAIMED] == reclaimed);
+
+    // GC 写回的 values 之后被覆盖或者删除，读到的是更新的版本
+    for (int i = 0; i < kKeySpace; i += 3) {
+      std::string key = keyOf(i);
+      if (i % 2) {
+        lsm->deleteKey(key);
+        ref.erase(key);
+      } else {
+        std::string value = valueOf(99, i);
+        lsm->insertKey(key, value);
+        ref[key] = value;
+      }
+    }
+    checkContents(*lsm, ref);
+
+    // 新的写入把 GC 写回的 runs 推到 disk levels，之后被 GC 的文件才会删除
+    writeRound(*lsm, ref, 5);
+    while (lsm->collectValueLog(0.9) > 0) {
+    }
+    checkContents(*lsm, ref);
+  }
+
+  auto lsm = openStringLSM(dir);
+  checkContents(*lsm, ref);
+  CHECK(countLogFiles(dir + "/vlog") < filesBefore);
+}
+
+// 没有无效 values 的 value log 不需要 GC
+void testNothingToCollect() {
+  TempDir tmp;
+  auto lsm = openStringLSM(tmp.file("db"));
+  std::map<std::string, std::string> ref;
+  for (int i = 0; i < kKeySpace; i++) {
+    std::string key = keyOf(i), value = valueOf(1, i);
+    lsm->insertKey(key, value);
+    ref[key] = value;
+  }
+  for (int i = 0; i < 1000; i++) {
+    std::string key = keyOf(kKeySpace + i), value = valueOf(2, i);
+    lsm->insertKey(key, value);
+  }
+  CHECK(lsm->collectValueLog(0.5) == 0);
+  checkContents(*lsm, ref);
+}
+
+int main() {
+  RUN_TEST(testCollectRewritesLiveValues);
+  RUN_TEST(testNothingToCollect);
+  return 0;
+}
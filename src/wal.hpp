@@ -0,0 +1,448 @@
+#ifndef LSMTREE_WAL_HPP
+#define LSMTREE_WAL_HPP
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "manifest.hpp"
+#include "murmur3.hpp"
+#include "slice.hpp"
+
+// WAL 的刷盘方式
+enum class WalSyncMode {
+  NONE,          // 只 write 到 page cache，进程崩溃不丢，机器掉电可能丢
+  INTERVAL,      // 后台线程每 syncIntervalMs 毫秒 fdatasync 一次
+  GROUP_COMMIT,  // 每次写入都等到落盘，并发的写者共享同一次 fdatasync
+};
+
+// 追加写的 write-ahead log。每个 segment 对应 C_0 中的一个 run，append 时
+// 带上 record 所在 run 的序号，序号变大时切换到新的 segment，中间跳过的
+// runs 也各自有一个 segment。切换之前在旧 run 中预留了位置的写者仍然写进
+// 旧 run 的 segment，回放时 record 落在写入时的同一个 run 中，不会排到更新
+// 的写入之后，也不会超过 run 的大小。runs 被 merge 到 diskLevels[0]
+// 并落盘后按序号删掉更老的 segments。
+// record 格式: checksum(4) | type(1) | key | value，key 和 value 按
+// SliceTraits 编码，定长的原样存放，变长的带上长度。checksum 校验失败或者
+// 读到不完整的 record 时认为是崩溃时写了一半的尾部，回放到此为止。
+// 一个 batch 的 records 一次写入，除了最后一条都在 type 上带 kBatchContinues，
+// 回放时凑齐整个 batch 才应用，尾部不完整的 batch 整个丢掉。
+template <class K, class V>
+class WriteAheadLog {
+ public:
+  enum RecordType : uint8_t { PUT = 0, DELETE = 1 };
+  static const uint8_t kBatchContinues = 0x80;
+
+  static const size_t kHeaderSize = sizeof(uint32_t) + 1;  // checksum | type
+
+  WriteAheadLog(const std::string &dir, WalSyncMode mode, int syncIntervalMs)
+      : _dir(dir),
+        _mode(mode),
+        _syncIntervalMs(syncIntervalMs),
+        _nextSegmentID(0),
+        _curRunSeq(0),
+        _nextLsn(0),
+        _syncedLsn(0),
+        _fd(-1),
+        _isLeaderActive(false),
+        _isStopping(false) {
+    mkdir(_dir.c_str(), 0700);
+    scanSegments();
+    if (_segments.empty()) {
+      openSegment(_nextSegmentID++);
+    } else {
+      // 恢复出来的 segments 依次对应 run 0, 1, ...，回放后接着写最后一个
+      _curRunSeq = _segments.size() - 1;
+      openForAppend(_segments.back().id);
+    }
+
+    if (_mode == WalSyncMode::INTERVAL && _syncIntervalMs > 0) {
+      _syncThread = std::thread(&WriteAheadLog::syncLoop, this);
+    }
+  }
+
+  ~WriteAheadLog() {
+    if (_syncThread.joinable()) {
+      {
+        std::lock_guard<std::mutex> lk(_mu);
+        _isStopping = true;
+      }
+      _cv.notify_all();
+      _syncThread.join();
+    }
+
+    std::unique_lock<std::mutex> lk(_mu);
+    waitForLeader(lk);
+    flushPending(true);
+    for (auto &seg : _segments) {
+      if (seg.fd != -1) close(seg.fd);
+    }
+  }
+
+  // 追加一条 record 到序号为 runSeq 的 run 对应的 segment，
+  // 按照 sync mode 返回时保证相应的持久性。返回写入的字节数
+  size_t append(uint64_t runSeq, RecordType type, const K &key,
+                const V &value) {
+    static thread_local std::string rec;
+    rec.clear();
+    encode(rec, type, key, value);
+    appendRecords(runSeq, rec.data(), rec.size());
+    return rec.size();
+  }
+
+  // 把 n 条 records 作为一个 batch 追加，回放时要么全部应用要么全部丢弃
+  size_t appendBatch(uint64_t runSeq, const RecordType *types, const K *keys,
+                     const V *values, size_t n) {
+    if (n == 0) return 0;
+    std::string buf;
+    for (size_t i = 0; i < n; i++) {
+      uint8_t type = types[i] | (i + 1 < n ? kBatchContinues : 0);
+      encode(buf, static_cast<RecordType>(type), keys[i], values[i]);
+    }
+    appendRecords(runSeq, buf.data(), buf.size());
+    return buf.size();
+  }
+
+  // 序号小于 runSeq 的 runs 已经持久化到 disk level 中，删除它们的 segments
+  void releaseSegmentsBefore(uint64_t runSeq) {
+    std::lock_guard<std::mutex> lk(_mu);
+    while (_segments.size() > 1 && _segments.front().runSeq < runSeq) {
+      if (_segments.front().fd != -1) {
+        std::lock_guard<std::mutex> syncLk(_syncMu);
+        close(_segments.front().fd);
+      }
+      std::string filename = segmentName(_segments.front().id);
+      if (remove(filename.c_str())) {
+        perror(("Error removing WAL segment " + filename).c_str());
+      }
+      _segments.pop_front();
+    }
+  }
+
+  // 回放恢复出来的 segments，每个 segment 回放完调用一次 onSegmentEnd，
+  // 最后一个 segment 除外（它会成为继续写入的 segment）
+  template <class ApplyFn, class SegmentEndFn>
+  void replay(ApplyFn apply, SegmentEndFn onSegmentEnd) {
+    std::vector<uint64_t> toReplay;
+    {
+      std::lock_guard<std::mutex> lk(_mu);
+      for (auto &seg : _segments) toReplay.push_back(seg.id);
+    }
+
+    for (size_t i = 0; i < toReplay.size(); i++) {
+      replaySegment(toReplay[i], apply);
+      if (i + 1 < toReplay.size()) {
+        onSegmentEnd();
+      }
+    }
+  }
+
+ private:
+  std::string _dir;
+  WalSyncMode _mode;
+  int _syncIntervalMs;
+
+  struct Segment {
+    uint64_t id;
+    uint64_t runSeq;  // 对应的 C_0 run 的序号
+    int fd;           // 恢复出来的旧 segments 不再写入，为 -1
+  };
+
+  std::deque<Segment> _segments;  // 存活的 segments，最后一个是正在写的
+  uint64_t _nextSegmentID;
+  uint64_t _curRunSeq;
+
+  std::string _pending;  // group commit 中还没有写入的 records
+  uint64_t _nextLsn;
+  uint64_t _syncedLsn;
+  int _fd;  // 当前 run 的 segment，也就是 _segments.back().fd
+  bool _isLeaderActive;
+  bool _isStopping;
+
+  std::mutex _mu;
+  std::mutex _syncMu;  // interval 线程 fdatasync 时防止 fd 被关掉
+  std::condition_variable _cv;
+  std::thread _syncThread;
+
+  // 一次 write 写入若干条完整的 records，并发的写者之间不会交错
+  void appendRecords(uint64_t runSeq, const char *recs, size_t len) {
+    std::unique_lock<std::mutex> lk(_mu);
+    if (runSeq > _curRunSeq) {
+      rotateTo(runSeq, lk);
+    }
+    if (runSeq < _curRunSeq) {
+      appendToOlder(runSeq, recs, len);
+      return;
+    }
+    if (_mode != WalSyncMode::GROUP_COMMIT) {
+      writeAll(_fd, recs, len);
+      return;
+    }
+
+    _pending.append(recs, len);
+    uint64_t lsn = ++_nextLsn;
+    while (_syncedLsn < lsn) {
+      if (_isLeaderActive) {
+        _cv.wait(lk);
+        continue;
+      }
+
+      // 成为 leader，把当前所有等待中的 records 一次写入并 fdatasync
+      _isLeaderActive = true;
+      std::string batch;
+      batch.swap(_pending);
+      uint64_t batchLsn = _nextLsn;
+      int fd = _fd;
+      lk.unlock();
+
+      writeAll(fd, batch.data(), batch.size());
+      syncSegment(fd);
+
+      lk.lock();
+      _syncedLsn = batchLsn;
+      _isLeaderActive = false;
+      _cv.notify_all();
+    }
+  }
+
+  std::string segmentName(uint64_t id) {
+    return _dir + "/wal_" + std::to_string(id) + ".log";
+  }
+
+  void scanSegments() {
+    DIR *d = opendir(_dir.c_str());
+    if (d == nullptr) {
+      perror(("Error opening WAL directory " + _dir).c_str());
+      exit(EXIT_FAILURE);
+    }
+
+    std::vector<uint64_t> ids;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != nullptr) {
+      unsigned long long id;
+      char tail;
+      if (sscanf(ent->d_name, "wal_%llu.lo%c", &id, &tail) == 2 &&
+          tail == 'g') {
+        ids.push_back(id);
+      }
+    }
+    closedir(d);
+
+    std::sort(ids.begin(), ids.end());
+    for (size_t i = 0; i < ids.size(); i++) {
+      _segments.push_back(Segment{ids[i], i, -1});
+    }
+    if (!ids.empty()) {
+      _nextSegmentID = ids.back() + 1;
+    }
+  }
+
+  void openSegment(uint64_t id) {
+    _fd = open(segmentName(id).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+               (mode_t)0600);
+    if (_fd == -1) {
+      perror(("Error opening WAL segment " + segmentName(id)).c_str());
+      exit(EXIT_FAILURE);
+    }
+    // 新建的 segment 要在目录 fsync 之后才不会在掉电时整个丢掉
+    Manifest::syncDir(_dir);
+    _segments.push_back(Segment{id, _curRunSeq, _fd});
+  }
+
+  void openForAppend(uint64_t id) {
+    _fd = open(segmentName(id).c_str(), O_WRONLY | O_APPEND);
+    if (_fd == -1) {
+      perror(("Error opening WAL segment " + segmentName(id)).c_str());
+      exit(EXIT_FAILURE);
+    }
+    _segments.back().fd = _fd;
+  }
+
+  // 把已经缓存的 records 写进旧的 segment，再为到 runSeq 为止的每个 run
+  // 打开新的 segment。旧的 segment 保持打开，直到被 releaseSegmentsBefore 删除
+  void rotateTo(uint64_t runSeq, std::unique_lock<std::mutex> &lk) {
+    waitForLeader(lk);
+    if (runSeq <= _curRunSeq) return;
+    flushPending(_mode != WalSyncMode::NONE);
+
+    while (_curRunSeq < runSeq) {
+      _curRunSeq++;
+      openSegment(_nextSegmentID++);
+    }
+  }
+
+  // 写者在 run 切换之前预留了旧 run 中的位置，record 写进那个 run 的
+  // segment。旧 run 在这个写者返回之前不会被 flush，segment 一定还在。
+  // 这种情况很少，直接写入，需要持久性时立即 fdatasync
+  void appendToOlder(uint64_t runSeq, const char *recs, size_t len) {
+    for (auto it = _segments.rbegin(); it != _segments.rend(); ++it) {
+      if (it->runSeq == runSeq && it->fd != -1) {
+        writeAll(it->fd, recs, len);
+        if (_mode != WalSyncMode::NONE) syncSegment(it->fd);
+        return;
+      }
+    }
+    fprintf(stderr, "No WAL segment for run %llu in %s\n",
+            static_cast<unsigned long long>(runSeq), _dir.c_str());
+    exit(EXIT_FAILURE);
+  }
+
+  void waitForLeader(std::unique_lock<std::mutex> &lk) {
+    while (_isLeaderActive) {
+      _cv.wait(lk);
+    }
+  }
+
+  // 调用方持有 _mu 且没有 leader 正在写
+  void flushPending(bool doSync) {
+    if (!_pending.empty()) {
+      writeAll(_fd, _pending.data(), _pending.size());
+      _pending.clear();
+    }
+    if (doSync) {
+      syncSegment(_fd);
+    }
+    _syncedLsn = _nextLsn;
+    _cv.notify_all();
+  }
+
+  void syncLoop() {
+    std::unique_lock<std::mutex> lk(_mu);
+    while (!_isStopping) {
+      _cv.wait_for(lk, std::chrono::milliseconds(_syncIntervalMs));
+      if (_isStopping) break;
+      std::unique_lock<std::mutex> syncLk(_syncMu);
+      int fd = _fd;
+      lk.unlock();
+      syncSegment(fd);
+      syncLk.unlock();
+      lk.lock();
+    }
+  }
+
+  // 把一条 record 追加到 out 的末尾
+  static void encode(std::string &out, RecordType type, const K &key,
+                     const V &value) {
+    size_t start = out.size();
+    out.append(kHeaderSize, static_cast<char>(type));
+    SliceTraits<K>::encode(out, SliceTraits<K>::view(key));
+    SliceTraits<V>::encode(out, SliceTraits<V>::view(value));
+    uint32_t checksum;
+    MurmurHash3_x86_32(out.data() + start + sizeof(uint32_t),
+                       static_cast<int>(out.size() - start - sizeof(uint32_t)),
+                       0, &checksum);
+    memcpy(&out[start], &checksum, sizeof(uint32_t));
+  }
+
+  template <class ApplyFn>
+  void replaySegment(uint64_t id, ApplyFn &apply) {
+    int fd = open(segmentName(id).c_str(), O_RDWR);
+    if (fd == -1) {
+      perror(("Error opening WAL segment " + segmentName(id)).c_str());
+      exit(EXIT_FAILURE);
+    }
+
+    // record 不定长，整个 segment 读进来再逐条解析
+    std::string data;
+    readAll(fd, data);
+    const char *p = data.data(), *limit = data.data() + data.size();
+    off_t validLen = 0;
+    std::vector<std::pair<RecordType, std::pair<K, V>>> batch;
+    while (limit - p >= static_cast<long>(kHeaderSize)) {
+      K key;
+      V value;
+      const char *end = SliceTraits<K>::decode(p + kHeaderSize, limit, key);
+      if (end != nullptr) {
+        end = SliceTraits<V>::decode(end, limit, value);
+      }
+      if (end == nullptr) {
+        break;
+      }
+
+      uint32_t checksum, expected;
+      memcpy(&expected, p, sizeof(uint32_t));
+      MurmurHash3_x86_32(p + sizeof(uint32_t),
+                         static_cast<int>(end - p - sizeof(uint32_t)), 0,
+                         &checksum);
+      if (checksum != expected) {
+        break;
+      }
+
+      uint8_t type = static_cast<uint8_t>(p[sizeof(uint32_t)]);
+      batch.emplace_back(static_cast<RecordType>(type & ~kBatchContinues),
+                         std::make_pair(std::move(key), std::move(value)));
+      p = end;
+      if (type & kBatchContinues) {
+        continue;
+      }
+
+      for (auto &r : batch) {
+        apply(r.first, r.second.first, r.second.second);
+      }
+      batch.clear();
+      validLen = p - data.data();
+    }
+
+    // 截掉写了一半的尾部，之后追加的 records 才能被完整回放
+    if (ftruncate(fd, validLen) == -1) {
+      perror(("Error truncating WAL segment " + segmentName(id)).c_str());
+    }
+    close(fd);
+  }
+
+  static void readAll(int fd, std::string &out) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+      perror("Error reading WAL segment");
+      exit(EXIT_FAILURE);
+    }
+    out.resize(st.st_size);
+    size_t done = 0;
+    while (done < out.size()) {
+      ssize_t ret = pread(fd, &out[done], out.size() - done, done);
+      if (ret == -1 && errno == EINTR) continue;
+      if (ret <= 0) {
+        perror("Error reading WAL segment");
+        exit(EXIT_FAILURE);
+      }
+      done += ret;
+    }
+  }
+
+  // 刷盘失败时不能告诉写者写入已经持久，直接退出
+  static void syncSegment(int fd) {
+    if (fdatasync(fd) == -1) {
+      perror("Error syncing WAL segment");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  static void writeAll(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+      ssize_t ret = write(fd, buf, len);
+      if (ret == -1) {
+        perror("Error writing WAL segment");
+        exit(EXIT_FAILURE);
+      }
+      buf += ret;
+      len -= ret;
+    }
+  }
+};
+
+#endif  // LSMTREE_WAL_HPP
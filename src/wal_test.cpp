@@ -0,0 +1,144 @@
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lsm.hpp"
+#include "test_util.hpp"
+#include "wal.hpp"
+
+typedef WriteAheadLog<int, int> WAL;
+
+// 打开 dir 中的 WAL 并回放，返回回放出的 (key, value)，删除的 value 记为 -1
+std::vector<std::pair<int, int>> replayAll(const std::string &dir) {
+  std::vector<std::pair<int, int>> out;
+  WAL wal(dir, WalSyncMode::NONE, 0);
+  wal.replay(
+      [&](WAL::RecordType type, int &key, int &value) {
+        out.emplace_back(key, type == WAL::DELETE ? -1 : value);
+      },
+      []() {});
+  return out;
+}
+
+// 尾部写了一半的 record 被丢掉，之前的 records 都能回放，
+// 回放之后追加的 records 在下次打开时也能回放
+void testReplayAfterTornRecord() {
+  TempDir tmp;
+  std::string dir = tmp.file("wal");
+  {
+    WAL wal(dir, WalSyncMode::NONE, 0);
+    for (int i = 0; i < 100; i++) {
+      WAL::RecordType type = i % 10 == 0 ? WAL::DELETE : WAL::PUT;
+      wal.append(0, type, i, i * 3);
+    }
+  }
+  chopTail(newestSegment(dir), 3);
+
+  std::vector<std::pair<int, int>> replayed;
+  {
+    WAL wal(dir, WalSyncMode::NONE, 0);
+    wal.replay(
+        [&](WAL::RecordType type, int &key, int &value) {
+          replayed.emplace_back(key, type == WAL::DELETE ? -1 : value);
+        },
+        []() {});
+    wal.append(0, WAL::PUT, 1000, 1);
+  }
+  CHECK(replayed.size() == 99);
+  for (int i = 0; i < 99; i++) {
+    CHECK(replayed[i].first == i);
+    CHECK(replayed[i].second == (i % 10 == 0 ? -1 : i * 3));
+  }
+
+  replayed = replayAll(dir);
+  CHECK(replayed.size() == 100);
+  CHECK(replayed.back() == std::make_pair(1000, 1));
+}
+
+// batch 的最后一条 record 不完整时整个 batch 都不回放
+void testTornBatchIsDropped() {
+  TempDir tmp;
+  std::string dir = tmp.file("wal");
+  {
+    WAL wal(dir, WalSyncMode::NONE, 0);
+    wal.append(0, WAL::PUT, 1, 1);
+    WAL::RecordType types[4] = {WAL::PUT, WAL::PUT, WAL::DELETE, WAL::PUT};
+    int keys[4] = {10, 11, 12, 13}, values[4] = {10, 11, 0, 13};
+    wal.appendBatch(0, types, keys, values, 4);
+  }
+  chopTail(newestSegment(dir), 1);
+
+  std::vector<std::pair<int, int>> replayed = replayAll(dir);
+  CHECK(replayed.size() == 1);
+  CHECK(replayed[0] == std::make_pair(1, 1));
+}
+
+// run 切换之后才写入的旧 run 的 record 仍然写进旧 run 的 segment，
+// 跳过的 run 也有自己的 segment，回放时每条 record 落在写入时的 run 中
+void testLateRecordStaysInItsRun() {
+  TempDir tmp;
+  std::string dir = tmp.file("wal");
+  {
+    WAL wal(dir, WalSyncMode::GROUP_COMMIT, 0);
+    wal.append(0, WAL::PUT, 1, 1);
+    wal.append(2, WAL::PUT, 2, 2);
+    wal.append(0, WAL::PUT, 3, 3);
+    wal.append(1, WAL::PUT, 4, 4);
+    wal.append(2, WAL::PUT, 5, 5);
+  }
+
+  std::vector<std::vector<int>> runs(1);
+  WAL wal(dir, WalSyncMode::NONE, 0);
+  wal.replay(
+      [&](WAL::RecordType, int &key, int &) { runs.back().push_back(key); },
+      [&]() { runs.emplace_back(); });
+  CHECK(runs.size() == 3);
+  CHECK(runs[0] == std::vector<int>({1, 3}));
+  CHECK(runs[1] == std::vector<int>({4}));
+  CHECK(runs[2] == std::vector<int>({2, 5}));
+}
+
+// LSM 重新打开时从 WAL 恢复 C_0：最后一次写入写了一半，之前的写入都在，
+// 包括已经 flush 到 disk levels 的部分
+void testLSMReopenAfterTornRecord() {
+  TempDir tmp;
+  std::string dir = tmp.file("db");
+  const int n = 1000;
+  {
+    LSM<int, int> lsm(100, 4, 1.0, 0.01, 16, 4);
+    lsm.open(dir, WalSyncMode::NONE);
+    for (int i = 0; i < n; i++) {
+      int key = i, value = i + 7;
+      lsm.insertKey(key, value);
+    }
+  }
+  chopTail(newestSegment(dir + "/wal"), 2);
+
+  {
+    LSM<int, int> lsm(100, 4, 1.0, 0.01, 16, 4);
+    lsm.open(dir, WalSyncMode::NONE);
+    for (int i = 0; i < n - 1; i++) {
+      int key = i, value;
+      CHECK(lsm.search(key, value));
+      CHECK(value == i + 7);
+    }
+    int key = n - 1, value;
+    CHECK(!lsm.search(key, value));
+    value = 1;
+    lsm.insertKey(key, value);
+  }
+
+  LSM<int, int> lsm(100, 4, 1.0, 0.01, 16, 4);
+  lsm.open(dir, WalSyncMode::NONE);
+  int key = n - 1, value;
+  CHECK(lsm.search(key, value));
+  CHECK(value == 1);
+}
+
+int main() {
+  RUN_TEST(testReplayAfterTornRecord);
+  RUN_TEST(testTornBatchIsDropped);
+  RUN_TEST(testLateRecordStaysInItsRun);
+  RUN_TEST(testLSMReopenAfterTornRecord);
+  return 0;
+}
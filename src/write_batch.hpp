@@ -0,0 +1,56 @@
+#ifndef LSMTREE_WRITE_BATCH_HPP
+#define LSMTREE_WRITE_BATCH_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// 一组 puts 和 deletes，由 LSM::write 作为一个整体写入：
+// WAL 中整批要么全部回放要么全部丢弃，写入 C_0 时不会跨越 run 的切换。
+// 去重之后放不进一个 C_0 run 的 batch 会被 LSM::write 整个拒绝
+template <class K, class V>
+class WriteBatch {
+ public:
+  enum OpType : uint8_t { PUT = 0, DELETE = 1 };  // 和 WAL 的 record 类型一致
+
+  struct Entry {
+    K key;
+    V value;
+    OpType type;
+  };
+
+  void insertKey(const K &key, const V &value) {
+    _entries.push_back(Entry{key, value, PUT});
+  }
+
+  void deleteKey(const K &key) {
+    _entries.push_back(Entry{key, V(), DELETE});
+  }
+
+  void clear() { _entries.clear(); }
+
+  size_t count() const { return _entries.size(); }
+
+  // 按 key 升序排列，同一个 key 只保留最后一次操作
+  std::vector<Entry> sorted() const {
+    std::vector<Entry> entries(_entries);
+    std::stable_sort(
+        entries.begin(), entries.end(),
+        [](const Entry &a, const Entry &b) { return a.key < b.key; });
+    size_t n = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+      if (n > 0 && entries[n - 1].key == entries[i].key) {
+        entries[n - 1] = entries[i];
+      } else {
+        entries[n++] = entries[i];
+      }
+    }
+    entries.resize(n);
+    return entries;
+  }
+
+ private:
+  std::vector<Entry> _entries;  // 按调用顺序
+};
+
+#endif  // LSMTREE_WRITE_BATCH_HPP
@@ -0,0 +1,102 @@
+#include <map>
+#include <string>
+
+#include "lsm.hpp"
+#include "test_util.hpp"
+#include "write_batch.hpp"
+
+const int kKeySpace = 2000;
+
+// 一个 batch：从 first 开始的 n 个 keys，每 7 个删除一个，其余写入 value
+void fillBatch(WriteBatch<int, int> &batch, std::map<int, int> &ref, int first,
+               int n, int value) {
+  for (int i = 0; i < n; i++) {
+    int key = (first + i) % kKeySpace;
+    if (i % 7 == 0) {
+      batch.deleteKey(key);
+      ref.erase(key);
+    } else {
+      batch.insertKey(key, value + i);
+      ref[key] = value + i;
+    }
+  }
+}
+
+// 去重之后超过一个 run 的 batch 整个被拒绝，什么都不写入；
+// 重复的 keys 去重之后放得下时整批写入，同一个 key 保留最后一次操作
+void testOversizedBatchRejected() {
+  TempDir tmp;
+  auto lsm = openLSM(tmp.path(), false);
+  std::map<int, int> ref;
+  int key = 5, value = 1;
+  lsm->insertKey(key, value);
+  ref[key] = value;
+
+  WriteBatch<int, int> big;
+  for (int i = 0; i <= lsm->maxBatchSize(); i++) big.insertKey(i, -1);
+  CHECK(!lsm->write(big));
+  checkContents(*lsm, ref, kKeySpace);
+
+  WriteBatch<int, int> dup;
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < lsm->maxBatchSize(); i++) dup.insertKey(i, round);
+  }
+  dup.deleteKey(5);
+  CHECK(lsm->write(dup));
+  for (int i = 0; i < lsm->maxBatchSize(); i++) ref[i] = 2;
+  ref.erase(5);
+  checkContents(*lsm, ref, kKeySpace);
+
+  WriteBatch<int, int> empty;
+  CHECK(lsm->write(empty));
+  checkContents(*lsm, ref, kKeySpace);
+}
+
+// batches 和单个写入交替，中间有 flush 和 merge。重新打开之后 C_0 中的
+// batches 从 WAL 回放，内容和关闭之前一样
+void testBatchReplay() {
+  TempDir tmp;
+  std::map<int, int> ref;
+  {
+    auto lsm = openLSM(tmp.path(), false);
+    for (int b = 0; b < 300; b++) {
+      WriteBatch<int, int> batch;
+      fillBatch(batch, ref, b * 37, 1 + b % lsm->maxBatchSize(), b * 1000);
+      CHECK(lsm->write(batch));
+      int key = (b * 13) % kKeySpace, value = -b;
+      lsm->insertKey(key, value);
+      ref[key] = value;
+    }
+    checkContents(*lsm, ref, kKeySpace);
+  }
+
+  auto lsm = openLSM(tmp.path(), false);
+  checkContents(*lsm, ref, kKeySpace);
+}
+
+// 最后一个 batch 的 WAL records 写了一半时重新打开：整个 batch 都不在，
+// 之前的写入都在
+void testTornBatchReopen() {
+  TempDir tmp;
+  std::map<int, int> ref;
+  {
+    auto lsm = openLSM(tmp.path(), false);
+    writeRandom(*lsm, ref, 150, 1, kKeySpace, 10);
+    std::map<int, int> before = ref;
+    WriteBatch<int, int> batch;
+    fillBatch(batch, ref, 100, 40, 7000);
+    CHECK(lsm->write(batch));
+    ref = before;
+  }
+  chopTail(newestSegment(tmp.file("wal")), 1);
+
+  auto lsm = openLSM(tmp.path(), false);
+  checkContents(*lsm, ref, kKeySpace);
+}
+
+int main() {
+  RUN_TEST(testOversizedBatchRejected);
+  RUN_TEST(testBatchReplay);
+  RUN_TEST(testTornBatchReopen);
+  return 0;
+}